@@ -0,0 +1,211 @@
+#include "checkpoint.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <format>
+#include <fstream>
+#include <algorithm>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#endif
+
+namespace ldbg {
+#ifdef __linux__
+	bool Checkpoints::supported() {
+		return true;
+	}
+
+	uint32_t Checkpoints::create(const std::string& label, bool& restarted, std::string& payload) {
+		if (dir.empty()) {
+			// a fresh private directory, so nobody else can plant FIFOs or labels in it
+			const char* runtime = getenv("XDG_RUNTIME_DIR");
+			std::string path = std::format("{}/ldbg-XXXXXX", runtime && *runtime ? runtime : "/tmp");
+			if (!mkdtemp(path.data()))
+				return 0;
+
+			if (mkfifo((path + "/root").c_str(), 0600)) {
+				rmdir(path.c_str());
+				return 0;
+			}
+
+			root = getpid();
+			dir = std::move(path);
+		}
+
+		uint32_t n = 1;
+		for (const auto& [num, _] : list())
+			n = std::max(n, num + 1);
+
+		const std::string fifo = std::format("{}/{}", dir, n);
+		if (mkfifo(fifo.c_str(), 0600))
+			return 0;
+
+		std::ofstream(fifo + ".label") << label;
+
+		// anything still buffered would be written once by each process
+		fflush(nullptr);
+
+		const pid_t pid = fork();
+		if (pid < 0) {
+			unlink(fifo.c_str());
+			unlink((fifo + ".label").c_str());
+			return 0;
+		}
+
+		if (pid == 0)
+			wait(fifo, restarted, payload);
+		return n;
+	}
+
+	bool Checkpoints::restart(uint32_t n, const std::string& payload) {
+		if (dir.empty() || !send(std::format("{}/{}", dir, n), "r" + payload))
+			return false;
+
+		fflush(nullptr);
+
+		// the shell waits on the root, so it lingers until the session ends and exits with the final status
+		if (getpid() == root) {
+			bool restarted = false;
+			std::string unused;
+			wait(dir + "/root", restarted, unused);
+		}
+		_exit(0);
+	}
+
+	std::vector<std::pair<uint32_t, std::string>> Checkpoints::list() const {
+		std::vector<std::pair<uint32_t, std::string>> result;
+		if (dir.empty())
+			return result;
+
+		DIR* d = opendir(dir.c_str());
+		if (!d)
+			return result;
+
+		while (dirent* entry = readdir(d)) {
+			const std::string name = entry->d_name;
+			if (name.empty() || !std::all_of(name.begin(), name.end(), [](unsigned char c) { return isdigit(c); }))
+				continue;
+
+			std::string label;
+			std::getline(std::ifstream(std::format("{}/{}.label", dir, name)), label);
+			result.emplace_back((uint32_t)std::stoul(name), std::move(label));
+		}
+		closedir(d);
+
+		std::sort(result.begin(), result.end());
+		return result;
+	}
+
+	void Checkpoints::end(int status) {
+		if (dir.empty())
+			return;
+
+		for (const auto& [n, label] : list()) {
+			const std::string fifo = std::format("{}/{}", dir, n);
+			send(fifo, "q");
+			unlink(fifo.c_str());
+			unlink((fifo + ".label").c_str());
+		}
+
+		if (getpid() != root)
+			send(dir + "/root", std::format("q{}", status));
+
+		unlink((dir + "/root").c_str());
+		rmdir(dir.c_str());
+		dir.clear();
+	}
+
+	bool Checkpoints::send(const std::string& fifo, const std::string& message) const {
+		// fails instead of blocking when nobody waits on the other end; a fresh checkpoint may not be waiting yet
+		int fd = -1;
+		for (int attempt = 0; attempt < 100 && fd < 0; attempt++) {
+			fd = open(fifo.c_str(), O_WRONLY | O_NONBLOCK);
+			if (fd < 0 && errno != ENXIO)
+				return false;
+			if (fd < 0)
+				usleep(10 * 1000);
+		}
+
+		if (fd < 0)
+			return false;
+
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+		size_t written = 0;
+		while (written < message.size()) {
+			const ssize_t n = write(fd, message.data() + written, message.size() - written);
+			if (n < 0) {
+				if (errno == EINTR)
+					continue;
+				break;
+			}
+			written += n;
+		}
+
+		close(fd);
+		return written == message.size();
+	}
+
+	void Checkpoints::wait(const std::string& fifo, bool& restarted, std::string& payload) const {
+		while (true) {
+			const int fd = open(fifo.c_str(), O_RDONLY);
+			if (fd < 0) {
+				if (errno == EINTR)
+					continue;
+				_exit(1);
+			}
+
+			std::string message;
+			char buf[4096];
+			for (ssize_t n; (n = read(fd, buf, sizeof(buf))) != 0;) {
+				if (n < 0) {
+					if (errno == EINTR)
+						continue;
+					break;
+				}
+				message.append(buf, n);
+			}
+			close(fd);
+
+			// copies restarted earlier are children of this process
+			while (waitpid(-1, nullptr, WNOHANG) > 0) {}
+
+			if (message.empty())
+				continue;
+
+			if (message[0] != 'r')
+				_exit(atoi(message.c_str() + 1));
+
+			// the copy that resumes is forked off so that this one stays suspended at the checkpoint
+			if (fork() == 0) {
+				restarted = true;
+				payload = message.substr(1);
+				return;
+			}
+		}
+	}
+#else
+	bool Checkpoints::supported() {
+		return false;
+	}
+
+	uint32_t Checkpoints::create(const std::string& label, bool& restarted, std::string& payload) {
+		return 0;
+	}
+
+	bool Checkpoints::restart(uint32_t n, const std::string& payload) {
+		return false;
+	}
+
+	std::vector<std::pair<uint32_t, std::string>> Checkpoints::list() const {
+		return {};
+	}
+
+	void Checkpoints::end(int status) {}
+#endif
+}
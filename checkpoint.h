@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <utility>
+
+namespace ldbg {
+	/// <summary>
+	/// Snapshots of the whole process kept as suspended fork() children, so restoring one is copy-on-write
+	/// and takes milliseconds. Each snapshot waits on a FIFO in a per-session directory, which lets any
+	/// process of the session restart it. Only available on Linux
+	/// </summary>
+	class Checkpoints {
+	public:
+		~Checkpoints() { end(); }
+
+		static bool supported();
+
+		/// <summary>
+		/// Forks a suspended copy of the process
+		/// </summary>
+		/// <param name="label">Shown when listing checkpoints</param>
+		/// <param name="restarted">Set in the copy once it's restarted</param>
+		/// <param name="payload">Receives what the restarting process sent along</param>
+		/// <returns>The checkpoint number, or 0 on failure. In the copy this only returns once restarted</returns>
+		uint32_t create(const std::string& label, bool& restarted, std::string& payload);
+
+		/// <summary>
+		/// Resumes a copy of a checkpoint, which stays available, and retires this process
+		/// </summary>
+		/// <returns>false if the checkpoint doesn't exist; doesn't return otherwise</returns>
+		bool restart(uint32_t n, const std::string& payload);
+
+		/// <summary>
+		/// Lists the live checkpoints of the session with their labels
+		/// </summary>
+		std::vector<std::pair<uint32_t, std::string>> list() const;
+
+		/// <summary>
+		/// Tells every suspended process of the session to exit and removes the session directory
+		/// </summary>
+		/// <param name="status">Exit status of the run; the root, which the shell waits on, exits with it</param>
+		void end(int status = 0);
+
+	private:
+		// process the shell waits on; it stays around until the session ends
+		int root = 0;
+		std::string dir;
+
+		bool send(const std::string& fifo, const std::string& message) const;
+		void wait(const std::string& fifo, bool& restarted, std::string& payload) const;
+	};
+}
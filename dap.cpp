@@ -0,0 +1,654 @@
+#include "dap.h"
+
+#include <algorithm>
+#include <string_view>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#include <ltable.h>
+
+#include "ldbg.h"
+#include "render.h"
+
+#ifdef _WIN32
+using socket_t = SOCKET;
+#define closesock closesocket
+#define SHUT_RDWR SD_BOTH
+#else
+using socket_t = int;
+#define closesock close
+#define INVALID_SOCKET (-1)
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace ldbg {
+	// children sent per table in a single variables response when the client doesn't page
+	constexpr uint32_t maxTableChildren = 1000;
+
+	DapServer::DapServer(Debugger& dbg) : dbg(dbg) {
+		dbg.dap = this;
+	}
+
+	DapServer::~DapServer() {
+		if (connected)
+			event("terminated");
+
+		{
+			std::lock_guard lock(mutex);
+			stopping = true;
+		}
+		outgoingCv.notify_all();
+
+		// the writer flushes whatever is still queued before exiting
+		if (writer.joinable())
+			writer.join();
+
+		if (client != -1) {
+			shutdown((socket_t)client, SHUT_RDWR);
+			if (reader.joinable())
+				reader.join();
+			closesock((socket_t)client);
+		}
+
+		if (listener != -1)
+			closesock((socket_t)listener);
+
+#ifdef _WIN32
+		WSACleanup();
+#else
+		if (!unixPath.empty())
+			unlink(unixPath.c_str());
+#endif
+
+		if (dbg.dap == this)
+			dbg.dap = nullptr;
+	}
+
+	bool DapServer::listen(const std::string& address) {
+#ifdef _WIN32
+		WSADATA wsa;
+		if (WSAStartup(MAKEWORD(2, 2), &wsa))
+			return false;
+#endif
+
+		socket_t s = INVALID_SOCKET;
+		if (address.rfind("tcp:", 0) == 0) {
+			int port = atoi(address.c_str() + 4);
+			if (port <= 0 || port > 65535)
+				return false;
+
+			s = socket(AF_INET, SOCK_STREAM, 0);
+			if (s == INVALID_SOCKET)
+				return false;
+
+			int yes = 1;
+			setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)&yes, sizeof(yes));
+
+			sockaddr_in addr = {};
+			addr.sin_family = AF_INET;
+			addr.sin_port = htons((uint16_t)port);
+			addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+			if (bind(s, (const sockaddr*)&addr, sizeof(addr)) != 0) {
+				closesock(s);
+				return false;
+			}
+		}
+#ifndef _WIN32
+		else if (address.rfind("unix:", 0) == 0) {
+			const std::string path = address.substr(5);
+
+			sockaddr_un addr = {};
+			if (path.empty() || path.size() >= sizeof(addr.sun_path))
+				return false;
+
+			addr.sun_family = AF_UNIX;
+			memcpy(addr.sun_path, path.c_str(), path.size());
+
+			s = socket(AF_UNIX, SOCK_STREAM, 0);
+			if (s == INVALID_SOCKET)
+				return false;
+
+			unlink(path.c_str());
+			if (bind(s, (const sockaddr*)&addr, sizeof(addr)) != 0) {
+				closesock(s);
+				return false;
+			}
+			unixPath = path;
+		}
+#endif
+		else
+			return false;
+
+		if (::listen(s, 1) != 0) {
+			closesock(s);
+			return false;
+		}
+
+		listener = (intptr_t)s;
+		return true;
+	}
+
+	bool DapServer::accept() {
+		if (listener == -1)
+			return false;
+
+		socket_t c = ::accept((socket_t)listener, nullptr, nullptr);
+		if (c == INVALID_SOCKET)
+			return false;
+
+		// responses are small and latency bound
+		int yes = 1;
+		setsockopt(c, IPPROTO_TCP, TCP_NODELAY, (const char*)&yes, sizeof(yes));
+
+		client = (intptr_t)c;
+		connected = true;
+
+		reader = std::thread(&DapServer::readLoop, this);
+		writer = std::thread(&DapServer::writeLoop, this);
+		return true;
+	}
+
+	void DapServer::readLoop() {
+		std::string buffer;
+		char chunk[4096];
+
+		while (true) {
+			int n = (int)recv((socket_t)client, chunk, sizeof(chunk), 0);
+			if (n <= 0)
+				break;
+			buffer.append(chunk, n);
+
+			// drain every complete message so they reach the VM thread as one batch
+			std::vector<Json> messages;
+			while (true) {
+				size_t header = buffer.find("\r\n\r\n");
+				if (header == std::string::npos)
+					break;
+
+				size_t lengthPos = buffer.find("Content-Length:");
+				if (lengthPos == std::string::npos || lengthPos > header) {
+					buffer.erase(0, header + 4);
+					continue;
+				}
+
+				size_t length = strtoul(buffer.c_str() + lengthPos + 15, nullptr, 10);
+				if (buffer.size() < header + 4 + length)
+					break;
+
+				Json message;
+				bool ok = Json::parse(buffer.substr(header + 4, length), message);
+				buffer.erase(0, header + 4 + length);
+				if (!ok)
+					continue;
+
+				// pause has to work while the VM is running and not polling for anything else
+				if (message["command"].string == "pause")
+					dbg.pause();
+
+				messages.push_back(std::move(message));
+			}
+
+			if (!messages.empty()) {
+				{
+					std::lock_guard lock(mutex);
+					for (auto& m : messages)
+						incoming.push_back(std::move(m));
+				}
+				pending = true;
+				incomingCv.notify_one();
+
+				// without singlestep the VM only looks at requests from its interrupt hook
+				dbg.requestInterrupt();
+			}
+		}
+
+		connected = false;
+		pending = true;
+		incomingCv.notify_one();
+	}
+
+	void DapServer::writeLoop() {
+		std::unique_lock lock(mutex);
+		while (true) {
+			outgoingCv.wait(lock, [this] { return stopping || !outgoing.empty(); });
+			if (outgoing.empty())
+				break;
+
+			// everything queued since the last wakeup goes out together
+			std::string data = std::move(outgoing);
+			outgoing.clear();
+			lock.unlock();
+
+			size_t off = 0;
+			while (off < data.size()) {
+				int n = (int)::send((socket_t)client, data.data() + off, (int)(data.size() - off), MSG_NOSIGNAL);
+				if (n <= 0)
+					break;
+				off += n;
+			}
+
+			lock.lock();
+		}
+	}
+
+	void DapServer::send(const Json& message) {
+		const std::string& body = message.dump();
+		{
+			std::lock_guard lock(mutex);
+			outgoing += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+			outgoing += body;
+		}
+		outgoingCv.notify_one();
+	}
+
+	void DapServer::respond(const Json& request, bool success, Json body, const char* message) {
+		Json response = Json::makeObject();
+		response.set("seq", ++seq);
+		response.set("type", "response");
+		response.set("request_seq", request["seq"].integer());
+		response.set("command", request["command"].string);
+		response.set("success", success);
+		if (message)
+			response.set("message", message);
+		if (!body.isNull())
+			response.set("body", std::move(body));
+
+		if (batchResponses)
+			batchResponses->push(std::move(response));
+		else
+			send(response);
+	}
+
+	void DapServer::event(const char* name, Json body) {
+		Json message = Json::makeObject();
+		message.set("seq", ++seq);
+		message.set("type", "event");
+		message.set("event", name);
+		if (!body.isNull())
+			message.set("body", std::move(body));
+
+		send(message);
+	}
+
+	std::vector<Json> DapServer::takeRequests(bool wait) {
+		std::vector<Json> batch;
+
+		std::unique_lock lock(mutex);
+		if (wait)
+			incomingCv.wait(lock, [this] { return !incoming.empty() || !connected; });
+
+		batch.swap(incoming);
+		pending = false;
+		return batch;
+	}
+
+	void DapServer::poll(lua_State* L) {
+		for (const auto& request : takeRequests(false))
+			handle(L, request, false);
+	}
+
+	void DapServer::pause(lua_State* L, const char* reason) {
+		// the first stop only exists to receive the client's configuration
+		if (!entered) {
+			entered = true;
+			while (connected && !configured) {
+				for (const auto& request : takeRequests(true))
+					handle(L, request, true);
+			}
+
+			if (!stopOnEntry || !connected) {
+				dbg.resume();
+				return;
+			}
+			reason = "entry";
+		}
+
+		event("stopped", Json::makeObject()
+			.set("reason", reason)
+			.set("threadId", 1)
+			.set("allThreadsStopped", true)
+		);
+
+		resume = false;
+		while (connected && !resume) {
+			for (const auto& request : takeRequests(true))
+				handle(L, request, !resume);
+		}
+
+		releaseVarRefs(L);
+
+		if (!connected) {
+			dbg.resume();
+		}
+	}
+
+	static std::string chunkSource(const Proto* p) {
+		char ss[LUA_IDSIZE];
+		return luaO_chunkid(ss, sizeof(ss), getstr(p->source), p->source->len);
+	}
+
+	// client paths are absolute while chunk names are usually relative to the working directory
+	static bool pathMatches(std::string path, std::string_view chunk) {
+		std::replace(path.begin(), path.end(), '\\', '/');
+		if (chunk.substr(0, 2) == "./")
+			chunk.remove_prefix(2);
+
+		if (path.size() < chunk.size())
+			return false;
+
+		std::string normalized(chunk);
+		std::replace(normalized.begin(), normalized.end(), '\\', '/');
+		if (path.compare(path.size() - normalized.size(), normalized.size(), normalized))
+			return false;
+
+		return path.size() == normalized.size() || path[path.size() - normalized.size() - 1] == '/';
+	}
+
+	void DapServer::setBreakpoints(lua_State* L, const Json& request) {
+		const Json& args = request["arguments"];
+		const std::string& path = args["source"]["path"].string;
+
+		const Proto* match = nullptr;
+		for (const auto& p : dbg.loadedProtos) {
+			if (p->source && p->source->len > 1 && getstr(p->source)[0] == '@' && pathMatches(path, std::string_view(getstr(p->source) + 1, p->source->len - 1))) {
+				match = p;
+				break;
+			}
+		}
+
+		Json result = Json::makeArray();
+		if (!match) {
+			for (const auto& bp : args["breakpoints"].array)
+				result.push(Json::makeObject().set("verified", false).set("line", bp["line"].integer()).set("message", "source not loaded"));
+
+			respond(request, true, Json::makeObject().set("breakpoints", std::move(result)));
+			return;
+		}
+
+		// the request carries the full set for the source, so previous ones are cleared first
+		const std::string& source = chunkSource(match);
+		for (size_t i = dbg.breakpoints.size(); i-- > 0;) {
+			const Breakpoint bp = dbg.breakpoints[i];
+			if (bp.source == source)
+				dbg.setBreakpoint(L, bp.p, bp.pc, bp.source, bp.line, false);
+		}
+
+		for (const auto& requested : args["breakpoints"].array) {
+			const int line = requested["line"].integer();
+			if (line > 0)
+				dbg.setBreakpoint(L, source, (uint32_t)line, true);
+
+			bool verified = std::any_of(dbg.breakpoints.begin(), dbg.breakpoints.end(), [&](const Breakpoint& bp) {
+				return bp.source == source && (int)bp.line == line;
+			});
+			result.push(Json::makeObject().set("verified", verified).set("line", line));
+		}
+
+		respond(request, true, Json::makeObject().set("breakpoints", std::move(result)));
+	}
+
+	int DapServer::pushVarRef(VarRef ref) {
+		varRefs.push_back(ref);
+		return (int)varRefs.size();
+	}
+
+	void DapServer::releaseVarRefs(lua_State* L) {
+		for (const auto& ref : varRefs) {
+			if (ref.ref != LUA_NOREF)
+				lua_unref(L, ref.ref);
+		}
+		varRefs.clear();
+	}
+
+	// hash slots that hold a value; the named children of a table
+	static int usedNodes(const Table* t) {
+		if (t->node == dummynode)
+			return 0;
+
+		int used = 0;
+		for (int i = 0; i < sizenode(t); i++)
+			used += !ttisnil(gval(gnode(t, i)));
+		return used;
+	}
+
+	Json DapServer::variable(lua_State* L, const std::string& name, const TValue* o) {
+		Json v = Json::makeObject();
+		v.set("name", name);
+		v.set("value", renderValue(o, { 0, 0, 256 }));
+		v.set("type", luaT_typenames[ttype(o)]);
+		v.set("variablesReference", 0);
+
+		// tables are only expanded when the client asks for their children
+		if (ttistable(o)) {
+			const Table* t = hvalue(o);
+
+			setobj2s(L, L->top, o);
+			incr_top(L);
+			int ref = lua_ref(L, -1);
+			lua_pop(L, 1);
+
+			v.set("variablesReference", pushVarRef({ VarRef::Kind::Table, 0, ref }));
+			v.set("indexedVariables", t->sizearray);
+			v.set("namedVariables", usedNodes(t));
+		}
+
+		return v;
+	}
+
+	void DapServer::variables(lua_State* L, const Json& request) {
+		const Json& args = request["arguments"];
+
+		const int id = args["variablesReference"].integer();
+		if (id < 1 || id > (int)varRefs.size()) {
+			respond(request, false, {}, "invalid variables reference");
+			return;
+		}
+
+		const VarRef vr = varRefs[id - 1];
+		Json vars = Json::makeArray();
+
+		switch (vr.kind) {
+		case VarRef::Kind::Locals:
+			for (int n = 1; const char* name = lua_getlocal(L, vr.level, n); n++) {
+				vars.push(variable(L, name, L->top - 1));
+				lua_pop(L, 1);
+			}
+			break;
+		case VarRef::Kind::Upvalues: {
+			lua_Debug ar;
+			if (!lua_getinfo(L, vr.level, "f", &ar))
+				break;
+
+			for (int n = 1; const char* name = lua_getupvalue(L, -1, n); n++) {
+				vars.push(variable(L, *name ? name : "U" + std::to_string(n - 1), L->top - 1));
+				lua_pop(L, 1);
+			}
+			lua_pop(L, 1);
+		} break;
+		case VarRef::Kind::Table: {
+			lua_getref(L, vr.ref);
+			const Table* t = hvalue(L->top - 1);
+
+			const std::string& filter = args["filter"].string;
+			const uint32_t start = (uint32_t)std::max(args["start"].integer(), 0);
+			const uint32_t count = args["count"].integer() > 0 ? (uint32_t)args["count"].integer() : maxTableChildren;
+
+			// children are the array part followed by the used nodes; a filter keeps one of the two, and start and
+			// count page over what's left so that pages never overlap
+			const uint64_t end = (uint64_t)start + count;
+			uint64_t position = 0;
+
+			if (filter != "named") {
+				for (int i = 0; i < t->sizearray && position < end; i++, position++) {
+					if (position >= start)
+						vars.push(variable(L, "[" + std::to_string(i + 1) + "]", &t->array[i]));
+				}
+			}
+
+			if (filter != "indexed" && t->node != dummynode) {
+				for (int i = 0; i < sizenode(t) && position < end; i++) {
+					const LuaNode* n = gnode(t, i);
+					if (ttisnil(gval(n)) || position++ < start)
+						continue;
+
+					TValue k;
+					k.value = n->key.value;
+					memcpy(k.extra, n->key.extra, sizeof(k.extra));
+					k.tt = n->key.tt;
+
+					const std::string& name = ttisstring(&k) ? std::string(getstr(tsvalue(&k)), tsvalue(&k)->len) : "[" + renderValue(&k, { 0, 0, 64 }) + "]";
+					vars.push(variable(L, name, gval(n)));
+				}
+			}
+
+			lua_pop(L, 1);
+		} break;
+		}
+
+		respond(request, true, Json::makeObject().set("variables", std::move(vars)));
+	}
+
+	void DapServer::handle(lua_State* L, const Json& request, bool paused) {
+		const std::string& command = request["command"].string;
+		const Json& args = request["arguments"];
+
+		if (command == "initialize") {
+			respond(request, true, Json::makeObject()
+				.set("supportsConfigurationDoneRequest", true)
+				.set("supportsEvaluateForHovers", true)
+				.set("supportsDelayedStackTraceLoading", true)
+			);
+			event("initialized");
+		}
+		else if (command == "launch" || command == "attach") {
+			stopOnEntry = args["stopOnEntry"].truthy();
+			respond(request, true);
+		}
+		else if (command == "configurationDone") {
+			configured = true;
+			respond(request, true);
+		}
+		else if (command == "threads") {
+			respond(request, true, Json::makeObject().set("threads", Json::makeArray()
+				.push(Json::makeObject().set("id", 1).set("name", "main"))
+			));
+		}
+		else if (command == "setBreakpoints")
+			setBreakpoints(L, request);
+		else if (command == "pause")
+			respond(request, true);
+		else if (command == "disconnect") {
+			respond(request, true);
+			connected = false;
+			resume = true;
+			dbg.resume();
+		}
+		else if (command == "batch") {
+			// non-standard: {"requests": [...]} is answered by one response carrying every sub-response
+			Json responses = Json::makeArray();
+			Json* outer = batchResponses;
+			batchResponses = &responses;
+
+			for (const auto& sub : args["requests"].array)
+				handle(L, sub, paused && !resume);
+
+			batchResponses = outer;
+			respond(request, true, Json::makeObject().set("responses", std::move(responses)));
+		}
+		else if (!paused)
+			respond(request, false, {}, "not paused");
+		else if (command == "stackTrace") {
+			const int start = std::max(args["startFrame"].integer(), 0);
+			const int levels = args["levels"].integer();
+			const int total = (int)(L->ci - L->base_ci);
+
+			Json frames = Json::makeArray();
+
+			lua_Debug ar;
+			for (int level = start; (levels <= 0 || level < start + levels) && lua_getinfo(L, level, "sln", &ar); level++) {
+				Json frame = Json::makeObject();
+				frame.set("id", level);
+				frame.set("name", ar.name ? ar.name : "??");
+				frame.set("line", std::max(ar.currentline, 0));
+				frame.set("column", ar.currentline > 0 ? 1 : 0);
+				if (ar.source && ar.source[0] == '@')
+					frame.set("source", Json::makeObject().set("name", ar.short_src).set("path", ar.source + 1));
+
+				frames.push(std::move(frame));
+			}
+
+			respond(request, true, Json::makeObject().set("stackFrames", std::move(frames)).set("totalFrames", total));
+		}
+		else if (command == "scopes") {
+			const int level = args["frameId"].integer();
+
+			respond(request, true, Json::makeObject().set("scopes", Json::makeArray()
+				.push(Json::makeObject()
+					.set("name", "Locals")
+					.set("presentationHint", "locals")
+					.set("variablesReference", pushVarRef({ VarRef::Kind::Locals, level, LUA_NOREF }))
+					.set("expensive", false))
+				.push(Json::makeObject()
+					.set("name", "Upvalues")
+					.set("variablesReference", pushVarRef({ VarRef::Kind::Upvalues, level, LUA_NOREF }))
+					.set("expensive", false))
+			));
+		}
+		else if (command == "variables")
+			variables(L, request);
+		else if (command == "evaluate") {
+			// expressions always see the innermost frame
+			const std::string& expr = args["expression"].string;
+			const int count = dbg.evaluate(L, expr);
+			if (count < 0) {
+				respond(request, false, {}, "evaluation failed");
+				return;
+			}
+
+			Json body = Json::makeObject().set("result", "").set("variablesReference", 0);
+			if (count > 0) {
+				const Json& v = variable(L, expr, L->top - count);
+				body.set("result", v["value"]);
+				body.set("variablesReference", v["variablesReference"]);
+				lua_pop(L, count);
+			}
+
+			respond(request, true, std::move(body));
+		}
+		else if (command == "continue") {
+			dbg.resume();
+			resume = true;
+			respond(request, true, Json::makeObject().set("allThreadsContinued", true));
+		}
+		else if (command == "next" || command == "stepIn") {
+			if (command == "next")
+				dbg.nextLine(L);
+			else
+				dbg.stepLine(L);
+			resume = true;
+			respond(request, true);
+		}
+		else if (command == "stepOut") {
+			dbg.stepOut(L);
+			resume = true;
+			respond(request, true);
+		}
+		else
+			respond(request, false, {}, "unsupported request");
+	}
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <condition_variable>
+
+#include <lua.h>
+#include <lstate.h>
+
+#include "json.h"
+
+namespace ldbg {
+	class Debugger;
+
+	/// <summary>
+	/// Debug Adapter Protocol front end for a Debugger. Socket I/O and event delivery run on
+	/// their own threads; requests are handled on the VM thread, in batches, either while
+	/// paused or between instructions while the script is running
+	/// </summary>
+	class DapServer {
+	public:
+		explicit DapServer(Debugger& dbg);
+		~DapServer();
+
+		DapServer(const DapServer&) = delete;
+		DapServer& operator=(const DapServer&) = delete;
+
+		/// <summary>
+		/// Starts listening for a client
+		/// </summary>
+		/// <param name="address">"tcp:&lt;port&gt;" on the loopback interface or "unix:&lt;path&gt;"</param>
+		/// <returns>false if the address is invalid or can't be bound</returns>
+		bool listen(const std::string& address);
+
+		/// <summary>
+		/// Blocks until a client connects and starts the I/O threads
+		/// </summary>
+		bool accept();
+
+		bool isConnected() const { return connected; }
+
+	private:
+		friend class Debugger;
+
+		struct VarRef {
+			enum class Kind {
+				Locals,
+				Upvalues,
+				Table
+			};
+
+			Kind kind;
+			int level;
+			int ref;
+		};
+
+		Debugger& dbg;
+
+		intptr_t listener = -1;
+		intptr_t client = -1;
+		std::string unixPath;
+
+		std::thread reader;
+		std::thread writer;
+
+		std::mutex mutex;
+		std::condition_variable incomingCv;
+		std::condition_variable outgoingCv;
+		std::vector<Json> incoming;
+		std::string outgoing;
+		bool stopping = false;
+
+		std::atomic<bool> connected = false;
+		std::atomic<bool> pending = false;
+
+		int seq = 0;
+		bool entered = false;
+		bool configured = false;
+		bool stopOnEntry = false;
+		bool resume = false;
+
+		std::vector<VarRef> varRefs;
+		Json* batchResponses = nullptr;
+
+		void readLoop();
+		void writeLoop();
+
+		void send(const Json& message);
+		void respond(const Json& request, bool success, Json body = {}, const char* message = nullptr);
+		void event(const char* name, Json body = {});
+
+		std::vector<Json> takeRequests(bool wait);
+
+		void poll(lua_State* L);
+		void pause(lua_State* L, const char* reason);
+		void handle(lua_State* L, const Json& request, bool paused);
+
+		void setBreakpoints(lua_State* L, const Json& request);
+		void variables(lua_State* L, const Json& request);
+
+		int pushVarRef(VarRef ref);
+		void releaseVarRefs(lua_State* L);
+		Json variable(lua_State* L, const std::string& name, const TValue* o);
+	};
+}
@@ -1,8 +1,10 @@
 #include "disasm.h"
 
 #include <format>
+#include <cstdarg>
 #include <sstream>
 #include <iomanip>
+#include <map>
 
 #include <lua.h>
 #include <lualib.h>
@@ -68,7 +70,33 @@ namespace ldbg {
 		}
 	}
 	
-	void idisasm(FILE* f, const Instruction*& pc, const Proto* p) {
+	static void appendf(std::string& out, const char* fmt, ...) {
+		char buf[256];
+
+		va_list args;
+		va_start(args, fmt);
+		int n = vsnprintf(buf, sizeof(buf), fmt, args);
+		va_end(args);
+
+		if (n < 0)
+			return;
+
+		if ((size_t)n < sizeof(buf)) {
+			out.append(buf, n);
+			return;
+		}
+
+		const size_t old = out.size();
+		out.resize(old + n + 1);
+
+		va_start(args, fmt);
+		vsnprintf(out.data() + old, n + 1, fmt, args);
+		va_end(args);
+
+		out.resize(old + n);
+	}
+
+	void idisasm(std::string& out, const Instruction*& pc, const Proto* p) {
 		const Instruction insn = *pc;
 #ifdef LDBG_ROBLOX
 		const uint8_t op = reverse(LUAU_INSN_OP(insn)) * 223;
@@ -77,10 +105,10 @@ namespace ldbg {
 #endif
 
 		if (op >= LOP__COUNT) {
-			fprintf(f, ANSI_GREY "INVALID %u" ANSI_RESET, op);
+			appendf(out, ANSI_GREY "INVALID %u" ANSI_RESET, op);
 			return;
 		}
-		fprintf(f, ANSI_RED "%s ", luau_opcode[op]);
+		appendf(out, ANSI_RED "%s ", luau_opcode[op]);
 
 		uint32_t line = (uint32_t)(pc - p->code);
 		switch (op) {
@@ -89,31 +117,31 @@ namespace ldbg {
 			if (Luau::getOpLength((LuauOpcode)realOp) - 1) {
 				const Instruction copy[2] = { (insn & 0xFFFFFF00) | realOp, *++pc };
 				const Instruction* pcCopy = copy;
-				idisasm(f, pcCopy, p);
+				idisasm(out, pcCopy, p);
 			} else {
 				const Instruction copy = (insn & 0xFFFFFF00) | realOp;
 				const Instruction* pcCopy = &copy;
-				idisasm(f, pcCopy, p);
+				idisasm(out, pcCopy, p);
 			}
 		} break;
 		case LOP_LOADNIL:
 		case LOP_PREPVARARGS:
 		case LOP_FORGPREP_INEXT:
 		case LOP_CLOSEUPVALS:
-			fprintf(f, ANSI_CYAN "R%u", LUAU_INSN_A(insn));
+			appendf(out, ANSI_CYAN "R%u", LUAU_INSN_A(insn));
 			break;
 		case LOP_LOADB:
-			fprintf(f, ANSI_CYAN "R%u %s", LUAU_INSN_A(insn), LUAU_INSN_B(insn) ? "true" : "false");
+			appendf(out, ANSI_CYAN "R%u %s", LUAU_INSN_A(insn), LUAU_INSN_B(insn) ? "true" : "false");
 			pc += LUAU_INSN_C(insn);
 			break;
 		case LOP_LOADN:
-			fprintf(f, ANSI_CYAN "R%u " ANSI_YELLOW "%hd", LUAU_INSN_A(insn), LUAU_INSN_D(insn));
+			appendf(out, ANSI_CYAN "R%u " ANSI_YELLOW "%hd", LUAU_INSN_A(insn), LUAU_INSN_D(insn));
 			break;
 		case LOP_MOVE:
 		case LOP_NOT:
 		case LOP_MINUS:
 		case LOP_LENGTH:
-			fprintf(f, ANSI_CYAN "R%u R%u", LUAU_INSN_A(insn), LUAU_INSN_D(insn));
+			appendf(out, ANSI_CYAN "R%u R%u", LUAU_INSN_A(insn), LUAU_INSN_D(insn));
 			break;
 		case LOP_LOADK:
 		case LOP_DUPTABLE:
@@ -121,35 +149,35 @@ namespace ldbg {
 		case LOP_DUPCLOSURE:
 		case LOP_LOADKX: {
 			uint32_t D = LUAU_INSN_D(insn);
-			fprintf(f, ANSI_CYAN "R%u K%u " ANSI_GREY "; %s", LUAU_INSN_A(insn), D, lua_strprimitive(&p->k[D]).c_str());
+			appendf(out, ANSI_CYAN "R%u K%u " ANSI_GREY "; %s", LUAU_INSN_A(insn), D, lua_strprimitive(&p->k[D]).c_str());
 		} break;
 		case LOP_SETGLOBAL:
 		case LOP_GETGLOBAL:
-			fprintf(f, ANSI_CYAN "R%u K%u", LUAU_INSN_A(insn), LUAU_INSN_B(insn));
+			appendf(out, ANSI_CYAN "R%u K%u", LUAU_INSN_A(insn), LUAU_INSN_B(insn));
 			break;
 		case LOP_SETUPVAL:
 		case LOP_GETUPVAL:
-			fprintf(f, ANSI_CYAN "R%u U%u", LUAU_INSN_A(insn), LUAU_INSN_B(insn));
+			appendf(out, ANSI_CYAN "R%u U%u", LUAU_INSN_A(insn), LUAU_INSN_B(insn));
 			if (p->upvalues)
-				fprintf(f, ANSI_GREY " ; %s", getstr(p->upvalues[LUAU_INSN_B(insn)]));
+				appendf(out, ANSI_GREY " ; %s", getstr(p->upvalues[LUAU_INSN_B(insn)]));
 			break;
 		case LOP_GETIMPORT: {
-			fprintf(f, ANSI_CYAN "R%u K%u " ANSI_GREY "; " "", LUAU_INSN_A(insn), LUAU_INSN_D(insn));
+			appendf(out, ANSI_CYAN "R%u K%u " ANSI_GREY "; " "", LUAU_INSN_A(insn), LUAU_INSN_D(insn));
 			
 			uint32_t aux = *++pc;
 			int count = (uint8_t)(aux >> 30);
 
 			if (count) {
 				TString* v = tsvalue(&p->k[uint32_t(aux >> 20) & 0x3FF]);
-				fprintf(f, "%.*s", v->len, getstr(v));
+				appendf(out, "%.*s", v->len, getstr(v));
 
 				if (count >= 2) {
 					TString* v = tsvalue(&p->k[uint32_t(aux >> 10) & 0x3FF]);
-					fprintf(f, ".%.*s", v->len, getstr(v));
+					appendf(out, ".%.*s", v->len, getstr(v));
 
 					if (count == 3) {
 						TString* v = tsvalue(&p->k[aux & 0x3FF]);
-						fprintf(f, ".%.*s", v->len, getstr(v));
+						appendf(out, ".%.*s", v->len, getstr(v));
 					}
 				}
 			}
@@ -178,34 +206,34 @@ namespace ldbg {
 		case LOP_ORK:
 		case LOP_SUBRK:
 		case LOP_DIVRK:
-			fprintf(f, ANSI_CYAN "R%u R%u R%u", LUAU_INSN_A(insn), LUAU_INSN_B(insn), LUAU_INSN_C(insn));
+			appendf(out, ANSI_CYAN "R%u R%u R%u", LUAU_INSN_A(insn), LUAU_INSN_B(insn), LUAU_INSN_C(insn));
 			break;
 		case LOP_GETTABLEKS:
 		case LOP_SETTABLEKS:
 		case LOP_NAMECALL: {
 			uint32_t aux = *++pc;
-			fprintf(f, ANSI_CYAN "R%u R%u K%u " ANSI_GREY "; " "%s", LUAU_INSN_A(insn), LUAU_INSN_B(insn), aux, lua_strprimitive(&p->k[aux]).c_str());
+			appendf(out, ANSI_CYAN "R%u R%u K%u " ANSI_GREY "; " "%s", LUAU_INSN_A(insn), LUAU_INSN_B(insn), aux, lua_strprimitive(&p->k[aux]).c_str());
 		} break;
 		case LOP_GETTABLEN:
 		case LOP_SETTABLEN:
-			fprintf(f, ANSI_CYAN "R%u R%u " ANSI_YELLOW "%u", LUAU_INSN_A(insn), LUAU_INSN_B(insn), LUAU_INSN_C(insn) + 1);
+			appendf(out, ANSI_CYAN "R%u R%u " ANSI_YELLOW "%u", LUAU_INSN_A(insn), LUAU_INSN_B(insn), LUAU_INSN_C(insn) + 1);
 			break;
 		case LOP_CALL:
-			fprintf(f, ANSI_CYAN "R%u " ANSI_YELLOW "%d %d", LUAU_INSN_A(insn), LUAU_INSN_B(insn) - 1, LUAU_INSN_C(insn) - 1);
+			appendf(out, ANSI_CYAN "R%u " ANSI_YELLOW "%d %d", LUAU_INSN_A(insn), LUAU_INSN_B(insn) - 1, LUAU_INSN_C(insn) - 1);
 			break;
 		case LOP_RETURN:
 		case LOP_GETVARARGS:
-			fprintf(f, ANSI_CYAN "R%u " ANSI_YELLOW "%u", LUAU_INSN_A(insn), LUAU_INSN_B(insn) - 1);
+			appendf(out, ANSI_CYAN "R%u " ANSI_YELLOW "%u", LUAU_INSN_A(insn), LUAU_INSN_B(insn) - 1);
 			break;
 		case LOP_FORGLOOP:
 		case LOP_FORNPREP:
 		case LOP_JUMPIF:
 		case LOP_JUMPIFNOT:
-			fprintf(f, ANSI_CYAN "R%u ", LUAU_INSN_A(insn));
+			appendf(out, ANSI_CYAN "R%u ", LUAU_INSN_A(insn));
 			[[fallthrough]];
 		case LOP_JUMPBACK:
 		case LOP_JUMP:
-			fprintf(f, ANSI_CYAN "L%u", line + LUAU_INSN_D(insn));
+			appendf(out, ANSI_CYAN "L%u", line + LUAU_INSN_D(insn));
 			break;
 		case LOP_JUMPIFEQ:
 		case LOP_JUMPIFLE:
@@ -213,69 +241,75 @@ namespace ldbg {
 		case LOP_JUMPIFNOTEQ:
 		case LOP_JUMPIFNOTLE:
 		case LOP_JUMPIFNOTLT:
-			fprintf(f, ANSI_CYAN "R%u R%u L%u", LUAU_INSN_A(insn), *++pc, line + LUAU_INSN_D(insn) - 1);
+			appendf(out, ANSI_CYAN "R%u R%u L%u", LUAU_INSN_A(insn), *++pc, line + LUAU_INSN_D(insn) - 1);
 			break;
 		case LOP_NEWTABLE:
-			fprintf(f, ANSI_CYAN "R%u " ANSI_YELLOW "%u %u", LUAU_INSN_A(insn), LUAU_INSN_B(insn), *++pc);
+			appendf(out, ANSI_CYAN "R%u " ANSI_YELLOW "%u %u", LUAU_INSN_A(insn), LUAU_INSN_B(insn), *++pc);
 			break;
 		case LOP_SETLIST:
-			fprintf(f, ANSI_CYAN "R%u R%u " ANSI_YELLOW "%u %u", LUAU_INSN_A(insn), LUAU_INSN_B(insn), LUAU_INSN_C(insn) - 1, *++pc);
+			appendf(out, ANSI_CYAN "R%u R%u " ANSI_YELLOW "%u %u", LUAU_INSN_A(insn), LUAU_INSN_B(insn), LUAU_INSN_C(insn) - 1, *++pc);
 			break;
 		case LOP_FORNLOOP:
-			fprintf(f, ANSI_CYAN "R%u L%u", LUAU_INSN_A(insn), line + LUAU_INSN_D(insn) + 2);
+			appendf(out, ANSI_CYAN "R%u L%u", LUAU_INSN_A(insn), line + LUAU_INSN_D(insn) + 2);
 			break;
 		case LOP_FASTCALL:
-			fprintf(f, ANSI_YELLOW "%u " ANSI_CYAN "L%u", LUAU_INSN_A(insn), line + LUAU_INSN_C(insn) + 1);
+			appendf(out, ANSI_YELLOW "%u " ANSI_CYAN "L%u", LUAU_INSN_A(insn), line + LUAU_INSN_C(insn) + 1);
 			break;
 		case LOP_FASTCALL1:
-			fprintf(f, ANSI_YELLOW "%u " ANSI_CYAN "R%u L%u", LUAU_INSN_A(insn), LUAU_INSN_B(insn), line + LUAU_INSN_C(insn) + 1);
+			appendf(out, ANSI_YELLOW "%u " ANSI_CYAN "R%u L%u", LUAU_INSN_A(insn), LUAU_INSN_B(insn), line + LUAU_INSN_C(insn) + 1);
 			break;
 		case LOP_FASTCALL2:
-			fprintf(f, ANSI_YELLOW "%u " ANSI_CYAN "R%u R%u L%u", LUAU_INSN_A(insn), LUAU_INSN_B(insn), *++pc & 0xFF, line + LUAU_INSN_C(insn));
+			appendf(out, ANSI_YELLOW "%u " ANSI_CYAN "R%u R%u L%u", LUAU_INSN_A(insn), LUAU_INSN_B(insn), *++pc & 0xFF, line + LUAU_INSN_C(insn));
 			break;
 		case LOP_FASTCALL2K: {
 			uint32_t aux = *++pc;
-			fprintf(f, ANSI_YELLOW "%u " ANSI_CYAN "R%u K%u L%u " ANSI_GREY "; " "%s", LUAU_INSN_A(insn), LUAU_INSN_B(insn), aux, line + (((insn) >> 24) & 0xff), lua_strprimitive(&p->k[aux]).c_str());
+			appendf(out, ANSI_YELLOW "%u " ANSI_CYAN "R%u K%u L%u " ANSI_GREY "; " "%s", LUAU_INSN_A(insn), LUAU_INSN_B(insn), aux, line + (((insn) >> 24) & 0xff), lua_strprimitive(&p->k[aux]).c_str());
 		} break;
 		case LOP_FASTCALL3:
-			fprintf(f, ANSI_YELLOW "%u " ANSI_CYAN "R%u R%u R%u L%u", LUAU_INSN_A(insn), LUAU_INSN_B(insn), *++pc & 0xFF, (*pc >> 8) & 0xFF, line + LUAU_INSN_C(insn));
+			appendf(out, ANSI_YELLOW "%u " ANSI_CYAN "R%u R%u R%u L%u", LUAU_INSN_A(insn), LUAU_INSN_B(insn), *++pc & 0xFF, (*pc >> 8) & 0xFF, line + LUAU_INSN_C(insn));
 			break;
 		case LOP_JUMPX:
-			fprintf(f, ANSI_CYAN "L%u", line + LUAU_INSN_E(insn));
+			appendf(out, ANSI_CYAN "L%u", line + LUAU_INSN_E(insn));
 			break;
 		case LOP_COVERAGE:
-			fprintf(f, ANSI_YELLOW "%u", LUAU_INSN_E(insn));
+			appendf(out, ANSI_YELLOW "%u", LUAU_INSN_E(insn));
 			break;
 		case LOP_CAPTURE:
 			switch (LUAU_INSN_A(insn)) {
 			case LCT_VAL:
-				fprintf(f, "VAL " ANSI_CYAN "R%u", LUAU_INSN_B(insn));
+				appendf(out, "VAL " ANSI_CYAN "R%u", LUAU_INSN_B(insn));
 				break;
 			case LCT_REF:
-				fprintf(f, "REF " ANSI_CYAN "R%u", LUAU_INSN_B(insn));
+				appendf(out, "REF " ANSI_CYAN "R%u", LUAU_INSN_B(insn));
 				break;
 			case LCT_UPVAL:
-				fprintf(f, "UPVAL " ANSI_CYAN "U%u", LUAU_INSN_B(insn));
+				appendf(out, "UPVAL " ANSI_CYAN "U%u", LUAU_INSN_B(insn));
 				if (p->upvalues)
-					fprintf(f, " " ANSI_GREY "; " "%s", getstr(p->upvalues[LUAU_INSN_B(insn)]));
+					appendf(out, " " ANSI_GREY "; " "%s", getstr(p->upvalues[LUAU_INSN_B(insn)]));
 				break;
 			}
 			break;
 		case LOP_JUMPXEQKNIL:
 		case LOP_JUMPXEQKB:
 			// TODO: add note
-			fprintf(f, ANSI_CYAN "R%u L%u " ANSI_YELLOW "%u", LUAU_INSN_A(insn), line + LUAU_INSN_D(insn) - 1, *++pc);
+			appendf(out, ANSI_CYAN "R%u L%u " ANSI_YELLOW "%u", LUAU_INSN_A(insn), line + LUAU_INSN_D(insn) - 1, *++pc);
 			break;
 		case LOP_JUMPXEQKN:
 		case LOP_JUMPXEQKS: {
 			uint32_t aux = *++pc & 0xFFFFFF;
-			fprintf(f, ANSI_CYAN "R%u K%u L%u " ANSI_GREY "; " "%s", LUAU_INSN_A(insn), aux, line + LUAU_INSN_D(insn) - 1, lua_strprimitive(&p->k[aux]).c_str());
+			appendf(out, ANSI_CYAN "R%u K%u L%u " ANSI_GREY "; " "%s", LUAU_INSN_A(insn), aux, line + LUAU_INSN_D(insn) - 1, lua_strprimitive(&p->k[aux]).c_str());
 		} break;
 		default:
 			break;
 		}
 
-		fputs(ANSI_RESET "", f);
+		out += ANSI_RESET "";
+	}
+
+	void idisasm(FILE* f, const Instruction*& pc, const Proto* p) {
+		std::string out;
+		idisasm(out, pc, p);
+		fputs(out.c_str(), f);
 	}
 
 	void fdisasm(FILE* f, const Proto* p) {
@@ -291,4 +325,163 @@ namespace ldbg {
 	void disasm(const Proto* p) {
 		fdisasm(stdout, p);
 	}
+
+	InsnWrites decodeWrites(const Proto* p, const Instruction* pc) {
+		const Instruction insn = *pc;
+
+		uint8_t op = LUAU_INSN_OP(insn);
+		if (op == LOP_BREAK && p->debuginsn)
+			op = p->debuginsn[pc - p->code];
+
+		InsnWrites w;
+		w.reg = LUAU_INSN_A(insn);
+
+		switch (op) {
+		case LOP_LOADNIL:
+		case LOP_LOADB:
+		case LOP_LOADN:
+		case LOP_LOADK:
+		case LOP_LOADKX:
+		case LOP_MOVE:
+		case LOP_GETGLOBAL:
+		case LOP_GETUPVAL:
+		case LOP_GETIMPORT:
+		case LOP_GETTABLE:
+		case LOP_GETTABLEKS:
+		case LOP_GETTABLEN:
+		case LOP_NEWCLOSURE:
+		case LOP_DUPCLOSURE:
+		case LOP_ADD:
+		case LOP_SUB:
+		case LOP_MUL:
+		case LOP_DIV:
+		case LOP_MOD:
+		case LOP_POW:
+		case LOP_IDIV:
+		case LOP_ADDK:
+		case LOP_SUBK:
+		case LOP_MULK:
+		case LOP_DIVK:
+		case LOP_MODK:
+		case LOP_POWK:
+		case LOP_IDIVK:
+		case LOP_SUBRK:
+		case LOP_DIVRK:
+		case LOP_AND:
+		case LOP_OR:
+		case LOP_ANDK:
+		case LOP_ORK:
+		case LOP_CONCAT:
+		case LOP_NOT:
+		case LOP_MINUS:
+		case LOP_LENGTH:
+		case LOP_NEWTABLE:
+		case LOP_DUPTABLE:
+			w.count = 1;
+			break;
+		case LOP_NAMECALL:
+			w.count = 2;
+			break;
+		case LOP_FORNPREP:
+		case LOP_FORNLOOP:
+		case LOP_FORGPREP:
+		case LOP_FORGPREP_INEXT:
+		case LOP_FORGPREP_NEXT:
+			w.count = 3;
+			break;
+		case LOP_FORGLOOP:
+			w.count = 256;
+			break;
+		case LOP_GETVARARGS:
+			w.count = LUAU_INSN_B(insn) ? LUAU_INSN_B(insn) - 1 : 256;
+			break;
+		case LOP_SETUPVAL:
+			w.upval = LUAU_INSN_B(insn);
+			break;
+		case LOP_SETTABLE:
+		case LOP_SETTABLEKS:
+		case LOP_SETTABLEN:
+			w.table = LUAU_INSN_B(insn);
+			break;
+		case LOP_SETLIST:
+			w.table = LUAU_INSN_A(insn);
+			break;
+		case LOP_CALL:
+		case LOP_FASTCALL:
+		case LOP_FASTCALL1:
+		case LOP_FASTCALL2:
+		case LOP_FASTCALL2K:
+		case LOP_FASTCALL3:
+			w.call = true;
+			break;
+		default:
+			break;
+		}
+
+		return w;
+	}
+
+	const Instruction* fastcallFallback(const Proto* p, const Instruction* pc) {
+		const Instruction* call = pc + 1 + LUAU_INSN_C(*pc);
+		if (call >= p->code + p->sizecode)
+			return nullptr;
+
+		uint8_t op = LUAU_INSN_OP(*call);
+		if (op == LOP_BREAK && p->debuginsn)
+			op = p->debuginsn[call - p->code];
+		return op == LOP_CALL ? call : nullptr;
+	}
+
+	std::vector<uint8_t> loopDepths(const Proto* p) {
+		// the furthest backward jump to each loop start; a continue jumps back to the same start as the loop itself
+		std::map<int, int> loops;
+
+		for (int i = 0; i < p->sizecode;) {
+			const Instruction insn = p->code[i];
+			uint8_t op = LUAU_INSN_OP(insn);
+			if (op == LOP_BREAK && p->debuginsn)
+				op = p->debuginsn[i];
+
+			int offset = 0;
+			switch (op) {
+			case LOP_JUMP:
+			case LOP_JUMPBACK:
+			case LOP_JUMPIF:
+			case LOP_JUMPIFNOT:
+			case LOP_JUMPIFEQ:
+			case LOP_JUMPIFLE:
+			case LOP_JUMPIFLT:
+			case LOP_JUMPIFNOTEQ:
+			case LOP_JUMPIFNOTLE:
+			case LOP_JUMPIFNOTLT:
+			case LOP_JUMPXEQKNIL:
+			case LOP_JUMPXEQKB:
+			case LOP_JUMPXEQKN:
+			case LOP_JUMPXEQKS:
+			case LOP_FORNLOOP:
+			case LOP_FORGLOOP:
+				offset = LUAU_INSN_D(insn);
+				break;
+			case LOP_JUMPX:
+				offset = LUAU_INSN_E(insn);
+				break;
+			default:
+				break;
+			}
+
+			if (offset < 0) {
+				int& end = loops[i + 1 + offset];
+				end = std::max(end, i);
+			}
+
+			i += Luau::getOpLength(LuauOpcode(op));
+		}
+
+		std::vector<uint8_t> depths(p->sizecode);
+		for (const auto& [start, end] : loops) {
+			for (int i = std::max(start, 0); i <= end; i++)
+				depths[i]++;
+		}
+		return depths;
+	}
 }
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <string>
+#include <vector>
+
 #include <lstate.h>
 #include <Luau/Compiler.h>
 
@@ -24,4 +27,47 @@ namespace ldbg {
 	/// <param name="pc">Current program counter</param>
 	/// <param name="p">Current proto</param>
 	void idisasm(FILE* f, const Instruction*& pc, const Proto* p);
+
+	/// <summary>
+	/// Appends a single disassembled instruction to a string
+	/// </summary>
+	/// <param name="out">String to append to</param>
+	/// <param name="pc">Current program counter</param>
+	/// <param name="p">Current proto</param>
+	void idisasm(std::string& out, const Instruction*& pc, const Proto* p);
+
+	/// <summary>
+	/// Registers, upvalues and tables an instruction may write to
+	/// </summary>
+	struct InsnWrites {
+		int reg = 0;
+		int count = 0;
+		int upval = -1;
+		int table = -1;
+		bool call = false;
+	};
+
+	/// <summary>
+	/// Decodes what an instruction may write to; calls can write anything
+	/// </summary>
+	/// <param name="p">Proto the instruction belongs to, used to see through breakpoints</param>
+	/// <param name="pc">Instruction to decode</param>
+	InsnWrites decodeWrites(const Proto* p, const Instruction* pc);
+
+	/// <summary>
+	/// Gets the CALL a fast call falls back to. Every variant counts its skip from the instruction after its
+	/// first word, so the aux word of the two and three argument forms is part of the skipped block
+	/// </summary>
+	/// <param name="p">Proto the instruction belongs to, used to see through breakpoints</param>
+	/// <param name="pc">FASTCALL instruction</param>
+	/// <returns>The CALL, or null if there is none where the fast call points</returns>
+	const Instruction* fastcallFallback(const Proto* p, const Instruction* pc);
+
+	/// <summary>
+	/// Gets how many loops enclose each instruction. Luau's bytecode keeps loop bodies contiguous, so each
+	/// backward jump marks the instructions from its target up to itself as one loop
+	/// </summary>
+	/// <param name="p">Proto to analyze</param>
+	/// <returns>A depth per instruction, 0 outside of loops</returns>
+	std::vector<uint8_t> loopDepths(const Proto* p);
 }
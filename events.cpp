@@ -0,0 +1,118 @@
+#include "events.h"
+
+#ifdef _WIN32
+#include <io.h>
+#define isatty _isatty
+#define fileno _fileno
+#else
+#include <unistd.h>
+#endif
+
+#include "json.h"
+
+namespace ldbg {
+	ConsoleSink::ConsoleSink(FILE* file, size_t capacity) : file(file), capacity(capacity), plain(!isatty(fileno(file))) {}
+
+	void ConsoleSink::emit(const Event& event) {
+		if (plain)
+			buffer += stripAnsi(event.text);
+		else
+			buffer += event.text;
+		if (buffer.size() >= capacity)
+			flush();
+	}
+
+	void ConsoleSink::flush() {
+		if (!buffer.empty()) {
+			fwrite(buffer.data(), 1, buffer.size(), file);
+			buffer.clear();
+		}
+		fflush(file);
+	}
+
+	void JsonLinesSink::emit(const Event& event) {
+		Json line = Json::makeObject();
+		line.set("kind", eventKindName(event.kind));
+
+		std::string text = stripAnsi(event.text);
+		if (!text.empty() && text.back() == '\n')
+			text.pop_back();
+		line.set("text", std::move(text));
+
+		switch (event.kind) {
+		case EventKind::Breakpoint:
+		case EventKind::Step:
+			line.set("function", event.function);
+			line.set("source", event.source);
+			line.set("line", event.line);
+			line.set("pc", event.pc);
+			break;
+		case EventKind::Gc:
+			if (event.gcState) {
+				line.set("state", event.gcState);
+				line.set("totalBytes", (double)event.totalBytes);
+			} else {
+				line.set("address", (double)event.address);
+				line.set("oldSize", (double)event.oldSize);
+				line.set("newSize", (double)event.newSize);
+			}
+			break;
+		default:
+			break;
+		}
+
+		line.dump(buffer);
+		buffer += '\n';
+
+		if (buffer.size() >= capacity)
+			flush();
+	}
+
+	void JsonLinesSink::flush() {
+		if (!buffer.empty()) {
+			fwrite(buffer.data(), 1, buffer.size(), file);
+			buffer.clear();
+		}
+		fflush(file);
+	}
+
+	void RingSink::emit(const Event& event) {
+		Event& slot = events[head];
+		slot = event;
+		slot.text = stripAnsi(event.text);
+
+		head = (head + 1) % events.size();
+		if (count < events.size())
+			count++;
+	}
+
+	const char* eventKindName(EventKind kind) {
+		switch (kind) {
+		case EventKind::Breakpoint: return "breakpoint";
+		case EventKind::Step: return "step";
+		case EventKind::Gc: return "gc";
+		case EventKind::Log: return "log";
+		}
+		return "unknown";
+	}
+
+	std::string stripAnsi(std::string_view text) {
+		std::string out;
+		out.reserve(text.size());
+
+		for (size_t i = 0; i < text.size(); i++) {
+			if (text[i] != '\033') {
+				out += text[i];
+				continue;
+			}
+
+			// CSI sequences end with a byte in the 0x40-0x7E range
+			if (i + 1 < text.size() && text[i + 1] == '[') {
+				i += 2;
+				while (i < text.size() && (text[i] < 0x40 || text[i] > 0x7E))
+					i++;
+			}
+		}
+		return out;
+	}
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <string_view>
+
+namespace ldbg {
+	enum class EventKind {
+		Breakpoint,
+		Step,
+		Gc,
+		Log
+	};
+
+	/// <summary>
+	/// Something the debugger reports. The text is the console rendering and may contain ANSI codes
+	/// </summary>
+	struct Event {
+		EventKind kind = EventKind::Log;
+		std::string text;
+
+		// breakpoint and step events
+		std::string function;
+		std::string source;
+		int line = 0;
+		int pc = -1;
+
+		// gc events; allocation traces fill in the block, state reports the collector
+		uintptr_t address = 0;
+		size_t oldSize = 0;
+		size_t newSize = 0;
+		const char* gcState = nullptr;
+		size_t totalBytes = 0;
+	};
+
+	/// <summary>
+	/// Receives every event emitted by a debugger
+	/// </summary>
+	class EventSink {
+	public:
+		virtual ~EventSink() = default;
+
+		virtual void emit(const Event& event) = 0;
+
+		/// <summary>
+		/// Called before the debugger blocks for input or hands control back to the script
+		/// </summary>
+		virtual void flush() {}
+	};
+
+	/// <summary>
+	/// Writes event text to a stream, buffering it until flushed or the buffer fills up. ANSI codes are only
+	/// kept when the stream is a terminal, so that redirected and batch output stays machine-readable
+	/// </summary>
+	class ConsoleSink : public EventSink {
+	public:
+		explicit ConsoleSink(FILE* file, size_t capacity = 64 * 1024);
+		~ConsoleSink() override { flush(); }
+
+		void emit(const Event& event) override;
+		void flush() override;
+
+		FILE* getFile() const { return file; }
+
+	private:
+		FILE* file;
+		size_t capacity;
+		bool plain;
+		std::string buffer;
+	};
+
+	/// <summary>
+	/// Writes one JSON object per event to a stream, buffering like ConsoleSink
+	/// </summary>
+	class JsonLinesSink : public EventSink {
+	public:
+		explicit JsonLinesSink(FILE* file, size_t capacity = 64 * 1024) : file(file), capacity(capacity) {}
+		~JsonLinesSink() override { flush(); }
+
+		void emit(const Event& event) override;
+		void flush() override;
+
+	private:
+		FILE* file;
+		size_t capacity;
+		std::string buffer;
+	};
+
+	/// <summary>
+	/// Keeps the most recent events in memory, overwriting the oldest ones
+	/// </summary>
+	class RingSink : public EventSink {
+	public:
+		explicit RingSink(size_t capacity) : events(capacity ? capacity : 1) {}
+
+		void emit(const Event& event) override;
+
+		size_t size() const { return count; }
+		size_t capacity() const { return events.size(); }
+
+		/// <summary>
+		/// Gets a retained event
+		/// </summary>
+		/// <param name="index">0 for the oldest retained event</param>
+		const Event& operator[](size_t index) const { return events[(head + events.size() - count + index) % events.size()]; }
+
+		void clear() { head = count = 0; }
+
+	private:
+		std::vector<Event> events;
+		size_t head = 0;
+		size_t count = 0;
+	};
+
+	const char* eventKindName(EventKind kind);
+
+	/// <summary>
+	/// Removes ANSI escape sequences for sinks that don't write to a terminal
+	/// </summary>
+	std::string stripAnsi(std::string_view text);
+}
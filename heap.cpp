@@ -0,0 +1,452 @@
+#include "heap.h"
+
+#include <bit>
+#include <format>
+#include <vector>
+#include <cstring>
+#include <string_view>
+#include <algorithm>
+#include <unordered_map>
+
+#include <lgc.h>
+#include <lmem.h>
+#include <ltable.h>
+
+#include "json.h"
+#include "style.h"
+
+namespace ldbg {
+	struct TableUsage {
+		Table* h;
+		size_t bytes;
+
+		int arrayUsed;
+		int hashSize;
+		int hashUsed;
+
+		// bytes of slots that hold nothing, and the part of them the smallest fitting sizes would free
+		size_t unused;
+		size_t reclaimable;
+	};
+
+	struct TableGroup {
+		Table* metatable;
+		size_t count;
+		size_t bytes;
+
+		uint64_t arraySize, arrayUsed;
+		uint64_t hashSize, hashUsed;
+
+		size_t unused;
+		size_t reclaimable;
+	};
+
+	// parts are resized to powers of two, so some slack is unavoidable
+	static size_t fittingSize(int used) {
+		return used ? std::bit_ceil((unsigned)used) : 0;
+	}
+
+	static TableUsage measureTable(Table* h, int blockSize) {
+		TableUsage usage = { h, (size_t)blockSize };
+
+		for (int i = 0; i < h->sizearray; i++) {
+			if (!ttisnil(&h->array[i]))
+				usage.arrayUsed++;
+		}
+
+		// tables without a hash part share the dummy node
+		if (h->node != dummynode) {
+			usage.hashSize = sizenode(h);
+			for (int i = 0; i < usage.hashSize; i++) {
+				if (!ttisnil(gval(gnode(h, i))))
+					usage.hashUsed++;
+			}
+		}
+
+		usage.bytes += h->sizearray * sizeof(TValue) + usage.hashSize * sizeof(LuaNode);
+		usage.unused = (h->sizearray - usage.arrayUsed) * sizeof(TValue) + (usage.hashSize - usage.hashUsed) * sizeof(LuaNode);
+
+		const size_t fitting = fittingSize(usage.arrayUsed) * sizeof(TValue) + fittingSize(usage.hashUsed) * sizeof(LuaNode);
+		const size_t parts = h->sizearray * sizeof(TValue) + usage.hashSize * sizeof(LuaNode);
+		usage.reclaimable = parts > fitting ? parts - fitting : 0;
+		return usage;
+	}
+
+	// classes commonly name themselves through __type or __name; read without allocating a key string
+	static std::string metatableName(const Table* mt) {
+		if (!mt)
+			return "(no metatable)";
+
+		if (mt->node != dummynode) {
+			for (int i = 0; i < sizenode(mt); i++) {
+				const LuaNode* n = gnode(mt, i);
+				if (!ttisstring(gkey(n)) || !ttisstring(gval(n)))
+					continue;
+
+				const char* key = getstr(tsvalue(gkey(n)));
+				if (!strcmp(key, "__type") || !strcmp(key, "__name"))
+					return std::format("{} (0x{:x})", getstr(tsvalue(gval(n))), (uintptr_t)mt);
+			}
+		}
+		return std::format("metatable 0x{:x}", (uintptr_t)mt);
+	}
+
+	void reportTables(lua_State* L, size_t top, std::string& out) {
+		struct Context {
+			global_State* g;
+			std::vector<TableUsage> tables;
+		};
+
+		Context ctx = { L->global };
+		luaM_visitgco(L, &ctx, [](void* _ctx, lua_Page* page, GCObject* gco) -> bool {
+			Context* ctx = (Context*)_ctx;
+			if (gco->gch.tt != LUA_TTABLE || isdead(ctx->g, gco))
+				return false;
+
+			int pageBlocks, busyBlocks, blockSize, pageSize;
+			luaM_getpageinfo(page, &pageBlocks, &busyBlocks, &blockSize, &pageSize);
+
+			ctx->tables.push_back(measureTable(gco2h(gco), blockSize));
+			return false;
+		});
+
+		if (ctx.tables.empty()) {
+			out += "no tables\n";
+			return;
+		}
+
+		TableGroup total = {};
+		std::unordered_map<Table*, TableGroup> groups;
+		for (const TableUsage& usage : ctx.tables) {
+			for (TableGroup* group : { &total, &groups[usage.h->metatable] }) {
+				group->metatable = usage.h->metatable;
+				group->count++;
+				group->bytes += usage.bytes;
+				group->arraySize += usage.h->sizearray;
+				group->arrayUsed += usage.arrayUsed;
+				group->hashSize += usage.hashSize;
+				group->hashUsed += usage.hashUsed;
+				group->unused += usage.unused;
+				group->reclaimable += usage.reclaimable;
+			}
+		}
+
+		auto percent = [](uint64_t part, uint64_t whole) { return whole ? 100.0 * part / whole : 100.0; };
+
+		out += std::format("tables: " ANSI_YELLOW "{}" ANSI_RESET ", " ANSI_YELLOW "{}" ANSI_RESET " bytes\n", total.count, total.bytes);
+		out += std::format("  array slots: {} of {} used ({:.1f}%)\n", total.arrayUsed, total.arraySize, percent(total.arrayUsed, total.arraySize));
+		out += std::format("  hash slots: {} of {} used ({:.1f}%)\n", total.hashUsed, total.hashSize, percent(total.hashUsed, total.hashSize));
+		out += std::format("  unused slots: " ANSI_YELLOW "{}" ANSI_RESET " bytes, " ANSI_YELLOW "{}" ANSI_RESET " of them reclaimable by a rehash\n", total.unused, total.reclaimable);
+		out += std::format("  metatables: {} shared by {} tables\n\n", groups.size() - groups.count(nullptr), total.count - (groups.count(nullptr) ? groups[nullptr].count : 0));
+
+		std::vector<const TableGroup*> byGroup;
+		for (const auto& [mt, group] : groups)
+			byGroup.push_back(&group);
+		std::sort(byGroup.begin(), byGroup.end(), [](auto a, auto b) { return a->reclaimable != b->reclaimable ? a->reclaimable > b->reclaimable : a->bytes > b->bytes; });
+
+		out += std::format(
+			"{:<8} {:<12} {:<12} {:<8} {:<8} {}\n"
+			ANSI_GREY "-------- ------------ ------------ -------- -------- ------------------------------\n" ANSI_RESET,
+			"tables", "bytes", "reclaimable", "array%", "hash%", "metatable"
+		);
+
+		for (size_t i = 0; i < std::min(top, byGroup.size()); i++) {
+			const TableGroup* group = byGroup[i];
+			out += std::format("{:<8} {:<12} " ANSI_YELLOW "{:<12}" ANSI_RESET " {:<8.1f} {:<8.1f} " ANSI_CYAN "{}\n" ANSI_RESET,
+				group->count, group->bytes, group->reclaimable,
+				percent(group->arrayUsed, group->arraySize), percent(group->hashUsed, group->hashSize),
+				metatableName(group->metatable));
+		}
+
+		std::sort(ctx.tables.begin(), ctx.tables.end(), [](const auto& a, const auto& b) { return a.reclaimable > b.reclaimable; });
+		if (ctx.tables.front().reclaimable == 0)
+			return;
+
+		out += std::format(
+			"\n{:<18} {:<12} {:<12} {:<16} {:<16} {}\n"
+			ANSI_GREY "------------------ ------------ ------------ ---------------- ---------------- ------------------------------\n" ANSI_RESET,
+			"address", "bytes", "reclaimable", "array used", "hash used", "metatable"
+		);
+
+		for (size_t i = 0; i < std::min(top, ctx.tables.size()) && ctx.tables[i].reclaimable; i++) {
+			const TableUsage& usage = ctx.tables[i];
+			out += std::format("0x{:<16x} {:<12} " ANSI_YELLOW "{:<12}" ANSI_RESET " {:<16} {:<16} " ANSI_CYAN "{}\n" ANSI_RESET,
+				(uintptr_t)usage.h, usage.bytes, usage.reclaimable,
+				std::format("{}/{}", usage.arrayUsed, usage.h->sizearray), std::format("{}/{}", usage.hashUsed, usage.hashSize),
+				metatableName(usage.h->metatable));
+		}
+	}
+
+	// payloads shorter than this aren't worth deduplicating
+	static constexpr size_t minDuplicateLength = 32;
+
+	static std::string preview(std::string_view data, size_t width = 40) {
+		std::string text;
+		for (char c : data.substr(0, width)) {
+			if (c == '\n')
+				text += "\\n";
+			else if ((unsigned char)c < 32 || (unsigned char)c >= 127)
+				text += '.';
+			else
+				text += c;
+		}
+		if (data.size() > width)
+			text += "...";
+		return text;
+	}
+
+	void reportStrings(lua_State* L, size_t top, std::string& out) {
+		static constexpr size_t bucketLimits[] = { 16, 64, 256, 1024, 4096, 65536, SIZE_MAX };
+		static constexpr const char* bucketNames[] = { "< 16", "< 64", "< 256", "< 1K", "< 4K", "< 64K", ">= 64K" };
+
+		struct Payload {
+			size_t count;
+			size_t strings;
+		};
+
+		struct Context {
+			global_State* g;
+
+			size_t count;
+			size_t bytes;
+			size_t bucketCount[std::size(bucketLimits)];
+			size_t bucketBytes[std::size(bucketLimits)];
+
+			std::vector<const TString*> strings;
+			std::unordered_map<std::string_view, Payload> payloads;
+		};
+
+		Context ctx = { L->global };
+		luaM_visitgco(L, &ctx, [](void* _ctx, lua_Page* page, GCObject* gco) -> bool {
+			Context* ctx = (Context*)_ctx;
+			if ((gco->gch.tt != LUA_TSTRING && gco->gch.tt != LUA_TBUFFER) || isdead(ctx->g, gco))
+				return false;
+
+			std::string_view data;
+			if (gco->gch.tt == LUA_TBUFFER)
+				data = std::string_view(gco2buf(gco)->data, gco2buf(gco)->len);
+			else {
+				const TString* ts = gco2ts(gco);
+				data = std::string_view(getstr(ts), ts->len);
+
+				int pageBlocks, busyBlocks, blockSize, pageSize;
+				luaM_getpageinfo(page, &pageBlocks, &busyBlocks, &blockSize, &pageSize);
+
+				const size_t bucket = std::upper_bound(std::begin(bucketLimits), std::end(bucketLimits), (size_t)ts->len) - std::begin(bucketLimits);
+				ctx->count++;
+				ctx->bytes += blockSize;
+				ctx->bucketCount[bucket]++;
+				ctx->bucketBytes[bucket] += blockSize;
+				ctx->strings.push_back(ts);
+			}
+
+			// the heap doesn't move, so views into it stay valid for the whole report
+			if (data.size() >= minDuplicateLength) {
+				Payload& payload = ctx->payloads[data];
+				payload.count++;
+				payload.strings += gco->gch.tt == LUA_TSTRING;
+			}
+			return false;
+		});
+
+		out += std::format("strings: " ANSI_YELLOW "{}" ANSI_RESET ", " ANSI_YELLOW "{}" ANSI_RESET " bytes\n", ctx.count, ctx.bytes);
+
+		out += std::format(
+			"{:<10} {:<10} {:<12}\n"
+			ANSI_GREY "---------- ---------- ------------\n" ANSI_RESET,
+			"length", "count", "bytes"
+		);
+		for (size_t i = 0; i < std::size(bucketLimits); i++) {
+			if (ctx.bucketCount[i])
+				out += std::format("{:<10} {:<10} " ANSI_YELLOW "{:<12}\n" ANSI_RESET, bucketNames[i], ctx.bucketCount[i], ctx.bucketBytes[i]);
+		}
+
+		// chains are walked for their lengths only; the strings themselves were counted above
+		const stringtable& strt = L->global->strt;
+		size_t emptyBuckets = 0;
+		size_t longestChain = 0;
+		for (int i = 0; i < strt.size; i++) {
+			size_t chain = 0;
+			for (const TString* ts = strt.hash[i]; ts; ts = ts->next)
+				chain++;
+
+			emptyBuckets += chain == 0;
+			longestChain = std::max(longestChain, chain);
+		}
+
+		out += std::format("\nstring table: {} strings in {} buckets, load factor " ANSI_YELLOW "{:.2f}" ANSI_RESET ", {} empty buckets, longest chain {}\n",
+			strt.nuse, strt.size, strt.size ? (double)strt.nuse / strt.size : 0.0, emptyBuckets, longestChain);
+
+		const size_t largest = std::min(top, ctx.strings.size());
+		std::partial_sort(ctx.strings.begin(), ctx.strings.begin() + largest, ctx.strings.end(), [](auto a, auto b) { return a->len > b->len; });
+
+		if (largest) {
+			out += std::format(
+				"\n{:<18} {:<10} {}\n"
+				ANSI_GREY "------------------ ---------- ----------------------------------------\n" ANSI_RESET,
+				"address", "length", "contents"
+			);
+			for (size_t i = 0; i < largest; i++) {
+				const TString* ts = ctx.strings[i];
+				out += std::format("0x{:<16x} " ANSI_YELLOW "{:<10}" ANSI_RESET " {}\n", (uintptr_t)ts, ts->len, preview(std::string_view(getstr(ts), ts->len)));
+			}
+		}
+
+		std::vector<std::pair<std::string_view, Payload>> repeated;
+		for (const auto& [data, payload] : ctx.payloads) {
+			if (payload.count > 1)
+				repeated.emplace_back(data, payload);
+		}
+
+		if (repeated.empty())
+			return;
+
+		// what keeping a single copy of each would save
+		std::sort(repeated.begin(), repeated.end(), [](const auto& a, const auto& b) {
+			return a.first.size() * (a.second.count - 1) > b.first.size() * (b.second.count - 1);
+		});
+
+		out += std::format(
+			"\n{:<8} {:<8} {:<10} {:<12} {}\n"
+			ANSI_GREY "-------- -------- ---------- ------------ ----------------------------------------\n" ANSI_RESET,
+			"copies", "strings", "length", "redundant", "contents"
+		);
+		for (size_t i = 0; i < std::min(top, repeated.size()); i++) {
+			const auto& [data, payload] = repeated[i];
+			out += std::format("{:<8} {:<8} {:<10} " ANSI_YELLOW "{:<12}" ANSI_RESET " {}\n",
+				payload.count, payload.strings, data.size(), data.size() * (payload.count - 1), preview(data));
+		}
+	}
+
+	void MemoryTimeline::start(lua_State* L, size_t capacity, uint32_t intervalMs) {
+		limit = std::max<size_t>(capacity, 16);
+		this->intervalMs = intervalMs;
+
+		samples.clear();
+		samples.reserve(limit);
+		values.clear();
+
+		begin = std::chrono::steady_clock::now();
+		running = true;
+
+		// the first row is the state sampling started from
+		take(L, 0, L->global->gcstate);
+	}
+
+	void MemoryTimeline::onGcStep(lua_State* L, int gcstate) {
+		const uint64_t ms = (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count();
+		if (!samples.empty() && ms - samples.back().ms < intervalMs)
+			return;
+
+		if (samples.size() == limit)
+			halve();
+
+		take(L, ms, gcstate);
+	}
+
+	void MemoryTimeline::take(lua_State* L, uint64_t ms, int gcstate) {
+		const global_State* g = L->global;
+
+		Sample sample = { ms, g->totalbytes, (uint8_t)gcstate, (uint32_t)values.size(), 0 };
+		for (int i = 0; i < LUA_MEMORY_CATEGORIES; i++) {
+			if (g->memcatbytes[i]) {
+				values.push_back({ (uint8_t)i, g->memcatbytes[i] });
+				sample.count++;
+			}
+		}
+		samples.push_back(sample);
+	}
+
+	void MemoryTimeline::halve() {
+		std::vector<Sample> kept;
+		std::vector<CategoryBytes> keptValues;
+		kept.reserve(limit);
+
+		for (size_t i = 0; i < samples.size(); i += 2) {
+			Sample sample = samples[i];
+			const uint32_t first = (uint32_t)keptValues.size();
+			keptValues.insert(keptValues.end(), values.begin() + sample.first, values.begin() + sample.first + sample.count);
+			sample.first = first;
+			kept.push_back(sample);
+		}
+
+		samples = std::move(kept);
+		values = std::move(keptValues);
+		intervalMs = std::max<uint32_t>(intervalMs * 2, 1);
+	}
+
+	std::vector<uint8_t> MemoryTimeline::usedCategories() const {
+		bool used[LUA_MEMORY_CATEGORIES] = {};
+		for (const CategoryBytes& value : values)
+			used[value.memcat] = true;
+
+		std::vector<uint8_t> categories;
+		for (int i = 0; i < LUA_MEMORY_CATEGORIES; i++) {
+			if (used[i])
+				categories.push_back((uint8_t)i);
+		}
+		return categories;
+	}
+
+	static std::string categoryName(const std::vector<std::string>& names, uint8_t memcat) {
+		return memcat < names.size() && !names[memcat].empty() ? names[memcat] : std::format("memcat {}", memcat);
+	}
+
+	void MemoryTimeline::writeCsv(FILE* file, const std::vector<std::string>& names) const {
+		const std::vector<uint8_t> categories = usedCategories();
+
+		std::string out = "ms,totalbytes,gcstate";
+		for (uint8_t memcat : categories) {
+			// module names are paths, which may contain the separator
+			std::string name = categoryName(names, memcat);
+			std::replace(name.begin(), name.end(), '"', '\'');
+			out += std::format(",\"{}\"", name);
+		}
+		out += '\n';
+
+		for (const Sample& sample : samples) {
+			out += std::format("{},{},{}", sample.ms, sample.totalBytes, luaC_statename(sample.gcstate));
+
+			const CategoryBytes* value = values.data() + sample.first;
+			const CategoryBytes* end = value + sample.count;
+			for (uint8_t memcat : categories) {
+				// both are sorted by category
+				if (value != end && value->memcat == memcat)
+					out += std::format(",{}", (value++)->bytes);
+				else
+					out += ",0";
+			}
+			out += '\n';
+		}
+
+		fwrite(out.data(), 1, out.size(), file);
+	}
+
+	void MemoryTimeline::writeJson(FILE* file, const std::vector<std::string>& names) const {
+		Json categories = Json::makeArray();
+		for (uint8_t memcat : usedCategories())
+			categories.push(Json::makeObject()
+				.set("memcat", (int)memcat)
+				.set("name", categoryName(names, memcat)));
+
+		Json rows = Json::makeArray();
+		for (const Sample& sample : samples) {
+			Json bytes = Json::makeObject();
+			for (uint32_t i = sample.first; i < sample.first + sample.count; i++)
+				bytes.set(std::to_string(values[i].memcat), (double)values[i].bytes);
+
+			rows.push(Json::makeObject()
+				.set("ms", (double)sample.ms)
+				.set("totalBytes", (double)sample.totalBytes)
+				.set("gcState", luaC_statename(sample.gcstate))
+				.set("bytes", std::move(bytes)));
+		}
+
+		const std::string text = Json::makeObject()
+			.set("intervalMs", (int)intervalMs)
+			.set("memcats", std::move(categories))
+			.set("samples", std::move(rows))
+			.dump();
+		fwrite(text.data(), 1, text.size(), file);
+	}
+}
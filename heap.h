@@ -0,0 +1,94 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+
+#include <lua.h>
+#include <lstate.h>
+
+namespace ldbg {
+	/// <summary>
+	/// Walks every table once and reports capacity against use for the array and hash parts. The report
+	/// counts the bytes left unused, and how much of that a rehash to the smallest fitting sizes would free.
+	/// Tables are aggregated by metatable, which for object tables stands in for the allocation site Luau
+	/// doesn't record
+	/// </summary>
+	/// <param name="top">Number of groups and tables listed</param>
+	/// <param name="out">String the report is appended to</param>
+	void reportTables(lua_State* L, size_t top, std::string& out);
+
+	/// <summary>
+	/// Walks every string and buffer once and reports count and bytes by length, the largest strings, payloads
+	/// held more than once, and the load of the string table. Luau interns every string, so repeated payloads
+	/// show up between buffers and the strings they were made from or turned into
+	/// </summary>
+	/// <param name="top">Number of strings and repeated payloads listed</param>
+	/// <param name="out">String the report is appended to</param>
+	void reportStrings(lua_State* L, size_t top, std::string& out);
+
+	/// <summary>
+	/// Time series of the bytes held by each memory category, sampled at collector steps no more often than
+	/// an interval. When the buffer fills up every other sample is dropped and the interval doubles, so a
+	/// fixed amount of memory covers any run length at a decreasing resolution
+	/// </summary>
+	class MemoryTimeline {
+	public:
+		bool active() const { return running; }
+
+		/// <summary>
+		/// Discards the previous samples and starts sampling
+		/// </summary>
+		/// <param name="capacity">Number of samples kept</param>
+		/// <param name="intervalMs">Minimum time between samples</param>
+		void start(lua_State* L, size_t capacity, uint32_t intervalMs);
+		void stop() { running = false; }
+
+		/// <summary>
+		/// Takes a sample if the interval has passed since the last one
+		/// </summary>
+		/// <param name="gcstate">State of the collector at the step</param>
+		void onGcStep(lua_State* L, int gcstate);
+
+		/// <summary>
+		/// Writes one row per sample and one column per category that held memory
+		/// </summary>
+		/// <param name="names">Names of the categories, indexed by category; empty ones are shown by number</param>
+		void writeCsv(FILE* file, const std::vector<std::string>& names) const;
+		void writeJson(FILE* file, const std::vector<std::string>& names) const;
+
+		size_t size() const { return samples.size(); }
+		size_t capacity() const { return limit; }
+		uint32_t getIntervalMs() const { return intervalMs; }
+
+	private:
+		struct Sample {
+			uint64_t ms;
+			size_t totalBytes;
+			uint8_t gcstate;
+
+			// categories that held memory, as a range of values
+			uint32_t first;
+			uint32_t count;
+		};
+
+		struct CategoryBytes {
+			uint8_t memcat;
+			size_t bytes;
+		};
+
+		bool running = false;
+		size_t limit = 0;
+		uint32_t intervalMs = 0;
+
+		std::chrono::steady_clock::time_point begin;
+		std::vector<Sample> samples;
+		std::vector<CategoryBytes> values;
+
+		void take(lua_State* L, uint64_t ms, int gcstate);
+		void halve();
+		std::vector<uint8_t> usedCategories() const;
+	};
+}
@@ -0,0 +1,311 @@
+#include "inspect.h"
+
+#include <format>
+#include <cstdarg>
+#include <sstream>
+#include <charconv>
+
+#include <ldebug.h>
+
+#include "ldbg.h"
+#include "style.h"
+#include "disasm.h"
+
+namespace ldbg {
+	// one line per value in listings
+	static constexpr RenderOptions listRender = { 0, 0, 60 };
+
+	const char* Inspector::help =
+		"  bt, backtrace         - dump call stack\n"
+		"  disasm [func]         - disassemble the provided or the current function\n"
+		"  i, inspect [what]     - (no what) show function info\n"
+		"    locals              - list local variables and their values\n"
+		"    upvalues            - list upvalues and their values\n"
+		"    R<num> [opts]       - show value of register\n"
+		"    U<num> [opts]       - show value of upvalue\n"
+		"    K<num> [opts]       - show value of constant\n"
+		"                          (opts: depth=<n> width=<n> bytes=<n> from=<slot>)\n"
+		"    stack               - dump stack\n"
+		"    insn                - disassemble current instruction\n";
+
+	static std::string getSource(const Proto* p) {
+		char ss[LUA_IDSIZE];
+		return luaO_chunkid(ss, sizeof(ss), getstr(p->source), p->source->len);
+	}
+
+	template<typename T>
+	static bool parseInt(const std::string& s, T& idx) {
+		const char* end = s.data() + s.size();
+		auto result = std::from_chars(s.data(), end, idx);
+		return result.ec == std::errc() && result.ptr == end;
+	}
+
+	static bool parseRenderOptions(std::istream& ss, RenderOptions& ropts) {
+		std::string arg;
+		while (ss >> arg) {
+			size_t eq = arg.find('=');
+			if (eq == std::string::npos)
+				return false;
+
+			const std::string& key = arg.substr(0, eq);
+			const std::string& value = arg.substr(eq + 1);
+
+			bool ok = false;
+			if (key == "depth") ok = parseInt(value, ropts.depth);
+			else if (key == "width") ok = parseInt(value, ropts.width);
+			else if (key == "bytes") ok = parseInt(value, ropts.bytes);
+			else if (key == "from") ok = parseInt(value, ropts.from);
+
+			if (!ok)
+				return false;
+		}
+		return true;
+	}
+
+	uint32_t ThreadFrames::frameCount() const {
+		return dbg.getFrameCount(L);
+	}
+
+	FrameSource::Frame ThreadFrames::frame(uint32_t level) const {
+		const FrameView view = dbg.getFrame(L, level);
+		if (!view.valid())
+			return {};
+
+		Frame frame;
+		if (const Proto* p = view.proto()) {
+			frame.function = p->debugname ? getstr(p->debugname) : "??";
+			frame.source = getSource(p);
+			frame.linedefined = p->linedefined;
+			frame.line = view.line();
+			frame.pc = view.pc();
+		} else {
+			const char* name = view.closure()->c.debugname;
+			frame.function = name ? name : "??";
+			frame.source = "[C]";
+			frame.c = true;
+		}
+		return frame;
+	}
+
+	std::vector<FrameSource::Local> ThreadFrames::locals(uint32_t level) const {
+		std::vector<Local> locals;
+
+		const FrameView view = dbg.getFrame(L, level);
+		if (view.valid()) {
+			dbg.forEachLocal(view, [&](const LocalView& local) {
+				locals.push_back({ local.name(), (int)local.var->reg, local.active });
+			});
+		}
+		return locals;
+	}
+
+	std::string ThreadFrames::upvalueName(uint32_t level, int index) const {
+		const FrameView view = dbg.getFrame(L, level);
+		const Proto* p = view.valid() ? view.proto() : nullptr;
+		return p && index >= 0 && index < p->sizeupvalues ? getstr(p->upvalues[index]) : "";
+	}
+
+	int ThreadFrames::slotCount(uint32_t level, Slot slot) const {
+		const FrameView view = dbg.getFrame(L, level);
+		if (!view.valid())
+			return 0;
+
+		const Proto* p = view.proto();
+		switch (slot) {
+		case Slot::Register: {
+			// C frames own everything up to the next frame's function or the top of the stack
+			const TValue* end = p ? view.ci->base + p->maxstacksize : view.level ? (view.ci + 1)->func : L->top;
+			return (int)(end - view.ci->base);
+		}
+		case Slot::Constant:
+			return p ? p->sizek : 0;
+		case Slot::Upvalue:
+			return view.closure()->nupvalues;
+		}
+		return 0;
+	}
+
+	std::string ThreadFrames::value(uint32_t level, Slot slot, int index, const RenderOptions& options) const {
+		if (index < 0 || index >= slotCount(level, slot))
+			return "?";
+
+		const FrameView view = dbg.getFrame(L, level);
+		const TValue* o = slot == Slot::Register ? view.reg(index) : slot == Slot::Constant ? dbg.getConstant(view, index) : dbg.getUpvalue(view, index);
+		return o ? renderValue(o, options) : "?";
+	}
+
+	bool ThreadFrames::code(uint32_t level, const std::string& function, std::vector<Insn>& out) const {
+		const FrameView view = dbg.getFrame(L, level);
+		const Proto* p = view.valid() ? view.proto() : nullptr;
+
+		if (!function.empty()) {
+			p = nullptr;
+			for (const Proto* lp : dbg.getLoadedProtos()) {
+				if (lp->debugname && getstr(lp->debugname) == function) {
+					p = lp;
+					break;
+				}
+			}
+
+			if (!p)
+				return false;
+		}
+
+		if (!p)
+			return true;
+
+		for (const Instruction* pc = p->code; pc < p->code + p->sizecode; pc++) {
+			const int i = (int)(pc - p->code);
+
+			std::string text;
+			ldbg::idisasm(text, pc, p);
+			out.push_back({ i, p->lineinfo ? luaG_getline((Proto*)p, i) : 0, std::move(text) });
+		}
+		return true;
+	}
+
+	void Inspector::print(const char* fmt, ...) {
+		va_list args;
+		va_start(args, fmt);
+		const int n = vsnprintf(nullptr, 0, fmt, args);
+		va_end(args);
+
+		if (n <= 0)
+			return;
+
+		std::string text(n + 1, '\0');
+
+		va_start(args, fmt);
+		vsnprintf(text.data(), n + 1, fmt, args);
+		va_end(args);
+
+		text.resize(n);
+		output(text);
+	}
+
+	void Inspector::backtrace() {
+		const uint32_t count = source.frameCount();
+		for (uint32_t i = 0; i < count; i++) {
+			const FrameSource::Frame f = source.frame(i);
+			const char* marker = i == current ? ANSI_GREY "=> " ANSI_RESET : "   ";
+
+			if (f.c)
+				print("%s" ANSI_YELLOW "%u" ANSI_RESET " - [C] %s\n", marker, i + 1, f.function.c_str());
+			else
+				print("%s" ANSI_YELLOW "%u" ANSI_RESET " - %s:" ANSI_YELLOW "%d" ANSI_RESET " %s\n", marker, i + 1, f.source.c_str(), f.line, f.function.c_str());
+		}
+	}
+
+	void Inspector::inspect(const std::string& what) {
+		using Slot = FrameSource::Slot;
+
+		const FrameSource::Frame f = source.frame(current);
+		if (what.empty()) {
+			if (f.c)
+				print(ANSI_GREY "=> " ANSI_CYAN "%s" ANSI_RESET "() [C]\n", f.function.c_str());
+			else
+				print(ANSI_GREY "=> " ANSI_CYAN "%s" ANSI_RESET "() at %s:" ANSI_YELLOW "%d\n" ANSI_RESET, f.function.c_str(), f.source.c_str(), f.line);
+			return;
+		}
+
+		// R/K/U accept rendering options after the index, e.g. "R3 depth=3 from=200"
+		std::istringstream args(what);
+		std::string subcmd;
+		args >> subcmd;
+
+		RenderOptions ropts;
+		if ((subcmd[0] == 'R' || subcmd[0] == 'K' || subcmd[0] == 'U') && !parseRenderOptions(args, ropts)) {
+			print("options must be depth=<n>, width=<n>, bytes=<n> or from=<n>\n");
+			return;
+		}
+
+		if (subcmd == "locals") {
+			const std::vector<FrameSource::Local> locals = source.locals(current);
+			if (locals.empty()) {
+				print("missing local info\n");
+				return;
+			}
+
+			for (const auto& local : locals) {
+				print(ANSI_CYAN "  R%d" ANSI_RESET " = %s", local.reg, local.name.c_str());
+				if (local.active)
+					print(ANSI_GREY " ; %s\n" ANSI_RESET, source.value(current, Slot::Register, local.reg, listRender).c_str());
+				else
+					print(ANSI_GREY " ; inactive" ANSI_RESET "\n");
+			}
+		}
+		else if (subcmd == "upvalues") {
+			const int count = source.slotCount(current, Slot::Upvalue);
+			if (!count) {
+				print("no upvalues\n");
+				return;
+			}
+
+			for (int i = 0; i < count; i++) {
+				const std::string name = source.upvalueName(current, i);
+				print(ANSI_CYAN "  U%d" ANSI_RESET " = %s " ANSI_GREY "; %s\n" ANSI_RESET, i, name.empty() ? "?" : name.c_str(), source.value(current, Slot::Upvalue, i, listRender).c_str());
+			}
+		}
+		else if (subcmd == "stack") {
+			const uint32_t end = (uint32_t)source.slotCount(current, Slot::Register);
+			const uint32_t rows = (end + 3) / 4;
+
+			for (uint32_t i = 0; i < rows; i++) {
+				for (uint32_t j = 0; j < 4; j++) {
+					uint32_t idx = i + j * rows;
+					if (idx < end)
+						print(ANSI_CYAN "  R%-3d" ANSI_RESET " = %-15.15s", idx, source.value(current, Slot::Register, (int)idx, { 0, 0, 15 }).c_str());
+				}
+				print("\n");
+			}
+		}
+		else if (subcmd == "insn") {
+			std::vector<FrameSource::Insn> code;
+			source.code(current, "", code);
+
+			for (const auto& insn : code) {
+				if (!f.c && insn.pc == f.pc) {
+					print("%s\n", insn.text.c_str());
+					return;
+				}
+			}
+			print("no instruction recorded\n");
+		}
+		else if (subcmd[0] == 'R' || subcmd[0] == 'K' || subcmd[0] == 'U') {
+			const Slot slot = subcmd[0] == 'R' ? Slot::Register : subcmd[0] == 'K' ? Slot::Constant : Slot::Upvalue;
+
+			int idx = 0;
+			if (!parseInt(subcmd.substr(1), idx)) {
+				print("index must be a number\n");
+				return;
+			}
+
+			if (idx < 0 || idx >= source.slotCount(current, slot)) print("index out of range\n");
+			else print("%s\n", source.value(current, slot, idx, ropts).c_str());
+		}
+		else
+			print("unknown subcommand\n");
+	}
+
+	void Inspector::disasm(const std::string& function) {
+		std::vector<FrameSource::Insn> code;
+		if (!source.code(current, function, code)) {
+			print("function not found\n");
+			return;
+		}
+
+		if (code.empty()) {
+			print("no instructions recorded\n");
+			return;
+		}
+
+		// only the selected frame's own listing has a current instruction
+		const FrameSource::Frame f = source.frame(current);
+		const int pc = function.empty() && !f.c ? f.pc : -1;
+
+		std::string text;
+		for (const auto& insn : code)
+			text += std::format("{}" ANSI_GREY "{:04X}  " ANSI_RESET "{}\n", insn.pc == pc ? "=> " : "   ", (uint32_t)insn.pc, insn.text);
+		output(text);
+	}
+}
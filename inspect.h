@@ -0,0 +1,127 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <functional>
+
+#include <lstate.h>
+
+#include "render.h"
+
+namespace ldbg {
+	class Debugger;
+
+	/// <summary>
+	/// Frames and values the inspection commands read. The debugger reads them from a stopped thread and the
+	/// postmortem viewer from a saved document, so both answer bt, inspect and disasm the same way
+	/// </summary>
+	class FrameSource {
+	public:
+		enum class Slot {
+			Register,
+			Constant,
+			Upvalue
+		};
+
+		struct Frame {
+			std::string function;
+			std::string source;
+			int linedefined = 0;
+			int line = 0;
+			int pc = 0;
+			bool c = false;
+		};
+
+		struct Local {
+			std::string name;
+			int reg = 0;
+			bool active = false;
+		};
+
+		struct Insn {
+			int pc = 0;
+			int line = 0;
+			std::string text;
+		};
+
+		virtual ~FrameSource() = default;
+
+		virtual uint32_t frameCount() const = 0;
+
+		/// <param name="level">0 for the innermost frame</param>
+		virtual Frame frame(uint32_t level) const = 0;
+
+		virtual std::vector<Local> locals(uint32_t level) const = 0;
+		virtual std::string upvalueName(uint32_t level, int index) const = 0;
+
+		virtual int slotCount(uint32_t level, Slot slot) const = 0;
+
+		/// <summary>
+		/// Renders a register, constant or upvalue. Saved values were rendered when they were saved and ignore the options
+		/// </summary>
+		virtual std::string value(uint32_t level, Slot slot, int index, const RenderOptions& options) const = 0;
+
+		/// <summary>
+		/// Disassembles the function of a frame, or the named function if there is one
+		/// </summary>
+		/// <returns>false if no function has that name</returns>
+		virtual bool code(uint32_t level, const std::string& function, std::vector<Insn>& out) const = 0;
+	};
+
+	/// <summary>
+	/// Frames of a stopped thread; only valid until execution resumes
+	/// </summary>
+	class ThreadFrames : public FrameSource {
+	public:
+		ThreadFrames(const Debugger& dbg, lua_State* L) : dbg(dbg), L(L) {}
+
+		uint32_t frameCount() const override;
+		Frame frame(uint32_t level) const override;
+
+		std::vector<Local> locals(uint32_t level) const override;
+		std::string upvalueName(uint32_t level, int index) const override;
+
+		int slotCount(uint32_t level, Slot slot) const override;
+		std::string value(uint32_t level, Slot slot, int index, const RenderOptions& options) const override;
+
+		bool code(uint32_t level, const std::string& function, std::vector<Insn>& out) const override;
+
+	private:
+		const Debugger& dbg;
+		lua_State* L;
+	};
+
+	/// <summary>
+	/// The bt, inspect and disasm commands over a frame source, shared by the REPL and the postmortem viewer
+	/// </summary>
+	class Inspector {
+	public:
+		using Output = std::function<void(const std::string&)>;
+
+		// help lines of the commands, in the layout of the REPL's help; the REPL follows them with its own inspect subcommands
+		static const char* help;
+
+		Inspector(const FrameSource& source, Output output) : source(source), output(std::move(output)) {}
+
+		// selected frame, 0 for the innermost
+		uint32_t current = 0;
+
+		void backtrace();
+
+		/// <summary>
+		/// Runs an inspect subcommand on the selected frame
+		/// </summary>
+		/// <param name="what">Subcommand and its arguments; empty for the function info</param>
+		void inspect(const std::string& what);
+
+		/// <param name="function">Name of the function to disassemble; empty for the selected frame's</param>
+		void disasm(const std::string& function);
+
+	private:
+		const FrameSource& source;
+		Output output;
+
+		void print(const char* fmt, ...);
+	};
+}
@@ -0,0 +1,332 @@
+#include "json.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+namespace ldbg {
+	const Json& Json::operator[](const std::string& key) const {
+		static const Json null;
+		if (type != Type::Object)
+			return null;
+
+		for (const auto& [k, v] : object) {
+			if (k == key)
+				return v;
+		}
+		return null;
+	}
+
+	Json& Json::set(const std::string& key, Json value) {
+		type = Type::Object;
+		for (auto& [k, v] : object) {
+			if (k == key) {
+				v = std::move(value);
+				return *this;
+			}
+		}
+
+		object.emplace_back(key, std::move(value));
+		return *this;
+	}
+
+	Json& Json::push(Json value) {
+		type = Type::Array;
+		array.push_back(std::move(value));
+		return *this;
+	}
+
+	static void dumpString(std::string& out, const std::string& s) {
+		out += '"';
+		for (uint8_t c : s) {
+			switch (c) {
+			case '"': out += "\\\""; break;
+			case '\\': out += "\\\\"; break;
+			case '\b': out += "\\b"; break;
+			case '\f': out += "\\f"; break;
+			case '\n': out += "\\n"; break;
+			case '\r': out += "\\r"; break;
+			case '\t': out += "\\t"; break;
+			default:
+				if (c < 0x20) {
+					char buf[8];
+					snprintf(buf, sizeof(buf), "\\u%04x", c);
+					out += buf;
+				} else
+					out += (char)c;
+			}
+		}
+		out += '"';
+	}
+
+	void Json::dump(std::string& out) const {
+		switch (type) {
+		case Type::Null:
+			out += "null";
+			break;
+		case Type::Bool:
+			out += boolean ? "true" : "false";
+			break;
+		case Type::Number: {
+			if (!std::isfinite(number)) {
+				out += "null";
+				break;
+			}
+
+			char buf[32];
+			if (number == (double)(long long)number)
+				snprintf(buf, sizeof(buf), "%lld", (long long)number);
+			else
+				snprintf(buf, sizeof(buf), "%.17g", number);
+			out += buf;
+		} break;
+		case Type::String:
+			dumpString(out, string);
+			break;
+		case Type::Array: {
+			out += '[';
+			bool first = true;
+			for (const auto& v : array) {
+				if (!first)
+					out += ',';
+				first = false;
+				v.dump(out);
+			}
+			out += ']';
+		} break;
+		case Type::Object: {
+			out += '{';
+			bool first = true;
+			for (const auto& [k, v] : object) {
+				if (!first)
+					out += ',';
+				first = false;
+				dumpString(out, k);
+				out += ':';
+				v.dump(out);
+			}
+			out += '}';
+		} break;
+		}
+	}
+
+	std::string Json::dump() const {
+		std::string out;
+		dump(out);
+		return out;
+	}
+
+	struct JsonParser {
+		const char* p;
+		const char* end;
+		int depth = 0;
+
+		void skip() {
+			while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+				p++;
+		}
+
+		bool literal(const char* s) {
+			size_t len = strlen(s);
+			if ((size_t)(end - p) < len || memcmp(p, s, len))
+				return false;
+			p += len;
+			return true;
+		}
+
+		static void utf8(std::string& out, uint32_t cp) {
+			if (cp < 0x80)
+				out += (char)cp;
+			else if (cp < 0x800) {
+				out += (char)(0xC0 | (cp >> 6));
+				out += (char)(0x80 | (cp & 0x3F));
+			} else if (cp < 0x10000) {
+				out += (char)(0xE0 | (cp >> 12));
+				out += (char)(0x80 | ((cp >> 6) & 0x3F));
+				out += (char)(0x80 | (cp & 0x3F));
+			} else {
+				out += (char)(0xF0 | (cp >> 18));
+				out += (char)(0x80 | ((cp >> 12) & 0x3F));
+				out += (char)(0x80 | ((cp >> 6) & 0x3F));
+				out += (char)(0x80 | (cp & 0x3F));
+			}
+		}
+
+		bool hex4(uint32_t& cp) {
+			if (end - p < 4)
+				return false;
+
+			cp = 0;
+			for (int i = 0; i < 4; i++) {
+				char c = *p++;
+				cp <<= 4;
+				if (c >= '0' && c <= '9') cp |= c - '0';
+				else if (c >= 'a' && c <= 'f') cp |= c - 'a' + 10;
+				else if (c >= 'A' && c <= 'F') cp |= c - 'A' + 10;
+				else return false;
+			}
+			return true;
+		}
+
+		bool string(std::string& out) {
+			if (p >= end || *p != '"')
+				return false;
+			p++;
+
+			while (p < end && *p != '"') {
+				if (*p != '\\') {
+					out += *p++;
+					continue;
+				}
+
+				if (++p >= end)
+					return false;
+
+				switch (*p++) {
+				case '"': out += '"'; break;
+				case '\\': out += '\\'; break;
+				case '/': out += '/'; break;
+				case 'b': out += '\b'; break;
+				case 'f': out += '\f'; break;
+				case 'n': out += '\n'; break;
+				case 'r': out += '\r'; break;
+				case 't': out += '\t'; break;
+				case 'u': {
+					uint32_t cp = 0;
+					if (!hex4(cp))
+						return false;
+
+					// surrogate pair
+					if (cp >= 0xD800 && cp < 0xDC00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+						p += 2;
+						uint32_t lo = 0;
+						if (!hex4(lo))
+							return false;
+						cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+					}
+					utf8(out, cp);
+				} break;
+				default:
+					return false;
+				}
+			}
+
+			if (p >= end)
+				return false;
+			p++;
+			return true;
+		}
+
+		bool value(Json& out) {
+			// protocol messages are shallow; this only guards the stack against hostile input
+			if (++depth > 64)
+				return false;
+
+			skip();
+			if (p >= end)
+				return false;
+
+			bool ok = true;
+			switch (*p) {
+			case 'n':
+				ok = literal("null");
+				break;
+			case 't':
+				ok = literal("true");
+				out = Json(true);
+				break;
+			case 'f':
+				ok = literal("false");
+				out = Json(false);
+				break;
+			case '"':
+				out.type = Json::Type::String;
+				ok = string(out.string);
+				break;
+			case '[': {
+				p++;
+				out = Json::makeArray();
+				skip();
+				if (p < end && *p == ']') {
+					p++;
+					break;
+				}
+
+				while (ok) {
+					Json v;
+					if (!(ok = value(v)))
+						break;
+					out.array.push_back(std::move(v));
+
+					skip();
+					if (p < end && *p == ',') p++;
+					else if (p < end && *p == ']') { p++; break; }
+					else ok = false;
+				}
+			} break;
+			case '{': {
+				p++;
+				out = Json::makeObject();
+				skip();
+				if (p < end && *p == '}') {
+					p++;
+					break;
+				}
+
+				while (ok) {
+					skip();
+
+					std::string key;
+					if (!(ok = string(key)))
+						break;
+
+					skip();
+					if (p >= end || *p++ != ':') {
+						ok = false;
+						break;
+					}
+
+					Json v;
+					if (!(ok = value(v)))
+						break;
+					out.object.emplace_back(std::move(key), std::move(v));
+
+					skip();
+					if (p < end && *p == ',') p++;
+					else if (p < end && *p == '}') { p++; break; }
+					else ok = false;
+				}
+			} break;
+			default: {
+				char* numEnd = nullptr;
+				std::string num(p, std::min<size_t>(end - p, 64));
+				double n = strtod(num.c_str(), &numEnd);
+				if (numEnd == num.c_str()) {
+					ok = false;
+					break;
+				}
+
+				p += numEnd - num.c_str();
+				out = Json(n);
+			} break;
+			}
+
+			depth--;
+			return ok;
+		}
+	};
+
+	bool Json::parse(const std::string& text, Json& out) {
+		JsonParser parser = { text.data(), text.data() + text.size() };
+
+		out = Json();
+		if (!parser.value(out))
+			return false;
+
+		parser.skip();
+		return parser.p == parser.end;
+	}
+}
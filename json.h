@@ -0,0 +1,75 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+
+namespace ldbg {
+	/// <summary>
+	/// Minimal JSON document used by the protocol front ends
+	/// </summary>
+	struct Json {
+		enum class Type {
+			Null,
+			Bool,
+			Number,
+			String,
+			Array,
+			Object
+		};
+
+		Type type = Type::Null;
+		bool boolean = false;
+		double number = 0;
+		std::string string;
+		std::vector<Json> array;
+		std::vector<std::pair<std::string, Json>> object;
+
+		Json() = default;
+		Json(bool b) : type(Type::Bool), boolean(b) {}
+		Json(int n) : type(Type::Number), number(n) {}
+		Json(double n) : type(Type::Number), number(n) {}
+		Json(const char* s) : type(Type::String), string(s) {}
+		Json(std::string s) : type(Type::String), string(std::move(s)) {}
+
+		static Json makeArray() { Json j; j.type = Type::Array; return j; }
+		static Json makeObject() { Json j; j.type = Type::Object; return j; }
+
+		bool isNull() const { return type == Type::Null; }
+
+		/// <summary>
+		/// Looks up a member of an object
+		/// </summary>
+		/// <returns>The member or a null value if it doesn't exist</returns>
+		const Json& operator[](const std::string& key) const;
+
+		/// <summary>
+		/// Adds or replaces a member of an object
+		/// </summary>
+		/// <returns>The object itself for chaining</returns>
+		Json& set(const std::string& key, Json value);
+
+		/// <summary>
+		/// Appends an element to an array
+		/// </summary>
+		/// <returns>The array itself for chaining</returns>
+		Json& push(Json value);
+
+		int integer(int def = 0) const { return type == Type::Number ? (int)number : def; }
+		bool truthy() const { return type == Type::Bool ? boolean : false; }
+
+		/// <summary>
+		/// Serializes the document without any whitespace
+		/// </summary>
+		std::string dump() const;
+		void dump(std::string& out) const;
+
+		/// <summary>
+		/// Parses a document
+		/// </summary>
+		/// <param name="text">Text to parse</param>
+		/// <param name="out">Parsed document</param>
+		/// <returns>false if the text isn't valid JSON</returns>
+		static bool parse(const std::string& text, Json& out);
+	};
+}
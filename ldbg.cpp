@@ -1,6 +1,8 @@
 #include "ldbg.h"
 
 #include <format>
+#include <cstdarg>
+#include <csignal>
 #include <fstream>
 #include <sstream>
 #include <algorithm>
@@ -10,13 +12,19 @@
 #include <lmem.h>
 #include <lfunc.h>
 #include <ldebug.h>
+#include <ltable.h>
 #include <lualib.h>
 #include <Luau/Compiler.h>
 #include <Luau/Bytecode.h>
 #include <Luau/BytecodeUtils.h>
 
 #include "style.h"
+#include "dap.h"
 #include "disasm.h"
+#include "render.h"
+#include "heap.h"
+#include "postmortem.h"
+#include "inspect.h"
 
 #define DLL_PROCESS_ATTACH	1
 #define DLL_THREAD_ATTACH	2
@@ -29,10 +37,11 @@ namespace nula {
 
 namespace ldbg {
 
-	static std::unordered_map<lua_State*, Debugger*> debuggers;
+	// keyed by VM so that every coroutine is covered without registering it
+	static std::unordered_map<global_State*, Debugger*> debuggers;
 
 	static void debugstep(lua_State* L, lua_Debug* ar) {
-		auto it = debuggers.find(L);
+		auto it = debuggers.find(L->global);
 		if (it == debuggers.end())
 			return;
 
@@ -40,29 +49,181 @@ namespace ldbg {
 	}
 
 	static void debugbreak(lua_State* L, lua_Debug* ar) {
-		auto it = debuggers.find(L);
+		auto it = debuggers.find(L->global);
 		if (it == debuggers.end())
 			return;
 
 		it->second->debugbreak(L, ar);
 	}
 
+	static void userthread(lua_State* LP, lua_State* L) {
+		auto it = debuggers.find(L->global);
+		if (it == debuggers.end())
+			return;
+
+		Debugger* dbg = it->second;
+		if (LP)
+			L->singlestep = !dbg->options.breakpointsOnly;
+		else
+			dbg->onThreadDestroyed(L);
+
+		if (dbg->oldUserthread)
+			dbg->oldUserthread(LP, L);
+	}
+
+	static void interrupt(lua_State* L, int gc) {
+		auto it = debuggers.find(L->global);
+		if (it == debuggers.end())
+			return;
+
+		Debugger* dbg = it->second;
+
+		// gc >= 0 comes from inside a collector step where stopping isn't safe
+		if (gc == -1)
+			dbg->interrupt(L);
+		else {
+			if (dbg->timeline.active())
+				dbg->timeline.onGcStep(L, gc);
+			if (dbg->gcBreakStates || dbg->gcTuning)
+				dbg->noteGcState(L);
+		}
+
+		if (dbg->oldInterrupt)
+			dbg->oldInterrupt(L, gc);
+	}
+
+	static void onallocate(lua_State* L, size_t osize, size_t nsize) {
+		auto it = debuggers.find(L->global);
+		if (it == debuggers.end())
+			return;
+
+		Debugger* dbg = it->second;
+
+		// the counters are already updated here, and they only cross a threshold upwards when something grows
+		if (nsize > osize) {
+			const global_State* g = L->global;
+			for (size_t i = 0; i < dbg->memoryBreakpoints.size(); i++) {
+				MemoryBreakpoint& mb = dbg->memoryBreakpoints[i];
+				const size_t bytes = mb.memcat < 0 ? g->totalbytes : g->memcatbytes[mb.memcat];
+				if (bytes <= mb.threshold) {
+					mb.above = false;
+					continue;
+				}
+
+				if (mb.above)
+					continue;
+				mb.above = true;
+
+				// allocations made by the REPL itself don't stop anything
+				if (!dbg->stoppedThread && !dbg->memoryBreakHit) {
+					dbg->memoryBreakHit = i + 1;
+					dbg->memoryBreakBytes = bytes;
+					dbg->requestInterrupt();
+				}
+			}
+		}
+
+		if (dbg->oldOnallocate)
+			dbg->oldOnallocate(L, osize, nsize);
+	}
+
+	// names the memory categories of heap snapshots after the modules they were tagged with
+	static const char* memcatName(lua_State* L, uint8_t memcat) {
+		auto it = debuggers.find(L->global);
+		if (it == debuggers.end())
+			return "";
+
+		const auto& names = it->second->getMemcatNames();
+		return memcat < names.size() ? names[memcat].c_str() : "";
+	}
+
+	template<typename F>
+	static void visitThreads(lua_State* L, F&& visit) {
+		global_State* g = L->global;
+		visit(g->mainthread);
+
+		struct Context {
+			global_State* g;
+			std::remove_reference_t<F>* visit;
+		};
+		Context ctx = { g, &visit };
+
+		// the main thread isn't allocated from the heap pages
+		luaM_visitgco(L, &ctx, [](void* _ctx, lua_Page* page, GCObject* gco) -> bool {
+			Context* ctx = (Context*)_ctx;
+			if (gco->gch.tt == LUA_TTHREAD && !isdead(ctx->g, gco) && gco2th(gco) != ctx->g->mainthread)
+				(*ctx->visit)(gco2th(gco));
+			return false;
+		});
+	}
+
 	static int onError(lua_State* L) {
-		const Debugger::Options& options = ((Debugger*)L->global->ud)->options;
+		auto it = debuggers.find(L->global);
+		if (it == debuggers.end())
+			return 0;
+
+		Debugger* dbg = it->second;
 
-		fprintf(options.out, ANSI_RED "%s" ANSI_GREY "\nStack Begin\n", luaL_checkstring(L, 1));
+		// expressions evaluated at a stop still report their errors right away
+		if (dbg->options.postmortem && !dbg->getStoppedThread()) {
+			dbg->writePostmortem(L, lua_tostring(L, 1), 1);
+			return 0;
+		}
+
+		if (dbg->options.captureErrors && !dbg->getStoppedThread()) {
+			dbg->captureError(L, lua_tostring(L, 1), 1);
+			return 0;
+		}
+
+		dbg->print(ANSI_RED "%s" ANSI_GREY "\nStack Begin\n", luaL_checkstring(L, 1));
 		lua_getglobal(L, "debug");
 		lua_getfield(L, -1, "traceback");
 		lua_call(L, 0, 1);
 		if (const char* traceback = lua_tostring(L, -1))
-			fprintf(options.out, "%s", traceback);
-		fprintf(options.out, "Stack End\n" ANSI_RESET);
+			dbg->print("%s", traceback);
+		dbg->print("Stack End\n" ANSI_RESET);
 		lua_pop(L, 2);
+		dbg->flushOutput();
 		return 0;
 	}
 
 	extern std::string lua_strprimitive(const TValue* o);
 
+	// the environment of evaluated expressions. Names bound in the table of upvalue 1 resolve to the frame's
+	// locals and upvalues; a bound nil is stored as that table itself so it still shadows the global of the same
+	// name. Every other name goes to the globals in upvalue 2
+	static int evalIndex(lua_State* L) {
+		lua_pushvalue(L, 2);
+		lua_rawget(L, lua_upvalueindex(1));
+
+		if (lua_isnil(L, -1)) {
+			lua_pop(L, 1);
+			lua_pushvalue(L, 2);
+			lua_gettable(L, lua_upvalueindex(2));
+		} else if (lua_rawequal(L, -1, lua_upvalueindex(1))) {
+			lua_pop(L, 1);
+			lua_pushnil(L);
+		}
+		return 1;
+	}
+
+	static int evalNewindex(lua_State* L) {
+		lua_pushvalue(L, 2);
+		lua_rawget(L, lua_upvalueindex(1));
+		const bool bound = !lua_isnil(L, -1);
+		lua_pop(L, 1);
+
+		lua_pushvalue(L, 2);
+		if (bound) {
+			lua_pushvalue(L, lua_isnil(L, 3) ? lua_upvalueindex(1) : 3);
+			lua_rawset(L, lua_upvalueindex(1));
+		} else {
+			lua_pushvalue(L, 3);
+			lua_settable(L, lua_upvalueindex(2));
+		}
+		return 0;
+	}
+
 	template<typename T>
 	static bool parseInt(const std::string& s, T& idx) {
 		const char* end = s.data() + s.size();
@@ -80,6 +241,51 @@ namespace ldbg {
 		return std::all_of(s.begin(), s.end(), [](uint8_t c) { return isdigit(c); });
 	}
 
+	// "<n>[KB|MB|GB]", in powers of 1024
+	static bool parseSize(const std::string& s, size_t& bytes) {
+		size_t value = 0;
+		const auto result = std::from_chars(s.data(), s.data() + s.size(), value);
+		if (result.ec != std::errc() || result.ptr == s.data())
+			return false;
+
+		std::string unit(result.ptr, s.data() + s.size());
+		std::transform(unit.begin(), unit.end(), unit.begin(), [](uint8_t c) { return (char)toupper(c); });
+
+		int shift;
+		if (unit.empty() || unit == "B")
+			shift = 0;
+		else if (unit == "K" || unit == "KB")
+			shift = 10;
+		else if (unit == "M" || unit == "MB")
+			shift = 20;
+		else if (unit == "G" || unit == "GB")
+			shift = 30;
+		else
+			return false;
+
+		bytes = value << shift;
+		return true;
+	}
+
+	// collector phases go by the names luaC_statename gives them, which the gc events report as well
+	static int parseGcPhase(const std::string& phase) {
+		for (int i = GCSpause; i <= GCSsweep; i++) {
+			if (phase == luaC_statename(i))
+				return i;
+		}
+		return -1;
+	}
+
+	static std::string gcPhaseNames(const char* separator) {
+		std::string names;
+		for (int i = GCSpause; i <= GCSsweep; i++) {
+			if (i != GCSpause)
+				names += separator;
+			names += luaC_statename(i);
+		}
+		return names;
+	}
+
 	static std::string getSource(Proto* p) {
 		char ss[LUA_IDSIZE];
 		return luaO_chunkid(ss, sizeof(ss), getstr(p->source), p->source->len);
@@ -87,16 +293,34 @@ namespace ldbg {
 
 	static void* frealloc(void* ud, void* ptr, size_t osize, size_t nsize) {
 		Debugger* dbg = (Debugger*)ud;
+
+		Event event;
+		event.kind = EventKind::Gc;
+		event.address = (uintptr_t)ptr;
+		event.oldSize = osize;
+		event.newSize = nsize;
+
 		if (!ptr)
-			fprintf(dbg->options.out, "[gc trace] allocation with size " ANSI_YELLOW "%zu\n" ANSI_RESET, nsize);
+			event.text = std::format("[gc trace] allocation with size " ANSI_YELLOW "{}\n" ANSI_RESET, nsize);
 		else if (!nsize)
-			fprintf(dbg->options.out, "[gc trace] deallocation of ptr " ANSI_YELLOW "0x%llx\n" ANSI_RESET, (uintptr_t)ptr);
+			event.text = std::format("[gc trace] deallocation of ptr " ANSI_YELLOW "0x{:x}\n" ANSI_RESET, (uintptr_t)ptr);
 		else
-			fprintf(dbg->options.out, "[gc trace] reallocation of ptr " ANSI_YELLOW "0x%llx" ANSI_RESET ": " ANSI_YELLOW "%zu" ANSI_RESET " -> " ANSI_YELLOW "%zu\n" ANSI_RESET, (uintptr_t)ptr, osize, nsize);
+			event.text = std::format("[gc trace] reallocation of ptr " ANSI_YELLOW "0x{:x}" ANSI_RESET ": " ANSI_YELLOW "{}" ANSI_RESET " -> " ANSI_YELLOW "{}\n" ANSI_RESET, (uintptr_t)ptr, osize, nsize);
 
+		dbg->emit(event);
 		return dbg->oldFrealloc(ud, ptr, osize, nsize);
 	}
 
+	static Event frameEvent(EventKind kind, Proto* p, const Instruction* pc) {
+		Event event;
+		event.kind = kind;
+		event.function = p->debugname ? getstr(p->debugname) : "??";
+		event.source = getSource(p);
+		event.pc = (int)(pc - p->code);
+		event.line = p->lineinfo ? luaG_getline(p, event.pc) : 0;
+		return event;
+	}
+
 	static void ensureDebugInsn(lua_State* L, Proto* p) {
 		if (p->debuginsn)
 			return;
@@ -113,13 +337,22 @@ namespace ldbg {
 
 		options.in = stdin;
 		options.out = stdout;
+
+		options.sink = nullptr;
+
+		options.batch = false;
+		options.breakpointsOnly = false;
+		options.captureErrors = false;
+
+		options.postmortem = nullptr;
+		options.postmortemAbort = false;
 	}
 
 	Debugger::~Debugger() {
 		std::vector<lua_State*> states;
-		for (const auto& [L, dbg] : debuggers) {
-			if (L && dbg == this)
-				states.emplace_back(L);
+		for (const auto& [g, dbg] : debuggers) {
+			if (g && dbg == this)
+				states.emplace_back(g->mainthread);
 		}
 
 		for (const auto& L : states)
@@ -127,21 +360,510 @@ namespace ldbg {
 	}
 
 	void Debugger::attach(lua_State* L) {
-		debuggers[L] = this;
+		debuggers[L->global] = this;
 
 		L->global->cb.debugstep = ldbg::debugstep;
 		L->global->cb.debugbreak = ldbg::debugbreak;
 
-		L->singlestep = true;
+		// new threads are picked up on creation, existing ones right away
+		oldUserthread = L->global->cb.userthread;
+		L->global->cb.userthread = ldbg::userthread;
+
+		vm = L->global;
+		oldInterrupt = L->global->cb.interrupt;
+		if (interruptArmed())
+			requestInterrupt();
+
+		oldOnallocate = L->global->cb.onallocate;
+		updateAllocationHook();
+
+		if (options.captureErrors && !errorStacks)
+			errorStacks = std::make_unique<StackCapture>();
+
+		// without singlestep there's no first instruction to stop at
+		const bool singlestep = !options.breakpointsOnly;
+		visitThreads(L, [singlestep](lua_State* th) { th->singlestep = singlestep; });
+
+		breakNext = singlestep;
+		updateStepping();
 	}
 
 	void Debugger::detach(lua_State* L) {
-		debuggers.erase(L);
+		debuggers.erase(L->global);
+
+		recorder.stop(L);
+		tracer.stop();
+		profiler.stop();
+		timeline.stop();
+
+		fastcalls.stop();
+		fastcalls.clear(L);
+		slots.stop();
+		slots.clear(L);
+		closures.stop();
+		closures.clear(L);
+
+		for (const auto& [expr, ref] : exprCache)
+			lua_unref(L, ref);
+		exprCache.clear();
+
+		if (evalEnv != LUA_NOREF) {
+			lua_unref(L, evalEnv);
+			lua_unref(L, evalBindings);
+			evalEnv = LUA_NOREF;
+			evalBindings = LUA_NOREF;
+		}
 
-		L->singlestep = false;
+		visitThreads(L, [](lua_State* th) { th->singlestep = false; });
+		threads.clear();
+		reportErrors(L);
+		flushOutput();
 
 		L->global->cb.debugstep = nullptr;
 		L->global->cb.debugbreak = nullptr;
+		L->global->cb.userthread = oldUserthread;
+		oldUserthread = nullptr;
+
+		L->global->cb.interrupt = oldInterrupt;
+		oldInterrupt = nullptr;
+		L->global->cb.onallocate = oldOnallocate;
+		oldOnallocate = nullptr;
+		memoryBreakHit = 0;
+		if (vm == L->global)
+			vm = nullptr;
+	}
+
+	void Debugger::pause() {
+		pauseRequested = true;
+		requestInterrupt();
+	}
+
+	void Debugger::requestInterrupt() {
+		if (global_State* g = vm)
+			g->cb.interrupt = ldbg::interrupt;
+	}
+
+	void Debugger::setWatchdog(Watchdog::Unit unit, uint64_t budget, bool sample) {
+		watchdog.unit = unit;
+		watchdog.budget = budget;
+		watchdog.sample = sample;
+		watchdog.thread = nullptr;
+
+		if (budget)
+			requestInterrupt();
+		else
+			releaseInterrupt();
+	}
+
+	void Debugger::releaseInterrupt() {
+		if (vm && !pauseRequested && !(dap && dap->pending) && !interruptArmed())
+			vm->cb.interrupt = oldInterrupt;
+	}
+
+	void Debugger::interrupt(lua_State* L) {
+		// uninstall first so that requests made from here on install the hook again
+		L->global->cb.interrupt = interruptArmed() ? ldbg::interrupt : oldInterrupt;
+
+		// timestamps are taken before anything else runs
+		if (tracer.active())
+			tracer.onInterrupt(L);
+		if (profiler.active())
+			profiler.onInterrupt(L);
+
+		if (dap && dap->pending)
+			dap->poll(L);
+
+		if (watchdog.budget && checkWatchdog(L))
+			return;
+
+		if (gcBreakStates)
+			noteGcState(L);
+
+		const Closure* cl = clvalue(L->ci->func);
+
+		// memory and collector breakpoints hit in C functions stop at the caller's next safe point
+		const char* reason = nullptr;
+		if ((memoryBreakHit || gcBreakHit >= 0) && cl->isC)
+			requestInterrupt();
+		else {
+			if (memoryBreakHit && takeMemoryBreak(L))
+				reason = "memory breakpoint";
+			if (gcBreakHit >= 0 && takeGcBreak(L))
+				reason = "gc breakpoint";
+		}
+
+		// a request made while a stop is being handled, e.g. by code evaluated at it, has nothing to interrupt
+		const bool paused = pauseRequested.exchange(false) && !stoppedThread;
+		if (!paused && !reason)
+			return;
+
+		if (cl->isC) {
+			pause();
+			return;
+		}
+
+		const Instruction* pc = L->ci->savedpc - 1;
+
+		Event event = frameEvent(EventKind::Step, cl->l.p, pc);
+		event.text = std::format("{} in function '{}' at {}:" ANSI_YELLOW "{}\n" ANSI_RESET, reason ? "stopped" : "paused", event.function, event.source, event.line);
+		emit(event);
+
+		std::string insn;
+		ldbg::idisasm(insn, pc, cl->l.p);
+		print("%s\n", insn.c_str());
+
+		stopReason = reason ? reason : "pause";
+		repl(L);
+	}
+
+	bool Debugger::checkWatchdog(lua_State* L) {
+		const Closure* cl = clvalue(L->ci->func);
+		if (cl->isC || L->ci == L->base_ci)
+			return false;
+
+		// a different outermost function means the last call ended without returning here, e.g. by erroring
+		const Closure* entry = clvalue((L->base_ci + 1)->func);
+		if (!watchdog.thread || (watchdog.thread == L && watchdog.entry != entry)) {
+			watchdog.thread = L;
+			watchdog.entry = entry;
+			watchdog.instructions = 0;
+			watchdog.ticks = 0;
+			watchdog.start = std::chrono::steady_clock::now();
+		}
+
+		Proto* p = cl->l.p;
+		const Instruction* pc = L->ci->savedpc - 1;
+
+		uint8_t op = LUAU_INSN_OP(*pc);
+		if (op == LOP_BREAK && p->debuginsn)
+			op = p->debuginsn[pc - p->code];
+
+		switch (op) {
+		case LOP_JUMPBACK:
+		case LOP_FORNLOOP:
+		case LOP_FORGLOOP:
+			// every iteration runs the instructions the back-edge jumps over
+			watchdog.instructions += std::max(1, -LUAU_INSN_D(*pc));
+			break;
+		default:
+			watchdog.instructions++;
+			break;
+		}
+
+		bool exceeded;
+		if (watchdog.unit == Watchdog::Unit::Instructions)
+			exceeded = watchdog.instructions > watchdog.budget;
+		else
+			// reading the clock at every safe point would dominate tight loops
+			exceeded = (++watchdog.ticks & 255) == 0 && std::chrono::steady_clock::now() - watchdog.start > std::chrono::milliseconds(watchdog.budget);
+
+		const bool returning = op == LOP_RETURN && L->ci == L->base_ci + 1 && watchdog.thread == L;
+		if (!exceeded) {
+			if (returning)
+				watchdog.thread = nullptr;
+			return false;
+		}
+
+		const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - watchdog.start).count();
+		const std::string summary = std::format("watchdog: top-level call ran ~{} instructions in {} ms", watchdog.instructions, elapsed);
+
+		// a runaway call is reported once per budget
+		watchdog.thread = nullptr;
+
+		if (watchdog.sample) {
+			std::string sample = summary + '\n';
+
+			lua_Debug ar;
+			for (int level = 0; lua_getinfo(L, level, "sln", &ar); level++)
+				sample += std::format("  {} - {}:{} {}\n", level + 1, ar.short_src, ar.currentline, ar.name ? ar.name : "??");
+
+			print("%s", sample.c_str());
+
+			if (watchdog.samples.size() >= 32)
+				watchdog.samples.pop_front();
+			watchdog.samples.push_back(std::move(sample));
+			return false;
+		}
+
+		Event event = frameEvent(EventKind::Step, p, pc);
+		event.text = std::format("{} in function '{}' at {}:" ANSI_YELLOW "{}\n" ANSI_RESET, summary, event.function, event.source, event.line);
+		emit(event);
+
+		std::string insn;
+		ldbg::idisasm(insn, pc, p);
+		print("%s\n", insn.c_str());
+
+		stopReason = "watchdog";
+		repl(L);
+		return true;
+	}
+
+	void Debugger::captureError(lua_State* L, const char* message, uint32_t skip) {
+		if (!errorStacks)
+			errorStacks = std::make_unique<StackCapture>();
+		else if (errorStacks->full())
+			reportErrors(L);
+
+		errorStacks->capture(L, message, skip);
+	}
+
+	void Debugger::writePostmortem(lua_State* L, const char* message, uint32_t skip) {
+		const std::string path = std::format("{}.{}.json", options.postmortem, ++postmortemCount);
+
+		FILE* file = nullptr;
+		if (fopen_s(&file, path.c_str(), "w") || !file) {
+			print("unable to open %s\n", path.c_str());
+			return;
+		}
+
+		const std::string text = capturePostmortem(*this, L, message, skip).dump();
+		fwrite(text.data(), 1, text.size(), file);
+		fclose(file);
+
+		print(ANSI_RED "%s" ANSI_RESET "\npostmortem written to %s\n", message ? message : "", path.c_str());
+
+		if (options.postmortemAbort) {
+			flushOutput();
+
+			// the status a shell reports for an abort, so a restarted run doesn't leave the root waiting
+			checkpoints.end(128 + SIGABRT);
+			abort();
+		}
+	}
+
+	void Debugger::reportErrors(lua_State* L) {
+		if (!errorStacks || (!errorStacks->size() && !errorStacks->dropped()))
+			return;
+
+		auto sameFrame = [](const CapturedFrame& a, const CapturedFrame& b) {
+			return a.p == b.p && a.cfunc == b.cfunc && a.pc == b.pc;
+		};
+
+		// identical stacks are reported once, with the first message and a count
+		std::vector<std::pair<size_t, size_t>> groups;
+		for (size_t i = 0; i < errorStacks->size(); i++) {
+			const auto frames = errorStacks->framesOf(i);
+			auto it = std::find_if(groups.begin(), groups.end(), [&](const auto& group) {
+				const auto other = errorStacks->framesOf(group.first);
+				return std::equal(frames.begin(), frames.end(), other.begin(), other.end(), sameFrame);
+			});
+
+			if (it != groups.end())
+				it->second++;
+			else
+				groups.emplace_back(i, 1);
+		}
+
+		std::string out;
+		for (const auto& [index, count] : groups) {
+			out += std::format(ANSI_RED "{}" ANSI_GREY " (x{})\n", errorStacks->stack(index).message, count);
+			symbolizer.format(*errorStacks, index, out);
+			out += ANSI_RESET "";
+		}
+
+		if (errorStacks->dropped())
+			out += std::format("{} errors dropped\n", errorStacks->dropped());
+
+		print("%s", out.c_str());
+
+		// unpinned protos may be collected and their addresses reused by new ones
+		errorStacks->clear(L);
+		symbolizer.clear();
+	}
+
+	uint8_t Debugger::tagMemcat(const std::string& name) {
+		if (memcatNames.empty())
+			memcatNames.resize(LUA_MEMORY_CATEGORIES);
+
+		auto it = std::find(memcatNames.begin(), memcatNames.end(), name);
+		if (it != memcatNames.end())
+			return (uint8_t)(it - memcatNames.begin());
+
+		// category 0 is where everything untagged goes
+		for (int i = 1; i < LUA_MEMORY_CATEGORIES; i++) {
+			if (memcatNames[i].empty()) {
+				memcatNames[i] = name;
+				return (uint8_t)i;
+			}
+		}
+		return 0;
+	}
+
+	void Debugger::startMemoryTimeline(lua_State* L, size_t capacity, uint32_t intervalMs) {
+		timeline.start(L, capacity, intervalMs);
+		requestInterrupt();
+	}
+
+	bool Debugger::writeMemoryTimeline(const std::string& path) {
+		FILE* file = nullptr;
+		if (fopen_s(&file, path.c_str(), "w") || !file)
+			return false;
+
+		if (path.ends_with(".csv"))
+			timeline.writeCsv(file, memcatNames);
+		else
+			timeline.writeJson(file, memcatNames);
+
+		fclose(file);
+		return true;
+	}
+
+	std::string Debugger::saveBreakpoints() const {
+		std::string saved;
+		for (const auto& bp : breakpoints) {
+			auto it = std::find(loadedProtos.begin(), loadedProtos.end(), bp.p);
+			if (it != loadedProtos.end())
+				saved += std::format("{} {} {} {}\n", it - loadedProtos.begin(), bp.pc, bp.enabled ? 1 : 0, (uintptr_t)bp.thread);
+		}
+		return saved;
+	}
+
+	void Debugger::restoreBreakpoints(lua_State* L, const std::string& saved) {
+		while (!breakpoints.empty())
+			deleteBreakpoint(breakpoints.size());
+
+		std::istringstream in(saved);
+		size_t index = 0, skipped = 0;
+		int pc = 0, enabled = 0;
+		uintptr_t thread = 0;
+
+		while (in >> index >> pc >> enabled >> thread) {
+			// protos loaded and threads created after the checkpoint don't exist here
+			Proto* p = index < loadedProtos.size() ? loadedProtos[index] : nullptr;
+			lua_State* th = thread ? findThread(L, thread) : nullptr;
+			if (!p || pc >= p->sizecode || (thread && !th)) {
+				skipped++;
+				continue;
+			}
+
+			breakpointThread = th;
+			const size_t num = setBreakpoint(L, p, pc, getSource(p), p->lineinfo ? luaG_getline(p, pc) : 0, true);
+			breakpointThread = nullptr;
+
+			if (!enabled) {
+				Breakpoint& bp = breakpoints[num - 1];
+				bp.enabled = false;
+				p->code[pc] = (p->code[pc] & ~0xFF) | p->debuginsn[pc];
+			}
+		}
+
+		if (skipped)
+			print("%zu breakpoints don't exist at this checkpoint\n", skipped);
+	}
+
+	void Debugger::reverseStep(lua_State* L, bool overCalls, bool toBreakpoint) {
+		if (!recorder.active()) {
+			print("not recording; use record start\n");
+			return;
+		}
+
+		const Recorder::Entry* from = recorder.position();
+		lua_State* thread = from ? from->thread : L;
+		const uint32_t level = from ? from->level : getFrameCount(L);
+
+		const Recorder::Entry* e = recorder.undo(L);
+
+		// the newest instruction was logged at this stop but hasn't run yet
+		const FrameView top = getFrame(L, 0);
+		if (e && !from && e->thread == L && e->level == level && top.valid() && e->p == top.proto() && e->pc == top.pc())
+			e = recorder.undo(L);
+
+		auto atBreakpoint = [this](const Recorder::Entry* e) {
+			return std::any_of(breakpoints.begin(), breakpoints.end(), [e](const Breakpoint& bp) {
+				return bp.enabled && bp.p == e->p && bp.pc == e->pc;
+			});
+		};
+
+		while (e && ((overCalls && (e->thread != thread || e->level > level)) || (toBreakpoint && !atBreakpoint(e))))
+			e = recorder.undo(L);
+
+		const Recorder::Entry* at = recorder.position();
+		if (!at) {
+			print("nothing was recorded before this point\n");
+			return;
+		}
+
+		if (!e)
+			print("reached the start of the recording\n");
+
+		const Instruction* pc = at->p->code + at->pc;
+		Event event = frameEvent(EventKind::Step, at->p, pc);
+		event.text = std::format("replaying {} instructions back in function '{}' at {}:" ANSI_YELLOW "{}\n" ANSI_RESET,
+			recorder.getStepsBack(), event.function, event.source, event.line);
+		emit(event);
+
+		std::string insn;
+		ldbg::idisasm(insn, pc, at->p);
+		print("%s\n", insn.c_str());
+
+		if (at->thread != L || at->level != getFrameCount(L))
+			print(ANSI_GREY "(not the stopped frame; inspect still shows that one)\n" ANSI_RESET);
+	}
+
+	void Debugger::onThreadDestroyed(lua_State* L) {
+		threads.erase(L);
+
+		for (size_t i = breakpoints.size(); i-- > 0;) {
+			if (breakpoints[i].thread == L) {
+				print("breakpoint %zu deleted because its thread was collected\n", i + 1);
+				deleteBreakpoint(i + 1);
+			}
+		}
+
+		for (size_t i = watchpoints.size(); i-- > 0;) {
+			if (watchpoints[i].kind == Watchpoint::Kind::Register && watchpoints[i].thread == L) {
+				print("watchpoint %zu deleted because its thread was collected\n", i + 1);
+				removeWatchpoint(L, i);
+			}
+		}
+
+		if (stoppedThread == L)
+			stoppedThread = nullptr;
+		if (watchdog.thread == L)
+			watchdog.thread = nullptr;
+		tracer.onThreadDestroyed(L);
+		profiler.onThreadDestroyed(L);
+		updateStepping();
+	}
+
+	lua_State* Debugger::findThread(lua_State* L, uintptr_t address) {
+		lua_State* found = nullptr;
+		visitThreads(L, [&](lua_State* th) {
+			if ((uintptr_t)th == address)
+				found = th;
+		});
+		return found;
+	}
+
+	void Debugger::listThreads(lua_State* L) {
+		static const char* statusNames[] = { "running", "suspended", "normal", "finished", "error" };
+
+		print("  %-18s %-10s %-6s %s\n" ANSI_GREY "  ------------------ ---------- ------ --------------------\n" ANSI_RESET, "thread", "status", "depth", "location");
+
+		size_t count = 0;
+		visitThreads(L, [&](lua_State* th) {
+			const int status = lua_costatus(L, th);
+
+			std::string location;
+			const FrameView frame = getFrame(th, 0);
+			if (frame.valid() && !frame.isC()) {
+				const Proto* p = frame.proto();
+				location = std::format("{}() at {}:{}", p->debugname ? getstr(p->debugname) : "??", getSource((Proto*)p), frame.line());
+			}
+
+			auto it = threads.find(th);
+			print("%s " ANSI_YELLOW "0x%-16llx" ANSI_RESET " %-10s %-6u %s%s\n",
+				th == L ? ANSI_CYAN "*" ANSI_RESET : " ",
+				(unsigned long long)(uintptr_t)th,
+				status >= 0 && status < 5 ? statusNames[status] : "?",
+				getFrameCount(th),
+				location.c_str(),
+				it != threads.end() && it->second.stepping ? ANSI_GREY " (stepping)" ANSI_RESET : ""
+			);
+			count++;
+		});
+
+		print("\ntotal threads: " ANSI_YELLOW "%zu\n" ANSI_RESET, count);
 	}
 
 	size_t Debugger::setBreakpoint(lua_State* L, Proto* p, bool enable) {
@@ -169,9 +891,9 @@ namespace ldbg {
 		}
 
 		if (count > 0)
-			fprintf(options.out, "breakpoint %zu %s at %s:" ANSI_YELLOW "%d\n" ANSI_RESET, idx, enable ? "set" : "cleared", source.c_str(), line);
+			print("breakpoint %zu %s at %s:" ANSI_YELLOW "%d\n" ANSI_RESET, idx, enable ? "set" : "cleared", source.c_str(), line);
 		else
-			fprintf(options.out, "no functions found matching source '%s' or line number out of range\n", source.c_str());
+			print("no functions found matching source '%s' or line number out of range\n", source.c_str());
 		return idx;
 	}
 
@@ -201,7 +923,7 @@ namespace ldbg {
 
 	void Debugger::toggleBreakpoint(lua_State* L, size_t num) {
 		if (num < 1 || num > breakpoints.size()) {
-			puts("invalid breakpoint number");
+			print("invalid breakpoint number\n");
 			return;
 		}
 
@@ -214,911 +936,2549 @@ namespace ldbg {
 			bp.p->code[bp.pc] = LOP_BREAK;
 		}
 
-		fprintf(options.out, "breakpoint %zu %s\n", num, bp.enabled ? "enabled" : "disabled");
+		print("breakpoint %zu %s\n", num, bp.enabled ? "enabled" : "disabled");
 	}
 
-	void Debugger::collectProtos(Proto* p) {
-		for (const auto& proto : loadedProtos) {
-			if (proto == p)
-				return;
+	void Debugger::print(const char* fmt, ...) {
+		char buf[512];
+
+		va_list args;
+		va_start(args, fmt);
+		int n = vsnprintf(buf, sizeof(buf), fmt, args);
+		va_end(args);
+
+		if (n < 0)
+			return;
+
+		if ((size_t)n < sizeof(buf))
+			pendingLog.append(buf, n);
+		else {
+			const size_t old = pendingLog.size();
+			pendingLog.resize(old + n + 1);
+
+			va_start(args, fmt);
+			vsnprintf(pendingLog.data() + old, n + 1, fmt, args);
+			va_end(args);
+
+			pendingLog.resize(old + n);
 		}
 
-		loadedProtos.push_back(p);
-		for (int i = 0; i < p->sizep; i++)
-			collectProtos(p->p[i]);
+		size_t start = 0;
+		for (size_t nl; (nl = pendingLog.find('\n', start)) != std::string::npos; start = nl + 1) {
+			Event event;
+			event.text = pendingLog.substr(start, nl + 1 - start);
+			getSink()->emit(event);
+		}
+		pendingLog.erase(0, start);
 	}
 
-	void Debugger::dumpFunctionInfo(lua_State* L) {
-		lua_Debug ar;
-		if (lua_getinfo(L, 0, "sln", &ar)) {
-			const Closure* cl = clvalue(L->ci->func);
-			fprintf(options.out, ANSI_GREY "=> " ANSI_CYAN "%s" ANSI_RESET "() at %s:" ANSI_YELLOW "%d\n" ANSI_RESET, cl->l.p->debugname ? getstr(cl->l.p->debugname) : "??", ar.short_src, ar.currentline);
+	void Debugger::emit(const Event& event) {
+		EventSink* sink = getSink();
+		if (!pendingLog.empty()) {
+			Event partial;
+			partial.text = std::move(pendingLog);
+			pendingLog.clear();
+			sink->emit(partial);
 		}
+
+		sink->emit(event);
 	}
 
-	size_t Debugger::pushBreakpoint(Proto* p, const std::string& source, int pc, uint32_t line) {
-		size_t i = 0;
-		for (auto& bp : breakpoints) {
-			if (bp.p == p && bp.pc == pc) {
-				bp.enabled = true;
-				return i;
-			}
-			i++;
+	void Debugger::flushOutput() {
+		EventSink* sink = getSink();
+		if (!pendingLog.empty()) {
+			Event partial;
+			partial.text = std::move(pendingLog);
+			pendingLog.clear();
+			sink->emit(partial);
 		}
 
-		breakpoints.push_back({ p, source, pc, true, line });
-		return breakpoints.size();
+		sink->flush();
 	}
 
-	void Debugger::handleBreakByPc(lua_State* L, Proto* p, int pc) {
-		if (pc >= p->sizecode) {
-			puts("pc out of range");
-			return;
+	EventSink* Debugger::getSink() {
+		if (options.sink)
+			return options.sink;
+
+		// out may be redirected at any point, so the default console follows it
+		if (!console || console->getFile() != options.out) {
+			if (console)
+				console->flush();
+			console = std::make_unique<ConsoleSink>(options.out);
 		}
+		return console.get();
+	}
 
-		if (Luau::getOpLength((LuauOpcode)LUAU_INSN_OP(p->code[pc - 1])) - 1)
-			pc--;
+	bool Debugger::deleteBreakpoint(size_t num) {
+		if (num < 1 || num > breakpoints.size())
+			return false;
 
-		ensureDebugInsn(L, p);
-		p->code[pc] = LOP_BREAK;
+		const auto& bp = breakpoints[num - 1];
+		if (bp.p->debuginsn) {
+			bp.p->code[bp.pc] &= ~0xFF;
+			bp.p->code[bp.pc] |= LUAU_INSN_OP(bp.p->debuginsn[bp.pc]);
+		}
 
-		uint32_t ln = luaG_getline(p, pc);
-		fprintf(options.out, "breakpoint %zu set at %s:" ANSI_YELLOW "%d\n" ANSI_RESET, pushBreakpoint(p, getSource(p), pc, ln), getSource(p).c_str(), ln);
+		breakpoints.erase(breakpoints.begin() + (num - 1));
+		return true;
 	}
 
-	void Debugger::handleBreakByFunc(lua_State* L, const std::string& source, const std::string& func) {
-		bool found = false;
-		for (const auto& p : loadedProtos) {
-			if (p->debugname && getstr(p->debugname) == func) {
-				if (!source.empty() && source != getSource(p))
-					continue;
+	int FrameView::pc() const {
+		const Proto* p = proto();
+		if (!p || !ci->savedpc)
+			return 0;
 
-				setBreakpoint(L, p, true);
-				found = true;
-				break;
-			}
+		return std::max((int)(ci->savedpc - p->code) - 1, 0);
+	}
+
+	int FrameView::line() const {
+		const Proto* p = proto();
+		return p && p->lineinfo ? luaG_getline((Proto*)p, pc()) : 0;
+	}
+
+	FrameView Debugger::getFrame(lua_State* L, uint32_t level) const {
+		if (level >= getFrameCount(L))
+			return {};
+
+		return { L->ci - level, level };
+	}
+
+	const TValue* Debugger::getConstant(const FrameView& frame, int index) const {
+		const Proto* p = frame.proto();
+		return p && index >= 0 && index < p->sizek ? &p->k[index] : nullptr;
+	}
+
+	const TValue* Debugger::getUpvalue(const FrameView& frame, int index) const {
+		Closure* cl = frame.closure();
+		if (index < 0 || index >= cl->nupvalues)
+			return nullptr;
+
+		if (cl->isC)
+			return &cl->c.upvals[index];
+
+		const TValue* uv = &cl->l.uprefs[index];
+		return ttisupval(uv) ? upvalue(uv)->v : uv;
+	}
+
+	void Debugger::resume() {
+		if (stoppedThread) {
+			auto it = threads.find(stoppedThread);
+			if (it != threads.end())
+				it->second.stepping = false;
 		}
+		updateStepping();
+	}
 
-		if (!found)
-			puts("function not found");
+	void Debugger::stepInstruction() {
+		if (stoppedThread) {
+			ThreadState& ts = threads[stoppedThread];
+			ts.state = State::None;
+			ts.stepping = true;
+			stoppedThread->singlestep = true;
+		} else if (options.breakpointsOnly) {
+			// no thread runs with singlestep, so the next one to reach a safe point stops instead
+			pause();
+			return;
+		} else
+			breakNext = true;
+		updateStepping();
 	}
 
-	void Debugger::repl(lua_State* L) {
+	void Debugger::stepOver(lua_State* L) {
+		ThreadState& ts = threads[L];
+		ts.state = State::StepOver;
+		ts.stateLevel = (uint32_t)(L->ci - L->base_ci);
+		ts.stepping = true;
+		L->singlestep = true;
 		debugstepActive = true;
+	}
 
-		std::string line;
-		std::ifstream istream(options.in);
+	void Debugger::stepLine(lua_State* L) {
+		beginLineStep(L, State::StepLine);
+	}
 
-		while (true) {
-			fputs(ANSI_RESET "(ldbg) ", options.out);
-			if (!std::getline(istream, line))
-				break;
+	void Debugger::nextLine(lua_State* L) {
+		beginLineStep(L, State::NextLine);
+	}
 
-			if (line.empty())
-				continue;
+	void Debugger::stepOut(lua_State* L) {
+		ThreadState& ts = threads[L];
+		ts.state = State::Finish;
+		ts.stateLevel = (uint32_t)(L->ci - L->base_ci);
+		ts.stepping = true;
+		L->singlestep = true;
+		debugstepActive = true;
+	}
 
-			std::istringstream ss(line);
-			std::string cmd;
-			ss >> cmd;
+	void Debugger::updateStepping() {
+		debugstepActive = breakNext || std::any_of(threads.begin(), threads.end(), [](const auto& entry) { return entry.second.stepping; });
+	}
 
-			if (cmd == "continue" || cmd == "c") {
-				state = State::None;
-				debugstepActive = false;
-				break;
+	void Debugger::collectProtos(Proto* p) {
+		for (const auto& proto : loadedProtos) {
+			if (proto == p)
+				return;
+		}
 
-			}
-			else if (cmd == "bt" || cmd == "backtrace") {
-				lua_Debug ar;
-				int level = 0;
-				fputs(ANSI_GREY "(current) " ANSI_RESET, options.out);
-				while (lua_getinfo(L, level++, "sl", &ar))
-					fprintf(options.out, ANSI_YELLOW "%d" ANSI_RESET " - %s:" ANSI_YELLOW "%d\n", level, ar.short_src, ar.currentline);
-				fputs(ANSI_RESET "", options.out);
-			}
-			else if (cmd == "quit" || cmd == "q") {
-				L->status = LUA_ERRRUN;
-				break;
+		loadedProtos.push_back(p);
+		for (int i = 0; i < p->sizep; i++)
+			collectProtos(p->p[i]);
+	}
 
-			}
-			else if (cmd == "step" || cmd == "s") {
-				state = State::None;
-				break;
+	void Debugger::dumpFunctionInfo(lua_State* L) {
+		lua_Debug ar;
+		if (lua_getinfo(L, 0, "sln", &ar)) {
+			const Closure* cl = clvalue(L->ci->func);
+			print(ANSI_GREY "=> " ANSI_CYAN "%s" ANSI_RESET "() at %s:" ANSI_YELLOW "%d\n" ANSI_RESET, cl->l.p->debugname ? getstr(cl->l.p->debugname) : "??", ar.short_src, ar.currentline);
+		}
+	}
 
-			}
-			else if (cmd == "next" || cmd == "n") {
-				state = State::StepOver;
-				stateLevel = (uint32_t)(L->ci - L->base_ci);
-				break;
+	const SourceFile* Debugger::getSourceFile(Proto* p) {
+		if (!p->source || p->source->len < 2 || getstr(p->source)[0] != '@')
+			return nullptr;
 
-			}
-			else if (cmd == "finish") {
-				state = State::Finish;
-				stateLevel = (uint32_t)(L->ci - L->base_ci);
-				break;
+		const std::string path(getstr(p->source) + 1, p->source->len - 1);
 
-			}
-			else if (cmd == "break" || cmd == "b") {
-				std::string loc;
-				ss >> std::ws;
-				std::getline(ss, loc);
+		// files that failed to open are cached as well so they aren't retried on every stop
+		auto it = sourceFiles.find(path);
+		if (it == sourceFiles.end())
+			it = sourceFiles.emplace(path, SourceFile::open(path)).first;
 
-				if (loc.empty()) {
-					puts("usage: break source:line/source:func/*func:pc/*pc/line/func");
-					continue;
-				}
+		return it->second.get();
+	}
 
-				size_t colon = loc.find(':');
-				if (colon != std::string::npos) {
-					const std::string& lhs = loc.substr(0, colon);
-					const std::string& rhs = loc.substr(colon + 1);
+	bool Debugger::formatSource(Proto* p, int first, int last, int current, std::string& out) {
+		const SourceFile* sf = getSourceFile(p);
+		if (!sf)
+			return false;
 
-					if (!lhs.empty() && lhs[0] == '*') {
-						if (!rhs.empty() && isNumber(rhs)) {
-							int pc = std::stoi(rhs, nullptr, 0);
-							const std::string& func = lhs.substr(1);
+		first = std::max(first, 1);
+		last = std::min(last, (int)sf->lineCount());
 
-							for (const auto& p : loadedProtos) {
-								if (p->debugname && getstr(p->debugname) == func) {
-									handleBreakByPc(L, p, pc);
-									break;
-								}
-							}
-						} else
-							puts("invalid *func:pc format");
+		for (int i = first; i <= last; i++) {
+			const std::string_view ln = sf->line(i);
+			out += std::format("{}" ANSI_YELLOW "{:<6}" ANSI_RESET "{}\n", i == current ? ANSI_GREY "=> " ANSI_RESET : "   ", i, ln);
+		}
+		return true;
+	}
 
-					} else {
-						if (isNumber(rhs))
-							setBreakpoint(L, lhs, std::stoi(rhs, nullptr, 0), true);
-						else
-							handleBreakByFunc(L, lhs, rhs);
-					}
-				}
-				else {
-					if (!loc.empty() && loc[0] == '*') {
-						if (isNumber(loc.substr(1))) {
-							Proto* p = clvalue(L->ci->func)->l.p;
-							handleBreakByPc(L, p, std::stoi(loc.substr(1), nullptr, 0));
-						} else
-							puts("invalid *pc format");
+	bool Debugger::listSource(Proto* p, int first, int last, int current) {
+		std::string text;
+		if (!formatSource(p, first, last, current, text))
+			return false;
 
-					} else if (isNumber(loc)) {
-						lua_Debug ar;
-						lua_getinfo(L, 0, "s", &ar);
-						setBreakpoint(L, ar.short_src, std::stoi(loc, nullptr, 0), true);
+		print("%s", text.c_str());
+		return true;
+	}
 
-					} else
-						handleBreakByFunc(L, "", loc);
-				}
+	void Debugger::beginLineStep(lua_State* L, State mode) {
+		Proto* p = clvalue(L->ci->func)->l.p;
 
-			}
-			else if (cmd == "delete" || cmd == "d") {
-				size_t num = 0;
-				if (ss >> num) {
-					if (num < 1 || num > breakpoints.size()) {
-						puts("invalid breakpoint number");
-						continue;
-					}
+		ThreadState& ts = threads[L];
+		ts.state = mode;
+		ts.stateLevel = (uint32_t)(L->ci - L->base_ci);
+		ts.stateProto = p;
+		ts.stateLine = luaG_getline(p, (int)(L->ci->savedpc - 1 - p->code));
+		ts.stepping = true;
+		L->singlestep = true;
+		debugstepActive = true;
+	}
 
-					const auto& bp = breakpoints[num - 1];
-					if (bp.p->debuginsn) {
-						bp.p->code[bp.pc] &= ~0xFF;
-						bp.p->code[bp.pc] |= LUAU_INSN_OP(bp.p->debuginsn[bp.pc]);
-					}
+	bool Debugger::pushExpression(lua_State* L, const std::string& expr) {
+		auto it = exprCache.find(expr);
+		if (it != exprCache.end()) {
+			lua_getref(L, it->second);
+			return true;
+		}
 
-					fprintf(options.out, "deleted breakpoint %zu at %s:" ANSI_YELLOW "%d\n" ANSI_RESET, num, bp.source.c_str(), bp.line);
-					breakpoints.erase(breakpoints.begin() + (num - 1));
-				} else
-					puts("usage: delete <breakpoint number>");
+		if (evalEnv == LUA_NOREF) {
+			lua_newtable(L);
+			evalBindings = lua_ref(L, -1);
+
+			lua_newtable(L);
+			lua_newtable(L);
+			lua_pushvalue(L, -3);
+			lua_pushvalue(L, LUA_GLOBALSINDEX);
+			lua_pushcclosure(L, evalIndex, "__index", 2);
+			lua_setfield(L, -2, "__index");
+			lua_pushvalue(L, -3);
+			lua_pushvalue(L, LUA_GLOBALSINDEX);
+			lua_pushcclosure(L, evalNewindex, "__newindex", 2);
+			lua_setfield(L, -2, "__newindex");
+			lua_setmetatable(L, -2);
+			evalEnv = lua_ref(L, -1);
+			lua_pop(L, 2);
+		}
 
-			}
-			else if (cmd == "toggle") {
-				size_t num;
-				if (ss >> num) toggleBreakpoint(L, num);
-				else puts("usage: toggle <breakpoint number>");
+		// chunks stay cached for the whole session; drop them all once there are too many
+		if (exprCache.size() >= 256) {
+			for (const auto& [cached, ref] : exprCache)
+				lua_unref(L, ref);
+			exprCache.clear();
+		}
 
+		// try it as an expression first so its values can be shown, then as a statement. O0 keeps free names as
+		// GETGLOBAL; imports are resolved against the globals at load time and would miss the bound locals
+		std::string btc = Luau::compile("return " + expr, { 0, 2, 1 }, {}, nullptr);
+		if (luau_load(L, "ldbg", btc.data(), btc.size(), 0)) {
+			lua_pop(L, 1);
+
+			btc = Luau::compile(expr, { 0, 2, 1 }, {}, nullptr);
+			if (luau_load(L, "ldbg", btc.data(), btc.size(), 0)) {
+				print("%s\n", lua_tostring(L, -1));
+				lua_pop(L, 1);
+				return false;
 			}
-			else if (cmd == "inspect" || cmd == "i") {
-				std::string subcmd;
-				ss >> std::ws;
-				std::getline(ss, subcmd);
+		}
 
-				if (subcmd.empty()) {
-					dumpFunctionInfo(L);
-					continue;
-				}
-				
-				const Closure* cl = clvalue(L->ci->func);
-				const Proto* p = cl->l.p;
+		lua_getref(L, evalEnv);
+		lua_setfenv(L, -2);
 
-				if (subcmd == "locals") {
-					if (!p->sizelocvars) {
-						puts("missing local info");
-						continue;
-					}
+		exprCache[expr] = lua_ref(L, -1);
+		return true;
+	}
 
-					for (int i = 0; i < p->sizelocvars; i++) {
-						const LocVar* local = &p->locvars[i];
+	int Debugger::evaluate(lua_State* L, const std::string& expr) {
+		struct Binding {
+			TString* name;
+			int reg;
+			int upval;
+		};
 
-						const int pc = (int)((L->ci->savedpc - 1) - p->code);
-						fprintf(options.out, ANSI_CYAN "  R%u" ANSI_RESET " = %s", local->reg, getstr(local->varname));
-						if (pc > local->startpc && pc <= local->endpc)
-							putchar('\n');
-						else
-							puts(ANSI_GREY " ; inactive" ANSI_RESET);
-					}
-				}
-				else if (subcmd == "upvalues") {
-					if (!p->sizeupvalues) {
-						puts("missing upvalue info");
-						continue;
-					}
+		const int top = lua_gettop(L);
+		if (!pushExpression(L, expr))
+			return -1;
+
+		// the stack and the CallInfo array may be reallocated by the call below
+		const ptrdiff_t level = L->ci - L->base_ci;
+
+		Closure* cl = clvalue(L->ci->func);
+		Proto* p = cl->l.p;
+		const int pc = (int)(L->ci->savedpc - 1 - p->code);
+
+		auto slot = [cl](CallInfo* ci, const Binding& b) -> TValue* {
+			if (b.upval < 0)
+				return ci->base + b.reg;
+
+			TValue* o = &cl->l.uprefs[b.upval];
+			return ttisupval(o) ? upvalue(o)->v : o;
+		};
+
+		std::vector<Binding> bindings;
+		for (int i = 0; i < p->sizeupvalues && i < cl->nupvalues; i++)
+			bindings.push_back({ p->upvalues[i], -1, i });
+
+		for (int i = 0; i < p->sizelocvars; i++) {
+			const LocVar* local = &p->locvars[i];
+			if (local->startpc > pc || pc >= local->endpc)
+				continue;
+
+			// later declarations shadow earlier ones with the same name
+			std::erase_if(bindings, [&](const Binding& b) { return b.name == local->varname; });
+			bindings.push_back({ local->varname, local->reg, -1 });
+		}
+
+		lua_getref(L, evalBindings);
+		for (const auto& b : bindings) {
+			const TValue* o = slot(L->ci, b);
+			if (ttisnil(o))
+				lua_pushvalue(L, -1);
+			else {
+				setobj2s(L, L->top, o);
+				incr_top(L);
+			}
+			lua_rawsetfield(L, -2, getstr(b.name));
+		}
+		lua_pop(L, 1);
 
-					for (int i = 0; i < p->sizeupvalues; i++)
-						fprintf(options.out, ANSI_CYAN "  U%d" ANSI_RESET " = %s\n", i, getstr(p->upvalues[i]));
+		const bool singlestep = L->singlestep;
+		L->singlestep = false;
+		lua_pushcfunction(L, options.onError, "");
+		lua_insert(L, -2);
+		const int status = lua_pcall(L, 0, LUA_MULTRET, -2);
+		L->singlestep = singlestep;
+
+		lua_remove(L, top + 1);
+
+		// write assignments to bound names back into the frame and unbind them
+		CallInfo* ci = L->base_ci + level;
+		lua_getref(L, evalBindings);
+		for (const auto& b : bindings) {
+			const char* name = getstr(b.name);
+
+			if (status == LUA_OK) {
+				lua_rawgetfield(L, -1, name);
+				if (lua_rawequal(L, -1, -2)) {
+					lua_pop(L, 1);
+					lua_pushnil(L);
 				}
-				else if (subcmd == "stack") {
-					const uint32_t end = p->maxstacksize;
-					const uint32_t rows = (end + 3) / 4;
 
-					for (uint32_t i = 0; i < rows; i++) {
-						for (uint32_t j = 0; j < 4; j++) {
-							uint32_t idx = i + j * rows;
-							if (idx < end)
-								fprintf(options.out, ANSI_CYAN "  R%-3d" ANSI_RESET " = %-15s", idx, lua_strprimitive(L->ci->base + idx).c_str());
+				TValue* o = slot(ci, b);
+				if (!luaO_rawequalObj(o, L->top - 1)) {
+					setobj(L, o, L->top - 1);
+
+					// a closed upvalue lives in its UpVal, which other closures may have marked already
+					if (b.upval >= 0) {
+						TValue* uv = &cl->l.uprefs[b.upval];
+						if (ttisupval(uv)) {
+							luaC_barrier(L, upvalue(uv), L->top - 1);
+						} else {
+							luaC_barrier(L, cl, L->top - 1);
 						}
-						putchar('\n');
 					}
 				}
-				else if (subcmd == "breakpoints") {
-					if (breakpoints.empty()) {
-						puts("no breakpoints set");
-						continue;
-					}
+				lua_pop(L, 1);
+			}
 
-					fprintf(options.out, 
-						"%-4s %-8s %-30s %s\n"
-						ANSI_GREY "---- -------- ------------------------------ ----------\n" ANSI_RESET,
-						"n", "active", "location", "func");
+			lua_pushnil(L);
+			lua_rawsetfield(L, -2, name);
+		}
+		lua_pop(L, 1);
 
-					size_t i = 0;
-					for (const auto& bp : breakpoints) {
-						const char* funcName = bp.p->debugname ? getstr(bp.p->debugname) : "??";
-						fprintf(options.out, "%-4zu %-8s %-35s " ANSI_CYAN "%s\n" ANSI_RESET,
-							++i,
-							bp.enabled ? "yes" : "no",
-							(bp.source + ":" ANSI_YELLOW + std::to_string(bp.line)).c_str(), funcName
-						);
-					}
-				}
-				else if (subcmd == "funcs") {
-					if (loadedProtos.empty()) {
-						puts("no functions loaded");
-						continue;
-					}
+		if (status != LUA_OK) {
+			lua_settop(L, top);
+			return -1;
+		}
+		return lua_gettop(L) - top;
+	}
 
-					fprintf(options.out, 
-						"%-4s %-30s %-8s %s\n"
-						ANSI_GREY "---- ------------------------------ -------- --------------------\n" ANSI_RESET,
-						"n", "func", "line", "source"
-					);
+	const TValue* Debugger::watchSlot(lua_State* L, const Watchpoint& wp) {
+		switch (wp.kind) {
+		case Watchpoint::Kind::Register: {
+			const lua_State* th = wp.thread;
+			const CallInfo* ci = th->base_ci + wp.level;
+			if (ci > th->ci || !ttisfunction(ci->func) || clvalue(ci->func) != wp.cl)
+				return nullptr;
+			return ci->base + wp.index;
+		}
+		case Watchpoint::Kind::Upvalue: {
+			const TValue* o = &wp.cl->l.uprefs[wp.index];
+			return ttisupval(o) ? upvalue(o)->v : o;
+		}
+		case Watchpoint::Kind::Field:
+			return luaH_getstr(wp.table, wp.key);
+		}
+		return nullptr;
+	}
 
-					size_t i = 0;
-					for (const auto& p : loadedProtos) {
-						fprintf(options.out, "%-4zu " ANSI_CYAN "%-30s" ANSI_YELLOW " %-9d" ANSI_RESET  "%s\n",
-							++i,
-							p->debugname ? getstr(p->debugname) : "??", p->linedefined,
-							getSource(p).c_str()
-						);
-					}
-				}
-				else if (subcmd == "insn") {
-					const Instruction* pc = L->ci->savedpc - 1;
-					ldbg::idisasm(options.out, pc, p);
-					putchar('\n');
-				}
-				else if (subcmd[0] == 'R') {
-					int idx = 0;
-					if (!parseInt(subcmd.substr(1), idx)) {
-						puts("index must be a number");
-						continue;
-					}
+	// copies a watched value and keeps it alive through a registry reference
+	static void keepWatchValue(lua_State* L, Watchpoint& wp, const TValue* o) {
+		lua_unref(L, wp.valueRef);
 
-					if (idx < 0 || idx >= p->maxstacksize) puts("index out of range");
-					else puts(lua_strprimitive(L->base + idx).c_str());
-				}
-				else if (subcmd[0] == 'K') {
-					int idx = 0;
-					if (!parseInt(subcmd.substr(1), idx)) {
-						puts("index must be a number");
-						continue;
-					}
+		wp.value = *o;
+		setobj2s(L, L->top, o);
+		incr_top(L);
+		wp.valueRef = lua_ref(L, -1);
+		lua_pop(L, 1);
+	}
 
-					if (idx < 0 || idx >= p->sizek) puts("index out of range");
-					else puts(lua_strprimitive(&p->k[idx]).c_str());
-				}
-				else if (subcmd[0] == 'U') {
-					int idx = 0;
-					if (!parseInt(subcmd.substr(1), idx)) {
-						puts("index must be a number");
-						continue;
-					}
+	bool Debugger::checkWatchpoints(lua_State* L, Proto* p, const Instruction* pc) {
+		const uint32_t level = (uint32_t)(L->ci - L->base_ci);
+		ThreadState& ts = threads[L];
+
+		// values are only compared right after an instruction that may have written them
+		bool check = ts.watchCheckNext;
+		while (!ts.watchReturnLevels.empty() && ts.watchReturnLevels.back() >= level) {
+			ts.watchReturnLevels.pop_back();
+			check = true;
+		}
+		ts.watchCheckNext = false;
+
+		bool hit = false;
+		if (check) {
+			for (size_t i = 0; i < watchpoints.size();) {
+				Watchpoint& wp = watchpoints[i];
 
-					if (idx < 0 || idx >= p->nups) puts("index out of range");
-					else puts(lua_strprimitive(&cl->l.uprefs[idx]).c_str());
+				const TValue* o = watchSlot(L, wp);
+				if (!o) {
+					print("watchpoint %zu deleted because its frame has exited\n", i + 1);
+					removeWatchpoint(L, i);
+					continue;
 				}
-				else
-					puts("unknown subcommand");
 
+				if (!luaO_rawequalObj(o, &wp.value)) {
+					const std::string& rendered = renderValue(o, { 1, 8, 256 });
+					print("watchpoint %zu: %s\n" ANSI_GREY "  old = " ANSI_RESET "%s\n" ANSI_GREY "  new = " ANSI_RESET "%s\n",
+						i + 1, wp.expr.c_str(), wp.rendered.c_str(), rendered.c_str());
+
+					keepWatchValue(L, wp, o);
+					wp.rendered = rendered;
+					hit = true;
+				}
+				i++;
 			}
-			else if (cmd == "disasm") {
-				std::string func;
-				ss >> std::ws;
-				std::getline(ss, func);
 
-				const Proto* p = clvalue(L->ci->func)->l.p;
-				if (!func.empty()) {
-					bool found = false;
-					for (const auto& lp : loadedProtos) {
-						if (lp->debugname && getstr(lp->debugname) == func) {
-							found = true;
-							p = lp;
-							break;
-						}
-					}
-					
-					if (!found) {
-						puts("function not found");
+			// deleting the last watchpoint drops the bookkeeping ts refers to
+			if (watchpoints.empty())
+				return hit;
+		}
+
+		const InsnWrites w = decodeWrites(p, pc);
+		if (w.call) {
+			ts.watchReturnLevels.push_back(level);
+			return hit;
+		}
+
+		const TValue* base = L->ci->base;
+		for (const auto& wp : watchpoints) {
+			switch (wp.kind) {
+			case Watchpoint::Kind::Register:
+				if (wp.thread == L && wp.level == level && wp.index >= w.reg && wp.index < w.reg + w.count)
+					ts.watchCheckNext = true;
+				break;
+			case Watchpoint::Kind::Upvalue: {
+				// an open upvalue aliases a register of the frame that owns it
+				const TValue* o = watchSlot(L, wp);
+				if (o >= base + w.reg && o < base + w.reg + w.count)
+					ts.watchCheckNext = true;
+				else if (w.upval >= 0) {
+					const TValue* uv = &clvalue(L->ci->func)->l.uprefs[w.upval];
+					if ((ttisupval(uv) ? upvalue(uv)->v : uv) == o)
+						ts.watchCheckNext = true;
+				}
+			} break;
+			case Watchpoint::Kind::Field:
+				if (w.table >= 0 && ttistable(base + w.table) && hvalue(base + w.table) == wp.table)
+					ts.watchCheckNext = true;
+				break;
+			}
+		}
+
+		return hit;
+	}
+
+	void Debugger::removeWatchpoint(lua_State* L, size_t index) {
+		const Watchpoint& wp = watchpoints[index];
+		if (wp.ref != LUA_NOREF)
+			lua_unref(L, wp.ref);
+		if (wp.keyRef != LUA_NOREF)
+			lua_unref(L, wp.keyRef);
+		lua_unref(L, wp.valueRef);
+
+		watchpoints.erase(watchpoints.begin() + index);
+		if (watchpoints.empty()) {
+			for (auto it = threads.begin(); it != threads.end();) {
+				if (it->second.stepping) {
+					it->second.watchReturnLevels.clear();
+					it->second.watchCheckNext = false;
+					++it;
+				} else
+					it = threads.erase(it);
+			}
+		}
+	}
+
+	void Debugger::updateAllocationHook() {
+		if (vm)
+			vm->cb.onallocate = memoryBreakpoints.empty() ? oldOnallocate : ldbg::onallocate;
+	}
+
+	size_t Debugger::setMemoryBreakpoint(lua_State* L, int memcat, size_t threshold, bool snapshot) {
+		MemoryBreakpoint mb;
+		mb.memcat = memcat;
+		mb.threshold = threshold;
+		mb.snapshot = snapshot;
+
+		// only a crossing that happens from now on fires
+		const global_State* g = L->global;
+		mb.above = (memcat < 0 ? g->totalbytes : g->memcatbytes[memcat]) > threshold;
+
+		if (memcat < 0)
+			mb.expr = std::format("heap > {}", threshold);
+		else if (memcat < (int)memcatNames.size() && !memcatNames[memcat].empty())
+			mb.expr = std::format("memcat {} ({}) > {}", memcat, memcatNames[memcat], threshold);
+		else
+			mb.expr = std::format("memcat {} > {}", memcat, threshold);
+
+		memoryBreakpoints.push_back(std::move(mb));
+		updateAllocationHook();
+		return memoryBreakpoints.size();
+	}
+
+	bool Debugger::deleteMemoryBreakpoint(size_t num) {
+		if (num < 1 || num > memoryBreakpoints.size())
+			return false;
+
+		memoryBreakpoints.erase(memoryBreakpoints.begin() + (num - 1));
+		memoryBreakHit = 0;
+		updateAllocationHook();
+		return true;
+	}
+
+	bool Debugger::takeMemoryBreak(lua_State* L) {
+		const size_t num = memoryBreakHit;
+		memoryBreakHit = 0;
+		if (num > memoryBreakpoints.size())
+			return false;
+
+		const MemoryBreakpoint& mb = memoryBreakpoints[num - 1];
+		print("memory breakpoint %zu: %s reached " ANSI_YELLOW "%zu" ANSI_RESET " bytes\n", num, mb.expr.c_str(), memoryBreakBytes);
+
+		if (!mb.snapshot)
+			return true;
+
+		lua_Debug ar;
+		for (int level = 0; lua_getinfo(L, level, "sln", &ar); level++)
+			print("  %d - %s:%d %s\n", level + 1, ar.short_src, ar.currentline, ar.name ? ar.name : "??");
+
+		const std::string path = std::format("memory.{}.json", ++memorySnapshotCount);
+
+		FILE* file = nullptr;
+		if (fopen_s(&file, path.c_str(), "w") || !file) {
+			print("unable to open %s\n", path.c_str());
+			return false;
+		}
+
+		luaC_dump(L, file, memcatName);
+		fclose(file);
+		print("heap snapshot written to %s\n", path.c_str());
+		return false;
+	}
+
+	void Debugger::noteGcState(lua_State* L) {
+		const global_State* g = L->global;
+		gcPeakBytes = std::max(gcPeakBytes, g->totalbytes);
+
+		const int state = g->gcstate;
+		if (state == lastGcState)
+			return;
+
+		if (state == GCSpause && lastGcState != -1)
+			gcCycles++;
+		lastGcState = state;
+
+		// collections run by the REPL itself don't stop anything
+		if ((gcBreakStates & (1u << state)) && !stoppedThread) {
+			gcBreakHit = state;
+			requestInterrupt();
+		}
+	}
+
+	bool Debugger::takeGcBreak(lua_State* L) {
+		const int state = gcBreakHit;
+		gcBreakHit = -1;
+		if (!(gcBreakStates & (1u << state)))
+			return false;
+
+		print("gc breakpoint: collector entered %s with " ANSI_YELLOW "%zu" ANSI_RESET " bytes allocated\n", luaC_statename(state), L->global->totalbytes);
+		return true;
+	}
+
+	void Debugger::tuneGc(lua_State* L, uint32_t runs, const std::string& expr) {
+		global_State* g = L->global;
+		if (oldGCThreshold) {
+			print("GC is paused; resume it first\n");
+			return;
+		}
+
+		const int top = lua_gettop(L);
+		if (evaluate(L, expr) < 1 || !lua_isfunction(L, top + 1)) {
+			print("%s doesn't evaluate to a function\n", expr.c_str());
+			lua_settop(L, top);
+			return;
+		}
+
+		const int workload = lua_ref(L, top + 1);
+		lua_settop(L, top);
+
+		struct Result {
+			int goal;
+			int stepmul;
+			double seconds;
+			// negative with too few runs for a p99 of its own
+			double p99Ms;
+			double maxMs;
+			uint32_t cycles;
+			size_t peakBytes;
+		};
+
+		// around the defaults of 200 for both
+		static const int goals[] = { 125, 150, 200, 300 };
+		static const int stepmuls[] = { 100, 200, 400 };
+
+		const int oldGoal = g->gcgoal;
+		const int oldStepmul = g->gcstepmul;
+
+		const bool singlestep = L->singlestep;
+		L->singlestep = false;
+		gcTuning = true;
+		requestInterrupt();
+
+		std::vector<Result> results;
+		std::vector<double> latencies(runs);
+		bool failed = false;
+		for (size_t i = 0; i < std::size(goals) * std::size(stepmuls) && !failed; i++) {
+			const int goal = goals[i / std::size(stepmuls)];
+			const int stepmul = stepmuls[i % std::size(stepmuls)];
+
+			// every setting starts from the same heap
+			lua_gc(L, LUA_GCCOLLECT, 0);
+			lua_gc(L, LUA_GCSETGOAL, goal);
+			lua_gc(L, LUA_GCSETSTEPMUL, stepmul);
+
+			gcCycles = 0;
+			gcPeakBytes = g->totalbytes;
+			lastGcState = g->gcstate;
+
+			const auto start = std::chrono::steady_clock::now();
+			for (uint32_t run = 0; run < runs && !failed; run++) {
+				const auto callStart = std::chrono::steady_clock::now();
+
+				lua_pushcfunction(L, options.onError, "");
+				lua_getref(L, workload);
+				failed = lua_pcall(L, 0, 0, -2) != LUA_OK;
+				lua_settop(L, top);
+
+				latencies[run] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - callStart).count();
+			}
+
+			if (failed)
+				break;
+
+			const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			std::sort(latencies.begin(), latencies.end());
+			// nearest rank; below 100 runs that's the slowest call, which the max column already shows
+			const double p99 = runs >= 100 ? latencies[(runs * 99 + 99) / 100 - 1] : -1;
+			results.push_back({ goal, stepmul, seconds, p99, latencies.back(), gcCycles, gcPeakBytes });
+		}
+
+		gcTuning = false;
+		L->singlestep = singlestep;
+		lua_gc(L, LUA_GCSETGOAL, oldGoal);
+		lua_gc(L, LUA_GCSETSTEPMUL, oldStepmul);
+		lua_unref(L, workload);
+		releaseInterrupt();
+
+		if (failed)
+			print("the workload failed; stopped after %zu settings\n", results.size());
+		if (results.empty())
+			return;
+
+		print(
+			"  %-5s %-8s %-10s %-9s %-9s %-7s %s\n"
+			ANSI_GREY "  ----- -------- ---------- --------- --------- ------- ----------\n" ANSI_RESET,
+			"goal", "stepmul", "calls/s", "p99 ms", "max ms", "cycles", "peak KB");
+
+		for (const auto& r : results) {
+			// settings no other one beats on both throughput and the longest call
+			const bool best = std::none_of(results.begin(), results.end(), [&](const Result& o) {
+				return o.seconds <= r.seconds && o.maxMs <= r.maxMs && (o.seconds < r.seconds || o.maxMs < r.maxMs);
+			});
+
+			const std::string p99 = r.p99Ms < 0 ? "-" : std::format("{:.3f}", r.p99Ms);
+			print("%s %-5d %-8d %-10.1f %-9s %-9.3f %-7u %zu\n" ANSI_RESET,
+				best ? ANSI_GREEN "*" : " ", r.goal, r.stepmul, runs / r.seconds, p99.c_str(), r.maxMs, r.cycles, r.peakBytes / 1024);
+		}
+
+		if (runs < 100)
+			print(ANSI_GREY "p99 needs at least 100 runs; with %u it would be the slowest call\n" ANSI_RESET, runs);
+
+		print(ANSI_GREY "goal %d and step multiplier %d restored; * marks settings no other one beats on both calls/s and max ms\n" ANSI_RESET, oldGoal, oldStepmul);
+	}
+
+	void Debugger::showDisplays(lua_State* L) {
+		for (size_t i = 0; i < displays.size(); i++) {
+			const int count = evaluate(L, displays[i]);
+			if (count < 0)
+				continue;
+
+			print(ANSI_GREY "%zu: " ANSI_RESET "%s =", i + 1, displays[i].c_str());
+			for (int j = 0; j < count; j++)
+				print(" %s", renderValue(L->top - count + j).c_str());
+			print("\n");
+			lua_pop(L, count);
+		}
+	}
+
+	size_t Debugger::pushBreakpoint(Proto* p, const std::string& source, int pc, uint32_t line) {
+		size_t i = 0;
+		for (auto& bp : breakpoints) {
+			if (bp.p == p && bp.pc == pc) {
+				bp.enabled = true;
+				bp.thread = breakpointThread;
+				return i + 1;
+			}
+			i++;
+		}
+
+		breakpoints.push_back({ p, source, pc, true, line, breakpointThread });
+		return breakpoints.size();
+	}
+
+	void Debugger::handleBreakByPc(lua_State* L, Proto* p, int pc) {
+		if (pc >= p->sizecode) {
+			print("pc out of range\n");
+			return;
+		}
+
+		if (Luau::getOpLength((LuauOpcode)LUAU_INSN_OP(p->code[pc - 1])) - 1)
+			pc--;
+
+		ensureDebugInsn(L, p);
+		p->code[pc] = LOP_BREAK;
+
+		uint32_t ln = luaG_getline(p, pc);
+		print("breakpoint %zu set at %s:" ANSI_YELLOW "%d\n" ANSI_RESET, pushBreakpoint(p, getSource(p), pc, ln), getSource(p).c_str(), ln);
+	}
+
+	void Debugger::handleBreakByFunc(lua_State* L, const std::string& source, const std::string& func) {
+		bool found = false;
+		for (const auto& p : loadedProtos) {
+			if (p->debugname && getstr(p->debugname) == func) {
+				if (!source.empty() && source != getSource(p))
+					continue;
+
+				setBreakpoint(L, p, true);
+				found = true;
+				break;
+			}
+		}
+
+		if (!found)
+			print("function not found\n");
+	}
+
+	void Debugger::repl(lua_State* L) {
+		stoppedThread = L;
+
+		// in breakpoint-only mode a step turns singlestep on for its thread until the step ends here
+		if (options.breakpointsOnly)
+			L->singlestep = false;
+
+		// a stop consumes whatever brought the thread here; commands decide how it continues
+		auto it = threads.find(L);
+		if (it != threads.end())
+			it->second.stepping = false;
+		breakNext = false;
+		updateStepping();
+
+		// time spent stopped doesn't count against the watchdog
+		watchdog.thread = nullptr;
+
+		if (dap && dap->isConnected()) {
+			flushOutput();
+			dap->pause(L, stopReason);
+			stopReason = "step";
+			stoppedThread = nullptr;
+			return;
+		}
+
+		if (options.debugbreak) {
+			lua_Debug ar = {};
+			lua_getinfo(L, 0, "sln", &ar);
+
+			// the host drives the stop through the control API; doing nothing continues
+			resume();
+			flushOutput();
+			options.debugbreak(this, L, &ar);
+			stoppedThread = nullptr;
+			return;
+		}
+
+		if (options.batch) {
+			lua_Debug ar;
+			if (lua_getinfo(L, 0, "sln", &ar))
+				print("@stop %s:%d %s\n", ar.short_src, ar.currentline, ar.name ? ar.name : "??");
+		}
+
+		showDisplays(L);
+
+		// bt, inspect and disasm are shared with the postmortem viewer
+		const ThreadFrames frames(*this, L);
+		Inspector inspector(frames, [this](const std::string& text) { print("%s", text.c_str()); });
+
+		std::string line;
+		std::ifstream istream(options.in);
+
+		size_t stopCommand = 0;
+		while (true) {
+			if (stopCommand < stopCommands.size())
+				line = stopCommands[stopCommand++];
+			else if (!commandQueue.empty()) {
+				line = std::move(commandQueue.front());
+				commandQueue.pop_front();
+			}
+			else if (options.batch)
+				line = "continue";
+			else {
+				print(ANSI_RESET "(ldbg) ");
+				flushOutput();
+				if (!std::getline(istream, line))
+					break;
+			}
+
+			if (line.empty())
+				continue;
+
+			if (options.batch)
+				print("@cmd %s\n", line.c_str());
+
+			std::istringstream ss(line);
+			std::string cmd;
+			ss >> cmd;
+
+			if (options.breakpointsOnly && (cmd == "watch" || cmd == "record" || cmd == "fastcalls" || cmd == "slots" || cmd == "closures")) {
+				print("%s needs singlestep on every thread, which is off in breakpoint-only mode\n", cmd.c_str());
+				continue;
+			}
+
+			if (cmd == "continue" || cmd == "c") {
+				resume();
+				break;
+
+			}
+			else if (cmd == "bt" || cmd == "backtrace")
+				inspector.backtrace();
+			else if (cmd == "quit" || cmd == "q") {
+				L->status = LUA_ERRRUN;
+				break;
+
+			}
+			else if (cmd == "step" || cmd == "s") {
+				std::string mode;
+				ss >> mode;
+
+				if (mode == "line")
+					stepLine(L);
+				else if (mode.empty())
+					stepInstruction();
+				else {
+					print("usage: step [line]\n");
+					continue;
+				}
+				break;
+
+			}
+			else if (cmd == "next" || cmd == "n") {
+				std::string mode;
+				ss >> mode;
+
+				if (mode == "line")
+					nextLine(L);
+				else if (mode.empty())
+					stepOver(L);
+				else {
+					print("usage: next [line]\n");
+					continue;
+				}
+				break;
+
+			}
+			else if (cmd == "list" || cmd == "l") {
+				std::string loc;
+				ss >> std::ws;
+				std::getline(ss, loc);
+
+				Proto* current = clvalue(L->ci->func)->l.p;
+				const int currentLine = luaG_getline(current, (int)(L->ci->savedpc - 1 - current->code));
+
+				Proto* p = current;
+				int line = currentLine;
+
+				if (!loc.empty()) {
+					std::string lineStr = loc;
+
+					size_t colon = loc.find(':');
+					if (colon != std::string::npos) {
+						const std::string& source = loc.substr(0, colon);
+						lineStr = loc.substr(colon + 1);
+
+						p = nullptr;
+						for (const auto& lp : loadedProtos) {
+							if (source == getSource(lp)) {
+								p = lp;
+								break;
+							}
+						}
+
+						if (!p) {
+							print("no functions found matching source '%s'\n", source.c_str());
+							continue;
+						}
+					}
+
+					if (!parseInt(lineStr, line)) {
+						print("usage: list [source:]line\n");
+						continue;
+					}
+				}
+
+				if (!listSource(p, line - 5, line + 5, p == current ? currentLine : 0))
+					print("source for %s is unavailable\n", getSource(p).c_str());
+
+			}
+			else if (cmd == "finish") {
+				stepOut(L);
+				break;
+
+			}
+			else if (cmd == "break" || cmd == "b") {
+				std::string loc;
+				ss >> std::ws;
+				std::getline(ss, loc);
+
+				// "heap > <size>" and "memcat <n> > <size>" stop when memory grows past the size
+				std::istringstream args(loc);
+				std::string what, op;
+				args >> what;
+
+				// "gc <phase>" stops when the collector enters the phase
+				if (what == "gc") {
+					std::string phase;
+					args >> phase;
+
+					const int state = parseGcPhase(phase);
+					if (state < 0) {
+						print("usage: break gc %s\n", gcPhaseNames("/").c_str());
+						continue;
+					}
+
+					gcBreakStates |= 1u << state;
+					lastGcState = L->global->gcstate;
+					requestInterrupt();
+
+					print("gc breakpoint: %s\n", phase.c_str());
+					continue;
+				}
+				if (what == "heap" || what == "memcat") {
+					int memcat = -1;
+					if (what == "memcat")
+						args >> memcat;
+
+					std::string size, mode;
+					args >> op >> size >> mode;
+					if (op == ">") {
+						size_t threshold = 0;
+						if ((what == "memcat" && (memcat < 0 || memcat >= LUA_MEMORY_CATEGORIES)) || !parseSize(size, threshold) || (!mode.empty() && mode != "snapshot")) {
+							print("usage: break heap > <size>[KB|MB|GB] [snapshot] / break memcat <n> > <size>[KB|MB|GB] [snapshot]\n");
+							continue;
+						}
+
+						const size_t num = setMemoryBreakpoint(L, memcat, threshold, mode == "snapshot");
+						print("memory breakpoint %zu: %s%s\n", num, memoryBreakpoints[num - 1].expr.c_str(), mode == "snapshot" ? ", snapshot" : "");
+						continue;
+					}
+				}
+
+				// "<loc> thread [address]" only stops the current or the given thread
+				lua_State* thread = nullptr;
+				const size_t threadPos = loc.find(" thread");
+				if (threadPos != std::string::npos) {
+					std::string address = loc.substr(threadPos + 7);
+					address.erase(0, address.find_first_not_of(' '));
+					loc.erase(threadPos);
+
+					if (address.empty())
+						thread = L;
+					else {
+						if (address.size() > 2 && address[0] == '0' && (address[1] == 'x' || address[1] == 'X'))
+							address.erase(0, 2);
+
+						uintptr_t value = 0;
+						const auto result = std::from_chars(address.data(), address.data() + address.size(), value, 16);
+						if (result.ec != std::errc() || result.ptr != address.data() + address.size() || !(thread = findThread(L, value))) {
+							print("no thread at address %s; see threads\n", address.c_str());
+							continue;
+						}
+					}
+				}
+
+				if (loc.empty()) {
+					print("usage: break source:line/source:func/*func:pc/*pc/line/func [thread [address]]\n");
+					continue;
+				}
+
+				breakpointThread = thread;
+
+				size_t colon = loc.find(':');
+				if (colon != std::string::npos) {
+					const std::string& lhs = loc.substr(0, colon);
+					const std::string& rhs = loc.substr(colon + 1);
+
+					if (!lhs.empty() && lhs[0] == '*') {
+						if (!rhs.empty() && isNumber(rhs)) {
+							int pc = std::stoi(rhs, nullptr, 0);
+							const std::string& func = lhs.substr(1);
+
+							for (const auto& p : loadedProtos) {
+								if (p->debugname && getstr(p->debugname) == func) {
+									handleBreakByPc(L, p, pc);
+									break;
+								}
+							}
+						} else
+							print("invalid *func:pc format\n");
+
+					} else {
+						if (isNumber(rhs))
+							setBreakpoint(L, lhs, std::stoi(rhs, nullptr, 0), true);
+						else
+							handleBreakByFunc(L, lhs, rhs);
+					}
+				}
+				else {
+					if (!loc.empty() && loc[0] == '*') {
+						if (isNumber(loc.substr(1))) {
+							Proto* p = clvalue(L->ci->func)->l.p;
+							handleBreakByPc(L, p, std::stoi(loc.substr(1), nullptr, 0));
+						} else
+							print("invalid *pc format\n");
+
+					} else if (isNumber(loc)) {
+						lua_Debug ar;
+						lua_getinfo(L, 0, "s", &ar);
+						setBreakpoint(L, ar.short_src, std::stoi(loc, nullptr, 0), true);
+
+					} else
+						handleBreakByFunc(L, "", loc);
+				}
+
+				breakpointThread = nullptr;
+			}
+			else if (cmd == "threads")
+				listThreads(L);
+			else if (cmd == "delete" || cmd == "d") {
+				ss >> std::ws;
+				if (ss.peek() == 'g') {
+					std::string word, phase;
+					ss >> word >> phase;
+
+					const int state = parseGcPhase(phase);
+					if (word != "gc" || (!phase.empty() && state < 0)) {
+						print("usage: delete gc [phase]\n");
+						continue;
+					}
+
+					gcBreakStates = state < 0 ? 0 : gcBreakStates & ~(1u << state);
+					gcBreakHit = -1;
+					releaseInterrupt();
+
+					print("deleted gc breakpoint%s %s\n", state < 0 ? "s" : "", phase.c_str());
+					continue;
+				}
+
+				if (ss.peek() == 'm') {
+					ss.get();
+
+					size_t num = 0;
+					if (!(ss >> num) || !deleteMemoryBreakpoint(num))
+						print("invalid memory breakpoint number\n");
+					else
+						print("deleted memory breakpoint %zu\n", num);
+					continue;
+				}
+
+				size_t num = 0;
+				if (ss >> num) {
+					if (num < 1 || num > breakpoints.size()) {
+						print("invalid breakpoint number\n");
+						continue;
+					}
+
+					const Breakpoint bp = breakpoints[num - 1];
+					deleteBreakpoint(num);
+
+					print("deleted breakpoint %zu at %s:" ANSI_YELLOW "%d\n" ANSI_RESET, num, bp.source.c_str(), bp.line);
+				} else
+					print("usage: delete <breakpoint number>\n");
+
+			}
+			else if (cmd == "toggle") {
+				size_t num;
+				if (ss >> num) toggleBreakpoint(L, num);
+				else print("usage: toggle <breakpoint number>\n");
+
+			}
+			else if (cmd == "inspect" || cmd == "i") {
+				std::string subcmd;
+				ss >> std::ws;
+				std::getline(ss, subcmd);
+
+				if (subcmd == "breakpoints") {
+					if (breakpoints.empty() && memoryBreakpoints.empty() && !gcBreakStates) {
+						print("no breakpoints set\n");
+						continue;
+					}
+
+					size_t m = 0;
+					for (const auto& mb : memoryBreakpoints)
+						print("m%-3zu %-8s %s\n", ++m, mb.snapshot ? "snapshot" : "stop", mb.expr.c_str());
+
+					for (int i = GCSpause; i <= GCSsweep; i++) {
+						if (gcBreakStates & (1u << i))
+							print("gc   %-8s %s\n", "stop", luaC_statename(i));
+					}
+
+					if (breakpoints.empty())
+						continue;
+
+					print(
+						"%-4s %-8s %-30s %s\n"
+						ANSI_GREY "---- -------- ------------------------------ ----------\n" ANSI_RESET,
+						"n", "active", "location", "func");
+
+					size_t i = 0;
+					for (const auto& bp : breakpoints) {
+						const char* funcName = bp.p->debugname ? getstr(bp.p->debugname) : "??";
+						print("%-4zu %-8s %-35s " ANSI_CYAN "%s\n" ANSI_RESET,
+							++i,
+							bp.enabled ? "yes" : "no",
+							(bp.source + ":" ANSI_YELLOW + std::to_string(bp.line)).c_str(), funcName
+						);
+					}
+				}
+				else if (subcmd == "watchpoints") {
+					if (watchpoints.empty()) {
+						print("no watchpoints set\n");
+						continue;
+					}
+
+					size_t i = 0;
+					for (const auto& wp : watchpoints)
+						print("%-4zu %-30s = %s\n", ++i, wp.expr.c_str(), wp.rendered.c_str());
+				}
+				else if (subcmd == "funcs") {
+					if (loadedProtos.empty()) {
+						print("no functions loaded\n");
+						continue;
+					}
+
+					print(
+						"%-4s %-30s %-8s %s\n"
+						ANSI_GREY "---- ------------------------------ -------- --------------------\n" ANSI_RESET,
+						"n", "func", "line", "source"
+					);
+
+					size_t i = 0;
+					for (const auto& p : loadedProtos) {
+						print("%-4zu " ANSI_CYAN "%-30s" ANSI_YELLOW " %-9d" ANSI_RESET  "%s\n",
+							++i,
+							p->debugname ? getstr(p->debugname) : "??", p->linedefined,
+							getSource(p).c_str()
+						);
+					}
+				}
+				else
+					inspector.inspect(subcmd);
+
+			}
+			else if (cmd == "disasm") {
+				std::string func;
+				ss >> std::ws;
+				std::getline(ss, func);
+				inspector.disasm(func);
+
+			}
+			else if (cmd == "cls") system("cls");
+			else if (cmd == "load") {
+				std::string path, option;
+				ss >> std::ws;
+				ss >> path >> option;
+
+				if (!option.empty() && option != "memcat") {
+					print("usage: load <filename> [memcat]\n");
+					continue;
+				}
+
+				std::ifstream file(path, std::ios::binary);
+				if (!file.is_open()) {
+					print("unable to open file\n");
+					continue;
+				}
+
+				uint32_t filesig = 0;
+				file.read((char*)&filesig, sizeof(filesig));
+				if (!file || filesig != nula::signature) {
+					print("not a nula library\n");
+					file.close();
+					continue;
+				}
+
+				file.seekg(0, std::ios::end);
+				size_t size = (size_t)file.tellg() - 4;
+				if (size <= 8) {
+					print("file too small\n");
+					file.close();
+					continue;
+				}
+
+				std::string btc;
+				btc.resize(size);
+
+				file.seekg(4, std::ios::beg);
+				file.read(btc.data(), size);
+				file.close();
+		
+				// everything the library allocates while loading and attaching is charged to its own category
+				const uint8_t oldMemcat = L->activememcat;
+				if (!option.empty()) {
+					const uint8_t memcat = tagMemcat(path);
+					if (!memcat)
+						print("all memory categories are taken; %s is charged to the default one\n", path.c_str());
+					lua_setmemcat(L, memcat);
+				}
+
+				if (luau_load(L, std::format("@{}", path).c_str(), btc.data(), btc.size(), 0)) {
+					print("invalid or corrupted bytecode\n");
+					lua_setmemcat(L, oldMemcat);
+					file.close();
+					continue;
+				}
+
+				file.close();
+
+				int refDllMain = LUA_REFNIL;
+				const Closure* DllMain = nullptr;
+				const Closure* cl = (const Closure*)lua_topointer(L, -1);
+				for (int i = 0; i < cl->l.p->sizep; i++) {
+					Proto* p = cl->l.p->p[i];
+					if (!p->debugname)
+						continue;
+
+					const Closure* ncl = luaF_newLclosure(L, p->nups, L->gt, p);
+					setclvalue(L, L->top, ncl);
+					incr_top(L);
+
+					const char* debugname = getstr(p->debugname);
+					if (strcmp(debugname, "DllMain")) {
+						lua_setglobal(L, debugname);
+						loadedProtos.push_back(p);
+					} else {
+						DllMain = ncl;
+						lua_pop(L, 1);
+						lua_ref(L, -1);
+					}
+				}
+
+				if (DllMain) {
+					setclvalue(L, L->top, DllMain);
+					incr_top(L);
+
+					lua_pushlightuserdata(L, nullptr);
+					lua_pushinteger(L, DLL_PROCESS_ATTACH);
+					lua_pushboolean(L, false);
+					lua_call(L, 3, 1);
+
+					if (L->status != LUA_OK || !lua_toboolean(L, -1)) {
+						print("DLL_PROCESS_ATTACH routine has failed\n");
+
+						lua_unref(L, refDllMain);
+						L->status = LUA_OK;
+						lua_setmemcat(L, oldMemcat);
+						continue;
+					}
+					lua_pop(L, 1);
+					lua_unref(L, refDllMain);
+				}
+
+				lua_setmemcat(L, oldMemcat);
+
+			}
+			else if (cmd == "help") {
+				print(
+					"  c, continue           - continue execution\n"
+					"  s, step               - step into next instruction\n"
+					"  n, next               - step over function calls\n"
+					"  s, step line          - step until the source line changes\n"
+					"  n, next line          - step over function calls until the source line changes\n"
+					"  l, list [source:]line - list source around the current or provided line\n"
+					"  finish                - step out of current function\n"
+				);
+				print("%s", Inspector::help);
+				print(
+					"    breakpoints         - list all breakpoints\n"
+					"    watchpoints         - list all watchpoints\n"
+					"    funcs               - list loaded functions\n"
+					"  threads               - list all threads of the VM\n"
+					"  b, break <loc>        - set breakpoint at location\n"
+					"    ... thread [addr]   - only stop the current or the given thread\n"
+					"  b, break heap > <size>\n"
+					"                        - stop when the heap grows past size bytes, KB, MB or GB\n"
+					"  b, break memcat <n> > <size>\n"
+					"                        - stop when memory category n grows past size\n"
+					"    ... snapshot        - write a heap snapshot to memory.<num>.json and continue instead\n"
+					"  b, break gc <phase>   - stop when the collector enters %s\n"
+					"  d, delete <num>       - delete breakpoint by number\n"
+					"  d, delete m<num>      - delete memory breakpoint by number\n"
+					"  d, delete gc [phase]  - delete the collector breakpoint on phase, or all of them\n"
+					"  toggle <num>          - enable/disable breakpoint by number\n"
+					"  watch <what>          - stop when R<num>, U<num> or <table>.<field> changes\n"
+					"  unwatch <num>         - delete watchpoint by number\n"
+					"  display [expr]        - (no expr) show all displays; evaluate expr at every stop\n"
+					"  undisplay <num>       - stop showing an expression by number\n"
+					"  onstop [cmd/clear]    - (no cmd) list commands run at every stop; add or clear them\n"
+					"  record [start [n]]    - (no start) show recording stats; log what every instruction overwrites\n"
+					"                          into a ring of n entries\n"
+					"  record stop           - stop recording\n"
+					"  rs, reverse-step      - undo the last recorded instruction\n"
+					"  rn, reverse-next      - undo instructions until back in the same or a calling frame\n"
+					"  rc, reverse-continue  - undo instructions until a breakpoint\n"
+					"  checkpoint            - snapshot the process at this stop (Linux only)\n"
+					"  checkpoints           - list checkpoints\n"
+					"  restart <num>         - continue from a checkpoint, keeping the current breakpoints\n"
+					"  errors                - report and clear the captured error stacks\n"
+					"  watchdog [budget]     - (no budget) show the watchdog and its samples; stop when a top-level call\n"
+					"                          runs more than <n> estimated instructions or <n>ms\n"
+					"    ... sample          - record a stack sample and continue instead of stopping\n"
+					"  watchdog off          - disarm the watchdog\n"
+					"  trace [start [n]]     - (no start) show the trace; record entries and exits of up to n calls\n"
+					"  trace stop [file]     - stop tracing and write Chrome trace-event JSON, trace.json by default\n"
+					"  profile start|stop    - count calls and time spent per function\n"
+					"  profile report [col]  - list profiled functions sorted by calls, incl, excl (default), avg or func\n"
+					"    ... [count]         - number of rows, 30 by default\n"
+					"  fastcalls start|stop  - count how often each builtin fast call falls back to a full call\n"
+					"  fastcalls [count]     - list fast call sites by fallback count\n"
+					"  slots start|stop      - count hash slot prediction misses of constant key field accesses\n"
+					"  slots [count]         - list field access sites by miss rate, with the table shapes they saw\n"
+					"  closures start|stop   - count closures allocated per NEWCLOSURE and DUPCLOSURE site\n"
+					"  closures [count]      - list closure sites by allocations, with their captures and loop depth\n"
+					"  <expr or statement>   - evaluate with the current frame's locals and upvalues in scope\n"
+					"  cls                   - clear console\n"
+					"  quit, q               - quit\n"
+					"  load <filename>       - load a nula library\n"
+					"    ... memcat          - charge its allocations to a memory category of its own\n"
+					"  patch <op> <val>      - patch the current instruction\n"
+					"  gc [subcmd]           - (no subcmd) show GC & memory usage info\n"
+					"    step                - step the garbage collector\n"
+					"    full                - perform a full GC cycle\n"
+					"    threshold <val>     - set the GC threshold\n"
+					"    pause               - pause the GC completly\n"
+					"    resume              - resume the garbage collector\n"
+					"    stats               - show statistics\n"
+					"    trace               - toggle allocation, deallocation, and reallocation tracing\n"
+					"    dump                - dump the entire heap to ./gcdump.json\n"
+					"    tables [count]      - find memory wasted by table parts larger than their contents\n"
+					"    strings [count]     - show string memory by length, the largest strings and repeated payloads\n"
+					"    memcats             - show the bytes held by each memory category and the module it belongs to\n"
+					"    timeline [start [ms] [n]|stop|save <file>]\n"
+					"                        - (no subcmd) show the timeline; sample every memory category at GC steps,\n"
+					"                          at most every ms (100) into n samples, or save them as .csv or .json\n"
+					"    tune [n] <expr>     - call the function expr evaluates to n times (10) under each goal and step\n"
+					"                          multiplier; compare calls/s against the longest calls, cycles and peak heap;\n"
+					"                          the p99 latency needs n of at least 100\n",
+					gcPhaseNames(", ").c_str()
+				);
+
+			}
+			else if (cmd == "patch") {
+				char operand;
+				ss >> std::ws;
+				ss >> operand;
+
+				int val = 0;
+				if (!(ss >> val)) {
+					print("val must be an integer\n");
+					continue;
+				}
+
+				uint8_t* pc = (uint8_t*)(L->ci->savedpc - 1);
+
+				switch (tolower((unsigned char)operand)) {
+				case 'a':
+					if (val < 0 || val > 255) {
+						print("val must be 0255 for this operand\n");
+						continue;
+					}
+					pc[1] = (uint8_t)val;
+					break;
+
+				case 'b':
+					if (val < 0 || val > 255) {
+						print("val must be 0255 for this operand\n");
+						continue;
+					}
+					pc[2] = (uint8_t)val;
+					break;
+
+				case 'c':
+					if (val < 0 || val > 255) {
+						print("val must be 0255 for this operand\n");
+						continue;
+					}
+					pc[3] = (uint8_t)val;
+					break;
+
+				case 'd':
+					if (val < -32768 || val > 32767) {
+						print("val must be -3276832767 for this operand\n");
+						continue;
+					}
+					
+					*(int16_t*)(pc + 2) = (int16_t)val;
+					break;
+
+				case 'e':
+					if (val < -8388608 || val > 8388607) {
+						print("val must be -8388608-8388607 for this operand\n");
+						continue;
+					}
+					
+					pc[1] = (uint8_t)(val & 0xFF);
+					pc[2] = (uint8_t)((val >> 8) & 0xFF);
+					pc[3] = (uint8_t)((val >> 16) & 0xFF);
+					break;
+
+				default:
+					print("invalid operand\n");
+					continue;
+				}
+
+				std::string insn;
+				ldbg::idisasm(insn, (const Instruction*&)pc, clvalue(L->ci->func)->l.p);
+				print("%s\n", insn.c_str());
+			}
+			else if (cmd == "gc") {
+				std::string subcmd;
+				ss >> std::ws;
+				ss >> subcmd;
+
+				global_State* g = L->global;
+
+				if (subcmd.empty()) {
+					struct Context {
+						global_State* g;
+						uint32_t dead, total;
+					};
+					Context ctx = { 0 };
+					ctx.g = g;
+
+					luaM_visitgco(L, &ctx, [](void* _ctx, lua_Page* page, GCObject* gco) -> bool {
+						if (!iscollectable(&gco->gch))
+							return false;
+						Context* ctx = (Context*)_ctx;
+						ctx->total++;
+						if (isdead(ctx->g, gco))
+							ctx->dead++;
+						return false;
+						});
+					Event event;
+					event.kind = EventKind::Gc;
+					event.gcState = luaC_statename(g->gcstate);
+					event.totalBytes = g->totalbytes;
+
+					if (g->GCthreshold == SIZE_MAX) {
+						event.text = std::format("GC is unavailable\ntotal bytes allocated: " ANSI_YELLOW "{}\n" ANSI_RESET, g->totalbytes);
+					}
+					else
+						event.text = std::format("GC state: {} (threshold: " ANSI_YELLOW "{}" ANSI_RESET " bytes)\ntotal bytes allocated: " ANSI_YELLOW "{}\n" ANSI_RESET,
+							event.gcState, g->GCthreshold, g->totalbytes);
+					emit(event);
+
+					print("total GC objects allocated: " ANSI_YELLOW "%u" ANSI_GREY "\n  %u of them are dead\n" ANSI_GREY, ctx.total, ctx.dead);
+					continue;
+				}
+				else if (subcmd == "step") {
+					if (!luaC_needsGC(L)) {
+						print("can't step GC if totalbytes < GCthreshold; either change the threshold or run a full GC cycle\n");
+						continue;
+					}
+
+					std::string countStr;
+					ss >> std::ws;
+					ss >> countStr;
+
+					uint8_t count = 1;
+					if (!countStr.empty() && !parseInt(countStr, count)) {
+						print("count must be an integer\n");
+						continue;
+					}
+					for (uint8_t i = 0; i < count; i++) {
+						luaC_step(L, true);
+						if (!luaC_needsGC(L))
+							break;
+					}
+				}
+				else if (subcmd == "full") {
+					if (g->GCthreshold != SIZE_MAX)
+						luaC_fullgc(L);
+				}
+				else if (subcmd == "threshold") {
+					std::string thresholdStr;
+					ss >> std::ws;
+					ss >> thresholdStr;
+
+					size_t threshold = 0;
+					if (!parseInt(thresholdStr, threshold)) {
+						print("threshold must be an integer\n");
+						continue;
+					}
+					g->GCthreshold = threshold;
+					if (oldGCThreshold)
+						oldGCThreshold = 0;
+				}
+				else if (subcmd == "pause") {
+					if (oldGCThreshold)
+						print("GC is already paused\n");
+					else {
+						oldGCThreshold = g->GCthreshold;
+						g->GCthreshold = SIZE_MAX;
+					}
+				}
+				else if (subcmd == "resume") {
+					if (!oldGCThreshold)
+						print("GC is not paused\n");
+					else {
+						g->GCthreshold = oldGCThreshold;
+						oldGCThreshold = 0;
+					}
+				}
+				else if (subcmd == "stats") {
+					struct Context {
+						global_State* g;
+						uint32_t dead, total, white, gray, black, fixed;
+					};
+
+					Context ctx = { 0 };
+					ctx.g = g;
+
+					luaM_visitgco(L, &ctx, [](void* _ctx, lua_Page* page, GCObject* gco) -> bool {
+						if (!iscollectable(&gco->gch))
+							return false;
+
+						Context* ctx = (Context*)_ctx;
+						ctx->total++;
+
+						if (isdead(ctx->g, gco))
+							ctx->dead++;
+						if (iswhite(gco))
+							ctx->white++;
+						else if (isblack(gco))
+							ctx->black++;
+						else if (isgray(gco))
+							ctx->gray++;
+						if (isfixed(gco))
+							ctx->fixed++;
+						return false;
+					});
+	
+					print(
+						"total GC objects: " ANSI_YELLOW "%u\n" ANSI_GREY
+						"  %u of them are dead\n"
+						"  %u of them are white\n"
+						"  %u of them are gray\n"
+						"  %u of them are black\n"
+						"  %u of them are fixed\n" ANSI_RESET,
+						ctx.total, ctx.dead, ctx.white, ctx.gray, ctx.black, ctx.fixed
+					);
+					
+					print("heap goal size: " ANSI_YELLOW "%zu" ANSI_RESET " bytes\n", g->gcstats.heapgoalsizebytes);
+					print("atomic start total size: " ANSI_YELLOW "%zu" ANSI_RESET " bytes\n" ANSI_RESET, g->gcstats.atomicstarttotalsizebytes);
+					print("end total size: " ANSI_YELLOW "%zu" ANSI_RESET " bytes\n" ANSI_RESET, g->gcstats.endtotalsizebytes);
+					print("trigger integral: " ANSI_YELLOW "%d\n" ANSI_RESET, g->gcstats.triggerintegral);
+					print("trigger term position: " ANSI_YELLOW "%u\n" ANSI_RESET, g->gcstats.triggertermpos);
+
+					if (g->gcstats.starttimestamp > 0) {
+						print("start timestamp: " ANSI_YELLOW "%.6f\n" ANSI_RESET, g->gcstats.starttimestamp);
+						print("end timestamp: " ANSI_YELLOW "%.6f\n" ANSI_RESET, g->gcstats.endtimestamp);
+						print("atomic start timestamp: " ANSI_YELLOW "%.6f\n" ANSI_RESET, g->gcstats.atomicstarttimestamp);
+
+						if (g->gcstats.endtimestamp > g->gcstats.starttimestamp)
+							print("total GC cycle time: " ANSI_YELLOW "%.6f seconds\n" ANSI_RESET, g->gcstats.endtimestamp - g->gcstats.starttimestamp);
+
+						if (g->gcstats.atomicstarttimestamp > g->gcstats.starttimestamp)
+							print("mark phase time: " ANSI_YELLOW "%.6f seconds\n" ANSI_RESET, g->gcstats.atomicstarttimestamp - g->gcstats.starttimestamp);
+					}
+				}
+				else if (subcmd == "list") {
+					std::string arg;
+
+					uint8_t filterType = 255;
+					uint8_t filterMarked = 255;
+					uint8_t filterMemcat = 255;
+
+					while (ss >> arg) {
+						size_t eq = arg.find('=');
+						if (eq != std::string::npos) {
+							const std::string& key = arg.substr(0, eq);
+							const std::string& value = arg.substr(eq + 1);
+							if (key == "type") {
+								int tt = LUA_TNONE;
+								for (int i = 0; i < LUA_T_COUNT; i++) {
+									if (value == luaT_typenames[i]) {
+										tt = i;
+										break;
+									}
+								}
+
+								if (tt == LUA_TNONE) {
+									print("unknown type\n");
+									goto badOption;
+								}
+
+								if (tt < LUA_TSTRING) {
+									print("type is not garbage collectable\n");
+									goto badOption;
+								}
+
+								filterType = tt;
+
+							}
+							else if (key == "mark") {
+								if (value == "white") filterMarked = 0;
+								else if (value == "gray") filterMarked = 1;
+								else if (value == "black") filterMarked = 2;
+								else if (value == "fixed") filterMarked = 3;
+								else {
+									print("invalid marked\n");
+									goto badOption;
+								}
+							}
+							else if (key == "memcat") {
+								if (!parseInt(value, filterMemcat)) {
+									print("memcat must be an integer\n");
+									goto badOption;
+								}
+
+								if (filterMemcat > LUA_MEMORY_CATEGORIES) {
+									print("memcat out of range\n");
+									goto badOption;
+								}
+							}
+							else {
+								print("unknown option\n");
+								goto badOption;
+							}
+						}
+					}
+
+					// TODO: fuckass
+					goto allGood;
+				badOption:
+					continue;
+				allGood:;
+
+					struct Context {
+						global_State* g;
+						Debugger* dbg;
+
+						uint32_t count;
+						uint8_t filterType;
+						uint8_t filterMarked;
+						uint8_t filterMemcat;
+					};
+					Context ctx = { g, this, 0, filterType, filterMarked, filterMemcat };
+
+					luaM_visitgco(L, &ctx, [](void* _ctx, lua_Page* page, GCObject* gco) -> bool {
+						if (!iscollectable(&gco->gch))
+							return false;
+						Context* ctx = (Context*)_ctx;
+
+						if (ctx->filterType != 255 && gco->gch.tt != ctx->filterType)
+							return false;
+
+						if (ctx->filterMemcat != 255 && gco->gch.memcat != ctx->filterMemcat)
+							return false;
+
+						switch (ctx->filterMarked) {
+						case 0:
+							if (!iswhite(gco))
+								return false;
+							break;
+						case 1:
+							if (!isgray(gco))
+								return false;
+							break;
+						case 2:
+							if (!isblack(gco))
+								return false;
+							break;
+						case 3:
+							if (!isfixed(gco))
+								return false;
+							break;
+						default:
+							break;
+						}
+						
+						TValue o;
+						o.value.p = gco;
+						o.tt = gco->gch.tt;
+						const std::string& s = lua_strprimitive(&o);
+
+						ctx->dbg->print("  %.*s (address = " ANSI_YELLOW "0x%llx" ANSI_RESET ", type=%s, marked=%s%s, memcat=" ANSI_YELLOW "%u" ANSI_RESET ")\n",
+							(uint32_t)s.length(), s.c_str(),
+							(uintptr_t)gco,
+							luaT_typenames[gco->gch.tt],
+							isfixed(gco) ? "fixed " : "", iswhite(gco) ? "white" : isblack(gco) ? "black" : isgray(gco) ? "gray" : "unknown",
+							gco->gch.memcat
+						);
+						ctx->count++;
+						return false;
+					});
+					print("\ntotal objects: " ANSI_YELLOW "%u\n" ANSI_RESET, ctx.count);
+				}
+				else if (subcmd == "trace") {
+					if (oldFrealloc) {
+						g->ud = nullptr;
+						g->frealloc = oldFrealloc;
+						oldFrealloc = nullptr;
+						print("allocation tracing disabled\n");
+					}
+					else {
+						oldFrealloc = g->frealloc;
+						g->frealloc = frealloc;
+						g->ud = this;
+						print("allocation tracing enabled\n");
+					}
+				}
+				else if (subcmd == "dump") {
+					FILE* file = nullptr;
+					if (!fopen_s(&file, "gcdump.json", "w") || !file) {
+						print("unable to open gcdump.json\n");
+						continue;
+					}
+
+					luaC_dump(L, file, nullptr);
+					fclose(file);
+					print("heap dump written to gcdump.json\n");
+				}
+				else if (subcmd == "tables") {
+					size_t count = 15;
+					ss >> count;
+
+					std::string out;
+					reportTables(L, count, out);
+					print("%s", out.c_str());
+				}
+				else if (subcmd == "strings") {
+					size_t count = 15;
+					ss >> count;
+
+					std::string out;
+					reportStrings(L, count, out);
+					print("%s", out.c_str());
+				}
+				else if (subcmd == "tune") {
+					uint32_t runs = 10;
+					ss >> std::ws;
+					if (isdigit(ss.peek()))
+						ss >> runs;
+
+					std::string expr;
+					ss >> std::ws;
+					std::getline(ss, expr);
+
+					if (expr.empty() || !runs) {
+						print("usage: gc tune [runs] <expr>\n");
 						continue;
 					}
+
+					tuneGc(L, runs, expr);
+				}
+				else if (subcmd == "memcats") {
+					for (int i = 0; i < LUA_MEMORY_CATEGORIES; i++) {
+						const bool named = i < (int)memcatNames.size() && !memcatNames[i].empty();
+						if (g->memcatbytes[i] || named)
+							print("memcat " ANSI_YELLOW "%-3d" ANSI_RESET " %-12zu %s\n", i, g->memcatbytes[i], named ? memcatNames[i].c_str() : i == 0 ? "(default)" : "");
+					}
 				}
+				else if (subcmd == "timeline") {
+					std::string action;
+					ss >> action;
+
+					if (action == "start") {
+						uint32_t intervalMs = 100;
+						size_t capacity = 64 * 1024;
+						uint32_t requestedInterval = 0;
+						size_t requestedCapacity = 0;
+						if (ss >> requestedInterval) {
+							intervalMs = requestedInterval;
+							if (ss >> requestedCapacity)
+								capacity = requestedCapacity;
+						}
 
-				const Instruction* pc = p->code;
-				const Instruction* end = p->code + p->sizecode;
+						startMemoryTimeline(L, capacity, intervalMs);
+						print("sampling memory categories every %u ms or more into %zu samples\n", timeline.getIntervalMs(), timeline.capacity());
+					}
+					else if (action == "stop") {
+						timeline.stop();
+						releaseInterrupt();
+						print("memory timeline stopped\n");
+					}
+					else if (action == "save") {
+						std::string path;
+						ss >> path;
+						if (path.empty()) {
+							print("usage: gc timeline save <file>.csv|<file>.json\n");
+							continue;
+						}
 
-				while (pc < end) {
-					fprintf(options.out, ANSI_GREY "  %04X  ", (uint32_t)(pc - p->code));
-					ldbg::idisasm(options.out, pc, p);
-					fputs(ANSI_RESET "\n", options.out);
-					pc++;
+						if (writeMemoryTimeline(path))
+							print("%zu samples written to %s\n", timeline.size(), path.c_str());
+						else
+							print("unable to open %s\n", path.c_str());
+					}
+					else if (action.empty())
+						print("%s: %zu of %zu samples, every %u ms or more\n", timeline.active() ? "sampling" : "not sampling",
+							timeline.size(), timeline.capacity(), timeline.getIntervalMs());
+					else
+						print("usage: gc timeline [start [ms] [samples]|stop|save <file>]\n");
 				}
-
+				else print("unknown subcommand\n");
 			}
-			else if (cmd == "cls") system("cls");
-			else if (cmd == "load") {
-				std::string path;
+			else if (cmd == "display") {
+				std::string expr;
 				ss >> std::ws;
-				ss >> path;
-
-				std::ifstream file(path, std::ios::binary);
-				if (!file.is_open()) {
-					puts("unable to open file");
-					continue;
-				}
+				std::getline(ss, expr);
 
-				uint32_t filesig = 0;
-				file.read((char*)&filesig, sizeof(filesig));
-				if (!file || filesig != nula::signature) {
-					puts("not a nula library");
-					file.close();
+				if (expr.empty()) {
+					showDisplays(L);
 					continue;
 				}
 
-				file.seekg(0, std::ios::end);
-				size_t size = (size_t)file.tellg() - 4;
-				if (size <= 8) {
-					puts("file too small");
-					file.close();
+				// compile up front so typos are reported once instead of at every stop
+				if (!pushExpression(L, expr))
 					continue;
-				}
+				lua_pop(L, 1);
 
-				std::string btc;
-				btc.resize(size);
+				displays.push_back(expr);
+				print("display %zu: %s\n", displays.size(), expr.c_str());
+			}
+			else if (cmd == "watch") {
+				std::string what;
+				ss >> std::ws;
+				std::getline(ss, what);
 
-				file.seekg(4, std::ios::beg);
-				file.read(btc.data(), size);
-				file.close();
-		
-				if (luau_load(L, std::format("@{}", path).c_str(), btc.data(), btc.size(), 0)) {
-					puts("invalid or corrupted bytecode");
-					file.close();
+				if (what.empty()) {
+					print("usage: watch R<num>/U<num>/<table>.<field>\n");
 					continue;
 				}
 
-				file.close();
-
-				int refDllMain = LUA_REFNIL;
-				const Closure* DllMain = nullptr;
-				const Closure* cl = (const Closure*)lua_topointer(L, -1);
-				for (int i = 0; i < cl->l.p->sizep; i++) {
-					Proto* p = cl->l.p->p[i];
-					if (!p->debugname)
-						continue;
+				Closure* cl = clvalue(L->ci->func);
 
-					const Closure* ncl = luaF_newLclosure(L, p->nups, L->gt, p);
-					setclvalue(L, L->top, ncl);
-					incr_top(L);
+				Watchpoint wp = {};
+				wp.thread = L;
+				wp.expr = what;
+				wp.ref = LUA_NOREF;
+				wp.keyRef = LUA_NOREF;
+				wp.valueRef = LUA_NOREF;
 
-					const char* debugname = getstr(p->debugname);
-					if (strcmp(debugname, "DllMain")) {
-						lua_setglobal(L, debugname);
-						loadedProtos.push_back(p);
-					} else {
-						DllMain = ncl;
-						lua_pop(L, 1);
-						lua_ref(L, -1);
+				int idx = 0;
+				if (what[0] == 'R' && parseInt(what.substr(1), idx)) {
+					if (idx < 0 || idx >= cl->l.p->maxstacksize) {
+						print("index out of range\n");
+						continue;
 					}
+
+					wp.kind = Watchpoint::Kind::Register;
+					wp.cl = cl;
+					wp.level = (uint32_t)(L->ci - L->base_ci);
+					wp.index = idx;
 				}
+				else if (what[0] == 'U' && parseInt(what.substr(1), idx)) {
+					if (idx < 0 || idx >= cl->nupvalues) {
+						print("index out of range\n");
+						continue;
+					}
 
-				if (DllMain) {
-					setclvalue(L, L->top, DllMain);
-					incr_top(L);
+					wp.kind = Watchpoint::Kind::Upvalue;
+					wp.cl = cl;
+					wp.index = idx;
 
-					lua_pushlightuserdata(L, nullptr);
-					lua_pushinteger(L, DLL_PROCESS_ATTACH);
-					lua_pushboolean(L, false);
-					lua_call(L, 3, 1);
+					// keeps the closure, and through it the upvalue, alive
+					setclvalue(L, L->top, cl);
+					incr_top(L);
+					wp.ref = lua_ref(L, -1);
+					lua_pop(L, 1);
+				}
+				else {
+					size_t dot = what.rfind('.');
+					if (dot == std::string::npos || dot == 0 || dot + 1 == what.size()) {
+						print("usage: watch R<num>/U<num>/<table>.<field>\n");
+						continue;
+					}
 
-					if (L->status != LUA_OK || !lua_toboolean(L, -1)) {
-						puts("DLL_PROCESS_ATTACH routine has failed");
+					const int count = evaluate(L, what.substr(0, dot));
+					if (count < 0)
+						continue;
 
-						lua_unref(L, refDllMain);
-						L->status = LUA_OK;
+					if (count == 0 || !lua_istable(L, -count)) {
+						print("expression is not a table\n");
+						lua_pop(L, count);
 						continue;
 					}
+					lua_pop(L, count - 1);
+
+					wp.kind = Watchpoint::Kind::Field;
+					wp.table = hvalue(L->top - 1);
+					wp.ref = lua_ref(L, -1);
+					lua_pop(L, 1);
+
+					lua_pushlstring(L, what.data() + dot + 1, what.size() - dot - 1);
+					wp.key = tsvalue(L->top - 1);
+					wp.keyRef = lua_ref(L, -1);
 					lua_pop(L, 1);
-					lua_unref(L, refDllMain);
 				}
 
+				const TValue* o = watchSlot(L, wp);
+				keepWatchValue(L, wp, o);
+				wp.rendered = renderValue(o, { 1, 8, 256 });
+				watchpoints.push_back(wp);
+
+				print("watchpoint %zu: %s = %s\n", watchpoints.size(), what.c_str(), wp.rendered.c_str());
 			}
-			else if (cmd == "help") {
-				fprintf(options.out, 
-					"  c, continue           - continue execution\n"
-					"  s, step               - step into next instruction\n"
-					"  n, next               - step over function calls\n"
-					"  finish                - step out of current function\n"
-					"  bt, backtrace         - dump call stack\n"
-					"  b, break <loc>        - set breakpoint at location\n"
-					"  d, delete <num>       - delete breakpoint by number\n"
-					"  toggle <num>          - enable/disable breakpoint by number\n"
-					"  i, inspect [what]     - (no what) show function info\n"
-					"    locals              - list all local variables\n"
-					"    upvalues            - list upvalues\n"
-					"    R<num>              - show value of register\n"
-					"    U<num>              - show value of upvalue\n"
-					"    K<num>              - show value of constant\n"
-					"    stack               - dump stack\n"
-					"    breakpoints         - list all breakpoints\n"
-					"    funcs               - list loaded functions\n"
-					"    insn				 - disassemble current instruction\n"
-					"  disasm [func]         - disassemble the provided or the current function\n"
-					"  cls                   - clear console\n"
-					"  quit, q               - quit\n"
-					"  load <filename>       - load a nula library\n"
-					"  patch <op> <val>      - patch the current instruction\n"
-					"  gc [subcmd]           - (no subcmd) show GC & memory usage info\n"
-					"    step                - step the garbage collector\n"
-					"    full                - perform a full GC cycle\n"
-					"    threshold <val>     - set the GC threshold\n"
-					"    pause               - pause the GC completly\n"
-					"    resume              - resume the garbage collector\n"
-					"    stats               - show statistics\n"
-					"    trace               - toggle allocation, deallocation, and reallocation tracing\n"
-					"    dump                - dump the entire heap to ./gcdump.json\n"
-				);
+			else if (cmd == "unwatch") {
+				size_t num = 0;
+				if (!(ss >> num) || num < 1 || num > watchpoints.size()) {
+					print("usage: unwatch <watchpoint number>\n");
+					continue;
+				}
 
+				removeWatchpoint(L, num - 1);
 			}
-			else if (cmd == "patch") {
-				char operand;
+			else if (cmd == "onstop") {
+				std::string command;
 				ss >> std::ws;
-				ss >> operand;
+				std::getline(ss, command);
 
-				int val = 0;
-				if (!(ss >> val)) {
-					puts("val must be an integer");
+				if (command.empty()) {
+					size_t i = 0;
+					for (const auto& c : stopCommands)
+						print("%-4zu %s\n", ++i, c.c_str());
+				}
+				else if (command == "clear")
+					stopCommands.clear();
+				else
+					stopCommands.push_back(command);
+			}
+			else if (cmd == "checkpoint") {
+				if (!Checkpoints::supported()) {
+					print("checkpoints need fork(), which is only used on Linux\n");
 					continue;
 				}
 
-				uint8_t* pc = (uint8_t*)(L->ci->savedpc - 1);
-
-				switch (tolower((unsigned char)operand)) {
-				case 'a':
-					if (val < 0 || val > 255) {
-						puts("val must be 0255 for this operand");
-						continue;
-					}
-					pc[1] = (uint8_t)val;
-					break;
-
-				case 'b':
-					if (val < 0 || val > 255) {
-						puts("val must be 0255 for this operand");
-						continue;
-					}
-					pc[2] = (uint8_t)val;
-					break;
-
-				case 'c':
-					if (val < 0 || val > 255) {
-						puts("val must be 0255 for this operand");
-						continue;
-					}
-					pc[3] = (uint8_t)val;
-					break;
+				lua_Debug ar;
+				const std::string label = lua_getinfo(L, 0, "sl", &ar) ? std::format("{}:{}", ar.short_src, ar.currentline) : "??";
 
-				case 'd':
-					if (val < -32768 || val > 32767) {
-						puts("val must be -3276832767 for this operand");
-						continue;
-					}
-					
-					*(int16_t*)(pc + 2) = (int16_t)val;
-					break;
+				flushOutput();
 
-				case 'e':
-					if (val < -8388608 || val > 8388607) {
-						puts("val must be -8388608-8388607 for this operand");
-						continue;
-					}
-					
-					pc[1] = (uint8_t)(val & 0xFF);
-					pc[2] = (uint8_t)((val >> 8) & 0xFF);
-					pc[3] = (uint8_t)((val >> 16) & 0xFF);
-					break;
+				bool restarted = false;
+				std::string saved;
+				const uint32_t n = checkpoints.create(label, restarted, saved);
+				if (!n)
+					print("unable to create a checkpoint\n");
+				else if (!restarted)
+					print("checkpoint %u at %s\n", n, label.c_str());
+				else {
+					restoreBreakpoints(L, saved);
+					print("restarted from checkpoint %u at %s\n", n, label.c_str());
+					dumpFunctionInfo(L);
+				}
+			}
+			else if (cmd == "checkpoints") {
+				const auto list = checkpoints.list();
+				if (list.empty())
+					print("no checkpoints\n");
 
-				default:
-					puts("invalid operand");
+				for (const auto& [n, label] : list)
+					print("%-4u %s\n", n, label.c_str());
+			}
+			else if (cmd == "restart") {
+				uint32_t n = 0;
+				if (!(ss >> n)) {
+					print("usage: restart <checkpoint number>\n");
 					continue;
 				}
 
-				ldbg::idisasm(options.out, (const Instruction*&)pc, clvalue(L->ci->func)->l.p);
-				putchar('\n');
+				flushOutput();
+				if (!checkpoints.restart(n, saveBreakpoints()))
+					print("no checkpoint %u\n", n);
 			}
-			else if (cmd == "gc") {
+			else if (cmd == "record") {
 				std::string subcmd;
-				ss >> std::ws;
 				ss >> subcmd;
 
-				global_State* g = L->global;
-
-				if (subcmd.empty()) {
-					struct Context {
-						global_State* g;
-						uint32_t dead, total;
-					};
-					Context ctx = { 0 };
-					ctx.g = g;
+				if (subcmd == "start") {
+					size_t capacity = 1 << 18;
+					size_t requested = 0;
+					if (ss >> requested)
+						capacity = requested;
 
-					luaM_visitgco(L, &ctx, [](void* _ctx, lua_Page* page, GCObject* gco) -> bool {
-						if (!iscollectable(&gco->gch))
-							return false;
-						Context* ctx = (Context*)_ctx;
-						ctx->total++;
-						if (isdead(ctx->g, gco))
-							ctx->dead++;
-						return false;
-						});
-					if (g->GCthreshold == SIZE_MAX) {
-						fprintf(options.out, "GC is unavailable\ntotal bytes allocated: " ANSI_YELLOW "%zu\n" ANSI_RESET, g->totalbytes);
+					recorder.start(L, capacity);
+					print("recording into %zu entries (%.1f MB)\n", recorder.capacity(), recorder.capacity() * Recorder::entryBytes() / 1048576.0);
+				}
+				else if (subcmd == "stop") {
+					recorder.stop(L);
+					print("recording stopped\n");
+				}
+				else if (subcmd.empty()) {
+					if (!recorder.active()) {
+						print("not recording\n");
+						continue;
 					}
+
+					const uint64_t instructions = recorder.getInstructions();
+					const double entriesPerInsn = instructions ? (double)recorder.getEntriesLogged() / instructions : 0;
+
+					print("%zu of %zu entries used, %llu instructions logged\n", recorder.size(), recorder.capacity(), (unsigned long long)instructions);
+					print("memory: %.1f MB for the ring, %.1f MB per million instructions\n",
+						recorder.capacity() * Recorder::entryBytes() / 1048576.0, entriesPerInsn * Recorder::entryBytes() / 1.048576);
+					print("overhead: ~%.0f ns per instruction\n", recorder.getNanosPerInstruction());
+					if (recorder.replaying())
+						print("replaying %llu instructions back\n", (unsigned long long)recorder.getStepsBack());
+				}
+				else
+					print("usage: record [start [entries]|stop]\n");
+			}
+			else if (cmd == "reverse-step" || cmd == "rs")
+				reverseStep(L, false, false);
+			else if (cmd == "reverse-next" || cmd == "rn")
+				reverseStep(L, true, false);
+			else if (cmd == "reverse-continue" || cmd == "rc")
+				reverseStep(L, false, true);
+			else if (cmd == "errors")
+				reportErrors(L);
+			else if (cmd == "watchdog") {
+				std::string budget, mode;
+				ss >> budget >> mode;
+
+				if (budget.empty()) {
+					if (!watchdog.budget)
+						print("watchdog is off\n");
 					else
-						fprintf(options.out, "GC state: %s (threshold: " ANSI_YELLOW "%zu" ANSI_RESET " bytes)\ntotal bytes allocated: " ANSI_YELLOW "%zu\n" ANSI_RESET,
-							luaC_statename(g->gcstate), g->GCthreshold, g->totalbytes);
+						print("watchdog: %llu %s per top-level call, %s\n", (unsigned long long)watchdog.budget,
+							watchdog.unit == Watchdog::Unit::Instructions ? "instructions" : "ms", watchdog.sample ? "sampling" : "stopping");
 
-					fprintf(options.out, "total GC objects allocated: " ANSI_YELLOW "%u" ANSI_GREY "\n  %u of them are dead\n" ANSI_GREY, ctx.total, ctx.dead);
+					for (const auto& sample : watchdog.samples)
+						print("%s", sample.c_str());
 					continue;
 				}
-				else if (subcmd == "step") {
-					if (!luaC_needsGC(L)) {
-						puts("can't step GC if totalbytes < GCthreshold; either change the threshold or run a full GC cycle");
-						continue;
-					}
 
-					std::string countStr;
-					ss >> std::ws;
-					ss >> countStr;
+				if (budget == "off") {
+					setWatchdog(watchdog.unit, 0, false);
+					continue;
+				}
 
-					uint8_t count = 1;
-					if (!countStr.empty() && !parseInt(countStr, count)) {
-						puts("count must be an integer");
-						continue;
-					}
-					for (uint8_t i = 0; i < count; i++) {
-						luaC_step(L, true);
-						if (!luaC_needsGC(L))
-							break;
-					}
+				Watchdog::Unit unit = Watchdog::Unit::Instructions;
+				if (budget.size() > 2 && budget.ends_with("ms")) {
+					unit = Watchdog::Unit::Milliseconds;
+					budget.resize(budget.size() - 2);
 				}
-				else if (subcmd == "full") {
-					if (g->GCthreshold != SIZE_MAX)
-						luaC_fullgc(L);
+
+				uint64_t value = 0;
+				if (!isNumber(budget) || !(value = std::stoull(budget, nullptr, 0)) || (!mode.empty() && mode != "sample")) {
+					print("usage: watchdog <instructions|<n>ms> [sample] | off\n");
+					continue;
 				}
-				else if (subcmd == "threshold") {
-					std::string thresholdStr;
-					ss >> std::ws;
-					ss >> thresholdStr;
 
-					size_t threshold = 0;
-					if (!parseInt(thresholdStr, threshold)) {
-						puts("threshold must be an integer");
+				watchdog.samples.clear();
+				setWatchdog(unit, value, mode == "sample");
+			}
+			else if (cmd == "trace") {
+				std::string subcmd;
+				ss >> subcmd;
+
+				if (subcmd == "start") {
+					size_t capacity = 1 << 20;
+					size_t requested = 0;
+					if (ss >> requested)
+						capacity = requested;
+
+					tracer.start(capacity);
+					requestInterrupt();
+					print("tracing up to %zu calls\n", tracer.capacity());
+				}
+				else if (subcmd == "stop") {
+					std::string path = "trace.json";
+					ss >> path;
+
+					tracer.stop();
+					releaseInterrupt();
+
+					FILE* file = nullptr;
+					if (fopen_s(&file, path.c_str(), "w") || !file) {
+						print("unable to open %s\n", path.c_str());
 						continue;
 					}
-					g->GCthreshold = threshold;
-					if (oldGCThreshold)
-						oldGCThreshold = 0;
+
+					const size_t events = tracer.write(file);
+					fclose(file);
+					print("%zu events from %zu threads written to %s\n", events, tracer.threadCount(), path.c_str());
 				}
-				else if (subcmd == "pause") {
-					if (oldGCThreshold)
-						puts("GC is already paused");
-					else {
-						oldGCThreshold = g->GCthreshold;
-						g->GCthreshold = SIZE_MAX;
-					}
+				else if (subcmd.empty()) {
+					print("%s: %zu of %zu calls recorded from %zu threads\n", tracer.active() ? "tracing" : "not tracing",
+						tracer.size(), tracer.capacity(), tracer.threadCount());
+					if (tracer.dropped())
+						print("%zu calls dropped\n", tracer.dropped());
+				}
+				else
+					print("usage: trace [start [calls]|stop [file]]\n");
+			}
+			else if (cmd == "profile") {
+				std::string subcmd;
+				ss >> subcmd;
+
+				if (subcmd == "start") {
+					profiler.start();
+					requestInterrupt();
+					print("profiling\n");
 				}
-				else if (subcmd == "resume") {
-					if (!oldGCThreshold)
-						puts("GC is not paused");
+				else if (subcmd == "stop") {
+					profiler.stop();
+					releaseInterrupt();
+					print("profile stopped\n");
+				}
+				else if (subcmd == "report") {
+					std::string column = "excl";
+					size_t count = 30;
+					ss >> column >> count;
+
+					std::vector<const FunctionProfile*> rows;
+					for (const auto& f : profiler.functions())
+						rows.push_back(&f);
+
+					auto avg = [](const FunctionProfile* f) { return f->calls ? f->exclusiveNs / f->calls : 0; };
+
+					if (column == "calls")
+						std::stable_sort(rows.begin(), rows.end(), [](auto a, auto b) { return a->calls > b->calls; });
+					else if (column == "incl")
+						std::stable_sort(rows.begin(), rows.end(), [](auto a, auto b) { return a->inclusiveNs > b->inclusiveNs; });
+					else if (column == "excl")
+						std::stable_sort(rows.begin(), rows.end(), [](auto a, auto b) { return a->exclusiveNs > b->exclusiveNs; });
+					else if (column == "avg")
+						std::stable_sort(rows.begin(), rows.end(), [&](auto a, auto b) { return avg(a) > avg(b); });
+					else if (column == "func")
+						std::stable_sort(rows.begin(), rows.end(), [](auto a, auto b) { return a->name < b->name; });
 					else {
-						g->GCthreshold = oldGCThreshold;
-						oldGCThreshold = 0;
+						print("usage: profile report [calls|incl|excl|avg|func] [count]\n");
+						continue;
 					}
-				}
-				else if (subcmd == "stats") {
-					struct Context {
-						global_State* g;
-						uint32_t dead, total, white, gray, black, fixed;
-					};
-
-					Context ctx = { 0 };
-					ctx.g = g;
 
-					luaM_visitgco(L, &ctx, [](void* _ctx, lua_Page* page, GCObject* gco) -> bool {
-						if (!iscollectable(&gco->gch))
-							return false;
-
-						Context* ctx = (Context*)_ctx;
-						ctx->total++;
+					if (rows.empty()) {
+						print("no calls profiled\n");
+						continue;
+					}
 
-						if (isdead(ctx->g, gco))
-							ctx->dead++;
-						if (iswhite(gco))
-							ctx->white++;
-						else if (isblack(gco))
-							ctx->black++;
-						else if (isgray(gco))
-							ctx->gray++;
-						if (isfixed(gco))
-							ctx->fixed++;
-						return false;
-					});
-	
-					fprintf(options.out, 
-						"total GC objects: " ANSI_YELLOW "%u\n" ANSI_GREY
-						"  %u of them are dead\n"
-						"  %u of them are white\n"
-						"  %u of them are gray\n"
-						"  %u of them are black\n"
-						"  %u of them are fixed\n" ANSI_RESET,
-						ctx.total, ctx.dead, ctx.white, ctx.gray, ctx.black, ctx.fixed
+					print(
+						"%-4s %-30s %-10s %-10s %-10s %-10s %s\n"
+						ANSI_GREY "---- ------------------------------ ---------- ---------- ---------- ---------- --------------------\n" ANSI_RESET,
+						"n", "func", "calls", "incl ms", "excl ms", "avg us", "source"
 					);
-					
-					fprintf(options.out, "heap goal size: " ANSI_YELLOW "%zu" ANSI_RESET " bytes\n", g->gcstats.heapgoalsizebytes);
-					fprintf(options.out, "atomic start total size: " ANSI_YELLOW "%zu" ANSI_RESET " bytes\n" ANSI_RESET, g->gcstats.atomicstarttotalsizebytes);
-					fprintf(options.out, "end total size: " ANSI_YELLOW "%zu" ANSI_RESET " bytes\n" ANSI_RESET, g->gcstats.endtotalsizebytes);
-					fprintf(options.out, "trigger integral: " ANSI_YELLOW "%d\n" ANSI_RESET, g->gcstats.triggerintegral);
-					fprintf(options.out, "trigger term position: " ANSI_YELLOW "%u\n" ANSI_RESET, g->gcstats.triggertermpos);
 
-					if (g->gcstats.starttimestamp > 0) {
-						fprintf(options.out, "start timestamp: " ANSI_YELLOW "%.6f\n" ANSI_RESET, g->gcstats.starttimestamp);
-						fprintf(options.out, "end timestamp: " ANSI_YELLOW "%.6f\n" ANSI_RESET, g->gcstats.endtimestamp);
-						fprintf(options.out, "atomic start timestamp: " ANSI_YELLOW "%.6f\n" ANSI_RESET, g->gcstats.atomicstarttimestamp);
+					for (size_t i = 0; i < std::min(count, rows.size()); i++) {
+						const FunctionProfile* f = rows[i];
 
-						if (g->gcstats.endtimestamp > g->gcstats.starttimestamp)
-							fprintf(options.out, "total GC cycle time: " ANSI_YELLOW "%.6f seconds\n" ANSI_RESET, g->gcstats.endtimestamp - g->gcstats.starttimestamp);
+						// the number inspect funcs and break use for the same proto
+						auto it = std::find(loadedProtos.begin(), loadedProtos.end(), f->p);
+						const std::string n = f->p && it != loadedProtos.end() ? std::to_string(it - loadedProtos.begin() + 1) : "-";
 
-						if (g->gcstats.atomicstarttimestamp > g->gcstats.starttimestamp)
-							fprintf(options.out, "mark phase time: " ANSI_YELLOW "%.6f seconds\n" ANSI_RESET, g->gcstats.atomicstarttimestamp - g->gcstats.starttimestamp);
+						print("%-4s " ANSI_CYAN "%-30s" ANSI_RESET " %-10llu %-10.3f %-10.3f %-10.3f " ANSI_YELLOW "%s:%d\n" ANSI_RESET,
+							n.c_str(), f->name.c_str(), (unsigned long long)f->calls,
+							f->inclusiveNs / 1e6, f->exclusiveNs / 1e6, avg(f) / 1e3,
+							f->source.c_str(), f->line
+						);
 					}
+
+					if (profiler.getInterrupts())
+						print(ANSI_GREY "%.3f ms spent in the profiler over %llu safe points (%llu ns each) is left out\n" ANSI_RESET,
+							profiler.getOverheadNs() / 1e6, (unsigned long long)profiler.getInterrupts(),
+							(unsigned long long)(profiler.getOverheadNs() / profiler.getInterrupts()));
 				}
-				else if (subcmd == "list") {
-					std::string arg;
+				else if (subcmd.empty())
+					print("%s, %zu functions called\n", profiler.active() ? "profiling" : "not profiling", profiler.functions().size());
+				else
+					print("usage: profile [start|stop|report [column] [count]]\n");
+			}
+			else if (cmd == "fastcalls") {
+				std::string subcmd;
+				ss >> subcmd;
 
-					uint8_t filterType = 255;
-					uint8_t filterMarked = 255;
-					uint8_t filterMemcat = 255;
+				if (subcmd == "start") {
+					fastcalls.start(L);
+					print("counting fast calls\n");
+				}
+				else if (subcmd == "stop") {
+					fastcalls.stop();
+					print("fast call counting stopped\n");
+				}
+				else if (subcmd.empty() || subcmd == "report") {
+					size_t count = 30;
+					ss >> count;
 
-					while (ss >> arg) {
-						size_t eq = arg.find('=');
-						if (eq != std::string::npos) {
-							const std::string& key = arg.substr(0, eq);
-							const std::string& value = arg.substr(eq + 1);
-							if (key == "type") {
-								int tt = LUA_TNONE;
-								for (int i = 0; i < LUA_T_COUNT; i++) {
-									if (value == luaT_typenames[i]) {
-										tt = i;
-										break;
-									}
-								}
+					std::vector<const FastcallSite*> rows;
+					for (const auto& site : fastcalls.sites())
+						rows.push_back(&site);
 
-								if (tt == LUA_TNONE) {
-									puts("unknown type");
-									goto badOption;
-								}
+					std::stable_sort(rows.begin(), rows.end(), [](auto a, auto b) { return a->fallbacks > b->fallbacks; });
 
-								if (tt < LUA_TSTRING) {
-									puts("type is not garbage collectable");
-									goto badOption;
-								}
+					if (rows.empty()) {
+						print("%s, no fast calls ran\n", fastcalls.active() ? "counting" : "not counting");
+						continue;
+					}
 
-								filterType = tt;
+					print(
+						"%-8s %-16s %-10s %-10s %-8s %-30s %s\n"
+						ANSI_GREY "-------- ---------------- ---------- ---------- -------- ------------------------------ --------------------\n" ANSI_RESET,
+						"builtin", "name", "executed", "fallbacks", "rate", "func", "source"
+					);
 
-							}
-							else if (key == "mark") {
-								if (value == "white") filterMarked = 0;
-								else if (value == "gray") filterMarked = 1;
-								else if (value == "black") filterMarked = 2;
-								else if (value == "fixed") filterMarked = 3;
-								else {
-									puts("invalid marked");
-									goto badOption;
-								}
-							}
-							else if (key == "memcat") {
-								if (!parseInt(value, filterMemcat)) {
-									puts("memcat must be an integer");
-									goto badOption;
-								}
+					for (size_t i = 0; i < std::min(count, rows.size()); i++) {
+						const FastcallSite* site = rows[i];
+						Proto* p = site->p;
 
-								if (filterMemcat > LUA_MEMORY_CATEGORIES) {
-									puts("memcat out of range");
-									goto badOption;
-								}
-							}
-							else {
-								puts("unknown option");
-								goto badOption;
-							}
-						}
+						print("%-8u " ANSI_CYAN "%-16s" ANSI_RESET " %-10llu %-10llu %-7.1f%% %-30s " ANSI_YELLOW "%s:%d\n" ANSI_RESET,
+							site->builtin, site->name.empty() ? "??" : site->name.c_str(),
+							(unsigned long long)site->executed, (unsigned long long)site->fallbacks,
+							site->executed ? 100.0 * site->fallbacks / site->executed : 0.0,
+							p->debugname ? getstr(p->debugname) : "??",
+							getSource(p).c_str(), p->lineinfo ? luaG_getline(p, site->pc) : 0
+						);
 					}
+				}
+				else
+					print("usage: fastcalls [start|stop|report [count]]\n");
+			}
+			else if (cmd == "slots") {
+				std::string subcmd;
+				ss >> subcmd;
 
-					// TODO: fuckass
-					goto allGood;
-				badOption:
-					continue;
-				allGood:;
-
-					struct Context {
-						global_State* g;
-						FILE* out;
+				if (subcmd == "start") {
+					slots.start(L);
+					print("counting slot prediction hits\n");
+				}
+				else if (subcmd == "stop") {
+					slots.stop();
+					print("slot prediction counting stopped\n");
+				}
+				else if (subcmd.empty() || subcmd == "report") {
+					size_t count = 30;
+					ss >> count;
 
-						uint32_t count;
-						uint8_t filterType;
-						uint8_t filterMarked;
-						uint8_t filterMemcat;
+					auto missRate = [](const SlotSite* site) {
+						const uint64_t runs = site->hits + site->misses;
+						return runs ? (double)site->misses / runs : 0.0;
 					};
-					Context ctx = { g, options.out, filterType, filterMarked, filterMemcat, 0 };
 
-					luaM_visitgco(L, &ctx, [](void* _ctx, lua_Page* page, GCObject* gco) -> bool {
-						if (!iscollectable(&gco->gch))
-							return false;
-						Context* ctx = (Context*)_ctx;
+					std::vector<const SlotSite*> rows;
+					for (const auto& site : slots.sites())
+						rows.push_back(&site);
 
-						if (ctx->filterType != 255 && gco->gch.tt != ctx->filterType)
-							return false;
+					std::stable_sort(rows.begin(), rows.end(), [&](auto a, auto b) {
+						return missRate(a) != missRate(b) ? missRate(a) > missRate(b) : a->misses > b->misses;
+					});
 
-						if (ctx->filterMemcat != 255 && gco->gch.memcat != ctx->filterMemcat)
-							return false;
+					if (rows.empty()) {
+						print("%s, no field accesses ran\n", slots.active() ? "counting" : "not counting");
+						continue;
+					}
 
-						switch (ctx->filterMarked) {
-						case 0:
-							if (!iswhite(gco))
-								return false;
-							break;
-						case 1:
-							if (!isgray(gco))
-								return false;
-							break;
-						case 2:
-							if (!isblack(gco))
-								return false;
-							break;
-						case 3:
-							if (!isfixed(gco))
-								return false;
-							break;
-						default:
-							break;
-						}
-						
-						TValue o;
-						o.value.p = gco;
-						o.tt = gco->gch.tt;
-						const std::string& s = lua_strprimitive(&o);
+					print(
+						"%-11s %-20s %-10s %-10s %-8s %-7s %-30s %s\n"
+						ANSI_GREY "----------- -------------------- ---------- ---------- -------- ------- ------------------------------ --------------------\n" ANSI_RESET,
+						"op", "key", "runs", "misses", "rate", "shapes", "func", "source"
+					);
 
-						fprintf(ctx->out, "  %.*s (address = " ANSI_YELLOW "0x%llx" ANSI_RESET ", type=%s, marked=%s%s, memcat=" ANSI_YELLOW "%u" ANSI_RESET ")\n",
-							(uint32_t)s.length(), s.c_str(),
-							(uintptr_t)gco,
-							luaT_typenames[gco->gch.tt],
-							isfixed(gco) ? "fixed " : "", iswhite(gco) ? "white" : isblack(gco) ? "black" : isgray(gco) ? "gray" : "unknown",
-							gco->gch.memcat
+					for (size_t i = 0; i < std::min(count, rows.size()); i++) {
+						const SlotSite* site = rows[i];
+						Proto* p = site->p;
+
+						const std::string shapes = std::format("{}{}", site->shapeCount, site->otherShapes ? "+" : "");
+						print("%-11s " ANSI_CYAN "%-20s" ANSI_RESET " %-10llu %-10llu %-7.1f%% %-7s %-30s " ANSI_YELLOW "%s:%d\n" ANSI_RESET,
+							site->op == LOP_GETTABLEKS ? "GETTABLEKS" : site->op == LOP_SETTABLEKS ? "SETTABLEKS" : "NAMECALL",
+							getstr(site->key), (unsigned long long)(site->hits + site->misses), (unsigned long long)site->misses,
+							100.0 * missRate(site), shapes.c_str(),
+							p->debugname ? getstr(p->debugname) : "??",
+							getSource(p).c_str(), p->lineinfo ? luaG_getline(p, site->pc) : 0
 						);
-						ctx->count++;
-						return false;
-					});
-					fprintf(options.out, "\ntotal objects: " ANSI_YELLOW "%u\n" ANSI_RESET, ctx.count);
-				}
-				else if (subcmd == "trace") {
-					if (oldFrealloc) {
-						g->ud = nullptr;
-						g->frealloc = oldFrealloc;
-						oldFrealloc = nullptr;
-						fprintf(options.out, "allocation tracing disabled\n");
-					}
-					else {
-						oldFrealloc = g->frealloc;
-						g->frealloc = frealloc;
-						g->ud = this;
-						fprintf(options.out, "allocation tracing enabled\n");
+
+						// only sites that miss are worth restructuring, so only theirs are broken down
+						if (site->misses && site->shapeCount > 1) {
+							for (uint8_t s = 0; s < site->shapeCount; s++) {
+								const TableShape& shape = site->shapes[s];
+								print(ANSI_GREY "            metatable 0x%llx, %d array, %d hash slots: %llu\n" ANSI_RESET,
+									(unsigned long long)(uintptr_t)shape.metatable, shape.sizearray, 1 << shape.lsizenode, (unsigned long long)shape.count);
+							}
+						}
+
+						if (site->others)
+							print(ANSI_GREY "            %llu runs on values other than tables\n" ANSI_RESET, (unsigned long long)site->others);
 					}
 				}
-				else if (subcmd == "dump") {
-					FILE* file = nullptr;
-					if (!fopen_s(&file, "gcdump.json", "w") || !file) {
-						puts("unable to open gcdump.json");
+				else
+					print("usage: slots [start|stop|report [count]]\n");
+			}
+			else if (cmd == "closures") {
+				std::string subcmd;
+				ss >> subcmd;
+
+				if (subcmd == "start") {
+					closures.start(L);
+					print("counting closure allocations\n");
+				}
+				else if (subcmd == "stop") {
+					closures.stop();
+					print("closure counting stopped\n");
+				}
+				else if (subcmd.empty() || subcmd == "report") {
+					size_t count = 30;
+					ss >> count;
+
+					std::vector<const ClosureSite*> rows;
+					for (const auto& site : closures.sites())
+						rows.push_back(&site);
+
+					std::stable_sort(rows.begin(), rows.end(), [](auto a, auto b) { return a->allocations > b->allocations; });
+
+					if (rows.empty()) {
+						print("%s, no closures created\n", closures.active() ? "counting" : "not counting");
 						continue;
 					}
 
-					luaC_dump(L, file, nullptr);
-					fclose(file);
-					puts("heap dump written to gcdump.json");
+					print(
+						"%-10s %-10s %-10s %-10s %-6s %-24s %-24s %s\n"
+						ANSI_GREY "---------- ---------- ---------- ---------- ------ ------------------------ ------------------------ --------------------\n" ANSI_RESET,
+						"op", "runs", "allocs", "val/ref/up", "loop", "closure", "in", "source"
+					);
+
+					for (size_t i = 0; i < std::min(count, rows.size()); i++) {
+						const ClosureSite* site = rows[i];
+						Proto* p = site->p;
+
+						const std::string captures = std::format("{}/{}/{}", site->byValue, site->byReference, site->fromUpvalue);
+						const std::string loop = site->loopDepth ? std::format("x{}", site->loopDepth) : "-";
+						print("%-10s %-10llu %-10llu %-10s " ANSI_RED "%-6s" ANSI_RESET " " ANSI_CYAN "%-24s" ANSI_RESET " %-24s " ANSI_YELLOW "%s:%d\n" ANSI_RESET,
+							site->op == LOP_NEWCLOSURE ? "NEWCLOSURE" : "DUPCLOSURE",
+							(unsigned long long)site->runs, (unsigned long long)site->allocations,
+							captures.c_str(), loop.c_str(),
+							site->child->debugname ? getstr(site->child->debugname) : "anonymous",
+							p->debugname ? getstr(p->debugname) : "??",
+							getSource(p).c_str(), p->lineinfo ? luaG_getline(p, site->pc) : 0
+						);
+					}
 				}
-				else puts("unknown subcommand");
+				else
+					print("usage: closures [start|stop|report [count]]\n");
 			}
-			else {
-				const std::string& btc = Luau::compile(line, { 2, 2, 1 }, {}, nullptr);
+			else if (cmd == "undisplay") {
+				size_t num = 0;
+				if (!(ss >> num) || num < 1 || num > displays.size()) {
+					print("usage: undisplay <display number>\n");
+					continue;
+				}
 
-				L->singlestep = false;
-				lua_pushcfunction(L, options.onError, "");
-				if (luau_load(L, "ldbg", btc.data(), btc.size(), 0)) puts(lua_tostring(L, -1));
-				else lua_pcall(L, 0, 0, -2);
-				lua_pop(L, 1);
-				L->singlestep = true;
+				displays.erase(displays.begin() + (num - 1));
 			}
+			else {
+				const int count = evaluate(L, line);
+				for (int i = 0; i < count; i++)
+					print(ANSI_GREY "  %d " ANSI_RESET "= %s\n", i + 1, renderValue(L->top - count + i).c_str());
+				if (count > 0)
+					lua_pop(L, count);
+			}
+		}
+
+		// execution only ever continues from the live state
+		if (recorder.replaying()) {
+			recorder.toPresent(L);
+			print("returned to the present\n");
 		}
+
+		stoppedThread = nullptr;
+		flushOutput();
 	}
 
 	void Debugger::debugstep(lua_State* L, lua_Debug* ar) {
-		if (!debugstepActive)
-			return;
-
 		const Closure* cl = clvalue(L->ci->func);
 		if (cl->isC)
 			return;
 
 		const Instruction* pc = L->ci->savedpc - 1;
+
+		// expressions evaluated while replaying can resume coroutines, which must not log over the past
+		if (recorder.active() && !recorder.replaying())
+			recorder.record(L, cl->l.p, pc);
+
+		if (fastcalls.active())
+			fastcalls.onStep(L, cl->l.p, pc);
+		if (slots.active())
+			slots.onStep(L, cl->l.p, pc);
+		if (closures.active())
+			closures.onStep(L, cl->l.p, pc);
+
+		bool stop = false;
+		if (!watchpoints.empty() && checkWatchpoints(L, cl->l.p, pc)) {
+			stop = true;
+			stopReason = "data breakpoint";
+		}
+
+		if (dap && dap->pending)
+			dap->poll(L);
+
+		// with singlestep on, a pause doesn't have to wait for the interrupt hook
+		if (pauseRequested.load(std::memory_order_relaxed) && pauseRequested.exchange(false) && !stoppedThread) {
+			stop = true;
+			stopReason = "pause";
+		}
+
+		// nor does a memory breakpoint, which then stops right after the allocating instruction
+		if (memoryBreakHit && takeMemoryBreak(L)) {
+			stop = true;
+			stopReason = "memory breakpoint";
+		}
+
+		if (gcBreakHit >= 0 && takeGcBreak(L)) {
+			stop = true;
+			stopReason = "gc breakpoint";
+		}
+
+		if (breakNext)
+			stop = true;
+
+		if (!stop && !debugstepActive)
+			return;
+
+		// threads that aren't stepping only pay for the lookup while another one is
+		auto it = threads.find(L);
+		if (!stop && (it == threads.end() || !it->second.stepping))
+			return;
+
+		ThreadState& ts = it != threads.end() ? it->second : threads[L];
+		if (stop)
+			ts.state = State::None;
+
 		uint32_t level = (uint32_t)(L->ci - L->base_ci);
-		if (level != lastLevel) {
-			if (state == State::None) {
+		if (level != ts.lastLevel) {
+			if (ts.state == State::None) {
 				dumpFunctionInfo(L);
-				putchar('\n');
+				print("\n");
 			}
-			lastLevel = level;
+			ts.lastLevel = level;
 		}
 
-		switch (state) {
+		switch (ts.state) {
 		case State::StepOver: {
-			if (level < stateLevel)
-				state = State::None;
-			else if (level > stateLevel)
+			if (level < ts.stateLevel)
+				ts.state = State::None;
+			else if (level > ts.stateLevel)
 				return;
 		} break;
 
-		case State::Finish: {
-			uint32_t level = (uint32_t)(L->ci - L->base_ci);
+		case State::StepLine:
+		case State::NextLine: {
+			if (ts.state == State::NextLine && level > ts.stateLevel)
+				return;
+
+			Proto* p = cl->l.p;
+			const int line = luaG_getline(p, (int)(pc - p->code));
+			if (level == ts.stateLevel && p == ts.stateProto && p->lineinfo && line == ts.stateLine)
+				return;
+
+			ts.state = State::None;
+			if (level != ts.stateLevel)
+				dumpFunctionInfo(L);
 
-			if (level < stateLevel) {
-				state = State::None;
+			// prefer the source line over disassembly when the file is available
+			Event event = frameEvent(EventKind::Step, p, pc);
+			if (formatSource(p, line, line, 0, event.text)) {
+				emit(event);
+				repl(L);
+				return;
+			}
+		} break;
 
+		case State::Finish: {
+			if (level < ts.stateLevel) {
+				ts.state = State::None;
 				const CallInfo* cip = L->ci + 1;
 				const Instruction* pc = cip->savedpc;
 				if (LUAU_INSN_OP(*pc) == LOP_RETURN) {
@@ -1133,9 +3493,9 @@ namespace ldbg {
 					else
 						count = rb - 1;
 
-					printf("returned " ANSI_YELLOW "%d" ANSI_RESET " value(s):\n", count);
+					print("returned " ANSI_YELLOW "%d" ANSI_RESET " value(s):\n", count);
 					for (int i = 0; i < count; i++)
-						printf(ANSI_GREY "  %d " ANSI_RESET "= %s\n", i + 1, lua_strprimitive(cip->base + ra + i).c_str());
+						print(ANSI_GREY "  %d " ANSI_RESET "= %s\n", i + 1, renderValue(cip->base + ra + i).c_str());
 				}
 			} else
 				return;
@@ -1145,8 +3505,10 @@ namespace ldbg {
 			break;
 		}
 
-		ldbg::idisasm(stdout, pc, cl->l.p);
-		putchar('\n');
+		Event event = frameEvent(EventKind::Step, cl->l.p, pc);
+		ldbg::idisasm(event.text, pc, cl->l.p);
+		event.text += '\n';
+		emit(event);
 
 		repl(L);
 	}
@@ -1156,20 +3518,46 @@ namespace ldbg {
 		if (cl->isC)
 			return;
 
-		printf("breakpoint hit in function '%s' at %s:" ANSI_YELLOW "%d\n" ANSI_RESET,
-			cl->l.p->debugname ? getstr(cl->l.p->debugname) : "??",
-			getSource(cl->l.p).c_str(), ar->currentline
-		);
-
 		const Instruction* pc = L->ci->savedpc - 1;
 
+		// the instruction under a breakpoint never reaches debugstep
+		if (!watchpoints.empty())
+			checkWatchpoints(L, cl->l.p, pc);
+
+		if (recorder.active() && !recorder.replaying())
+			recorder.record(L, cl->l.p, pc);
+
+		if (fastcalls.active())
+			fastcalls.onStep(L, cl->l.p, pc);
+		if (slots.active())
+			slots.onStep(L, cl->l.p, pc);
+		if (closures.active())
+			closures.onStep(L, cl->l.p, pc);
+
+		const Proto* p = cl->l.p;
+		for (const auto& bp : breakpoints) {
+			if (bp.p == p && bp.pc == (int)(pc - p->code) && bp.thread && bp.thread != L)
+				return;
+		}
+
+		Event event = frameEvent(EventKind::Breakpoint, cl->l.p, pc);
+		event.text = std::format("breakpoint hit in function '{}' at {}:" ANSI_YELLOW "{}\n" ANSI_RESET, event.function, event.source, ar->currentline);
+		emit(event);
+
 		if (!ar->userdata) {
-			ldbg::idisasm(stdout, pc, cl->l.p);
-			putchar('\n');
+			std::string insn;
+			ldbg::idisasm(insn, pc, cl->l.p);
+			print("%s\n", insn.c_str());
 
+			stopReason = "breakpoint";
 			repl(L);
-		} else
+		} else {
+			ThreadState& ts = threads[L];
+			ts.state = State::None;
+			ts.stepping = true;
+			L->singlestep = true;
 			debugstepActive = true;
+		}
 	}
 
 } // namespace ldbg
@@ -1,22 +1,41 @@
 #pragma once
 
+#include <deque>
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include <vector>
 #include <string>
 #include <cstdint>
+#include <unordered_map>
 
 #include <lua.h>
 #include <lstate.h>
 
+#include "stack.h"
+#include "heap.h"
+#include "record.h"
+#include "sites.h"
+#include "trace.h"
+#include "profile.h"
+#include "events.h"
+#include "checkpoint.h"
+#include "source.h"
+
 // to enable ANSI highlighting - predefine LDBG_ENABLE_HIGHLIGHTING
 
 struct Proto;
 
 namespace ldbg {
 
+	class DapServer;
+
 	enum class State {
 		None,
 		Finish,
-		StepOver
+		StepOver,
+		StepLine,
+		NextLine
 	};
 
 	struct Breakpoint {
@@ -25,6 +44,138 @@ namespace ldbg {
 		int pc;
 		bool enabled : 1;
 		uint32_t line : 31;
+
+		// only stops this thread when set
+		lua_State* thread;
+	};
+
+	struct Watchpoint {
+		enum class Kind {
+			Register,
+			Upvalue,
+			Field
+		};
+
+		Kind kind;
+		std::string expr;
+
+		lua_State* thread;
+		Closure* cl;
+		uint32_t level;
+		int index;
+
+		Table* table;
+		TString* key;
+
+		int ref;
+		int keyRef;
+
+		// the last value seen, anchored by valueRef so that its address can't be reused while it's compared against
+		TValue value;
+		int valueRef;
+		std::string rendered;
+	};
+
+	/// <summary>
+	/// Stops when the whole heap or a memory category grows past a threshold. Checked in the allocation hook against
+	/// the collector's own counters; the stop happens at the next instruction or safe point of the allocating thread
+	/// </summary>
+	struct MemoryBreakpoint {
+		std::string expr;
+
+		// -1 for the whole heap
+		int memcat;
+		size_t threshold;
+
+		// write a heap snapshot and continue instead of stopping
+		bool snapshot;
+		// fires once per crossing; re-armed when the counter is seen below the threshold again
+		bool above;
+	};
+
+	/// <summary>
+	/// View over a call frame of a stopped thread; only valid until execution resumes
+	/// </summary>
+	struct FrameView {
+		CallInfo* ci = nullptr;
+		uint32_t level = 0;
+
+		bool valid() const { return ci != nullptr; }
+
+		Closure* closure() const { return clvalue(ci->func); }
+		bool isC() const { return closure()->isC; }
+		Proto* proto() const { return isC() ? nullptr : closure()->l.p; }
+
+		/// <summary>
+		/// Index of the instruction being executed, or of the call for frames below the top
+		/// </summary>
+		int pc() const;
+		int line() const;
+
+		const TValue* reg(int index) const { return ci->base + index; }
+	};
+
+	/// <summary>
+	/// View over a local variable declared by a frame's function
+	/// </summary>
+	struct LocalView {
+		const LocVar* var;
+		const TValue* value;
+		bool active;
+
+		const char* name() const { return getstr(var->varname); }
+	};
+
+	/// <summary>
+	/// View over an upvalue of a frame's closure
+	/// </summary>
+	struct UpvalueView {
+		int index;
+		const TString* name;
+		const TValue* value;
+	};
+
+	/// <summary>
+	/// Stepping and watch bookkeeping of a thread; only threads that step or run under watchpoints get one
+	/// </summary>
+	struct ThreadState {
+		State state = State::None;
+		bool stepping = false;
+
+		uint32_t lastLevel = 0;
+		uint32_t stateLevel = 0;
+
+		const Proto* stateProto = nullptr;
+		int stateLine = 0;
+
+		std::vector<uint32_t> watchReturnLevels;
+		bool watchCheckNext = false;
+	};
+
+	/// <summary>
+	/// Runaway detection for top-level calls, driven by the interrupt hook so that singlestep can stay off
+	/// </summary>
+	struct Watchdog {
+		enum class Unit {
+			Instructions,
+			Milliseconds
+		};
+
+		Unit unit = Unit::Instructions;
+		// 0 while disarmed
+		uint64_t budget = 0;
+		// record a stack sample and continue instead of stopping
+		bool sample = false;
+
+		// the call being measured; a new one starts at the first safe point after its outermost frame returns
+		lua_State* thread = nullptr;
+		const Closure* entry = nullptr;
+		uint64_t instructions = 0;
+		uint32_t ticks = 0;
+		std::chrono::steady_clock::time_point start;
+
+		// most recent samples, oldest first
+		std::deque<std::string> samples;
 	};
 
 	class Debugger {
@@ -32,10 +183,29 @@ namespace ldbg {
 		struct Options {
 			lua_CFunction onError;
 
+			// called at every stop instead of the REPL; execution continues unless it steps
 			void (*debugbreak)(Debugger*, lua_State*, lua_Debug*);
 
 			FILE* in;
 			FILE* out;
+
+			// receives all output; when null it's buffered to out as plain text
+			EventSink* sink;
+
+			// never prompt; frame every stop and command with '@' lines and continue once the queue is empty
+			bool batch;
+
+			// leave singlestep off so scripts run at full speed; only breakpoints and pause requests stop them,
+			// and a thread that steps from a stop has singlestep on until its step ends
+			bool breakpointsOnly;
+
+			// record error stacks into a preallocated buffer instead of printing a traceback; they're reported in batches
+			bool captureErrors;
+
+			// write a postmortem file named <prefix>.<n>.json on every error instead of printing a traceback
+			const char* postmortem;
+			// abort the process once the postmortem is written instead of letting the call fail
+			bool postmortemAbort;
 		};
 
 		Options options;
@@ -49,6 +219,11 @@ namespace ldbg {
 		void attach(lua_State* L);
 		void detach(lua_State* L);
 
+		/// <summary>
+		/// Ends the checkpoint session. A run restarted from a checkpoint hands its status to the process the shell waits on
+		/// </summary>
+		void endCheckpoints(int status) { checkpoints.end(status); }
+
 		size_t setBreakpoint(lua_State* L, Proto* p, bool enable = true);
 		size_t setBreakpoint(lua_State* L, const std::string& source, uint32_t line, bool enable = true);
 		size_t setBreakpoint(lua_State* L, Proto* p, int pc, const std::string& source, uint32_t line, bool enable = true);
@@ -56,7 +231,137 @@ namespace ldbg {
 		bool removeBreakpoint(Proto* p, int pc);
 		void toggleBreakpoint(lua_State* L, size_t index);
 
+		bool deleteBreakpoint(size_t num);
+
 		const std::vector<Breakpoint>& getBreakpoints() const { return breakpoints; }
+		const std::vector<Watchpoint>& getWatchpoints() const { return watchpoints; }
+		const std::vector<MemoryBreakpoint>& getMemoryBreakpoints() const { return memoryBreakpoints; }
+
+		/// <summary>
+		/// Adds a memory breakpoint and installs the allocation hook
+		/// </summary>
+		/// <param name="memcat">Category to watch, or -1 for the whole heap</param>
+		/// <param name="snapshot">Write a heap snapshot and continue instead of stopping</param>
+		/// <returns>The memory breakpoint number</returns>
+		size_t setMemoryBreakpoint(lua_State* L, int memcat, size_t threshold, bool snapshot);
+		bool deleteMemoryBreakpoint(size_t num);
+		const std::vector<Proto*>& getLoadedProtos() const { return loadedProtos; }
+
+		/// <summary>
+		/// Requests a stop at the next safe point; safe to call from other threads and signal handlers
+		/// </summary>
+		void pause();
+
+		/// <summary>
+		/// Arms the watchdog, which checks every top-level call against a budget at loop back-edges, calls and returns
+		/// </summary>
+		/// <param name="budget">Estimated instructions or milliseconds; 0 disarms it</param>
+		/// <param name="sample">Record a stack sample and continue instead of stopping</param>
+		void setWatchdog(Watchdog::Unit unit, uint64_t budget, bool sample);
+		const Watchdog& getWatchdog() const { return watchdog; }
+
+		// the thread whose stop is being handled by the REPL or options.debugbreak, otherwise null
+		lua_State* getStoppedThread() const { return stoppedThread; }
+
+		// execution control while stopped; the last call wins once the stop handler returns
+		void resume();
+		void stepInstruction();
+		void stepOver(lua_State* L);
+		void stepLine(lua_State* L);
+		void nextLine(lua_State* L);
+		void stepOut(lua_State* L);
+
+		uint32_t getFrameCount(lua_State* L) const { return (uint32_t)(L->ci - L->base_ci); }
+
+		/// <summary>
+		/// Gets a view over a frame of a stopped thread
+		/// </summary>
+		/// <param name="level">0 for the innermost frame</param>
+		/// <returns>An invalid view if the level is out of range</returns>
+		FrameView getFrame(lua_State* L, uint32_t level) const;
+
+		const TValue* getConstant(const FrameView& frame, int index) const;
+		const TValue* getUpvalue(const FrameView& frame, int index) const;
+
+		template<typename F>
+		void forEachLocal(const FrameView& frame, F&& visit) const {
+			const Proto* p = frame.proto();
+			if (!p)
+				return;
+
+			const int pc = frame.pc();
+			for (int i = 0; i < p->sizelocvars; i++) {
+				const LocVar* local = &p->locvars[i];
+				visit(LocalView{ local, frame.reg(local->reg), pc >= local->startpc && pc < local->endpc });
+			}
+		}
+
+		template<typename F>
+		void forEachUpvalue(const FrameView& frame, F&& visit) const {
+			const Closure* cl = frame.closure();
+			const Proto* p = frame.proto();
+
+			for (int i = 0; i < cl->nupvalues; i++) {
+				const TString* name = p && i < p->sizeupvalues ? p->upvalues[i] : nullptr;
+				visit(UpvalueView{ i, name, getUpvalue(frame, i) });
+			}
+		}
+
+		/// <summary>
+		/// Records the stack of a failing thread without symbolizing it; reports the batch first if the buffer is full
+		/// </summary>
+		/// <param name="skip">Number of innermost frames to leave out, e.g. the error handler's</param>
+		void captureError(lua_State* L, const char* message, uint32_t skip = 0);
+
+		/// <summary>
+		/// Writes a postmortem of a failing thread to the next file of options.postmortem
+		/// </summary>
+		/// <param name="skip">Number of innermost frames to leave out, e.g. the error handler's</param>
+		void writePostmortem(lua_State* L, const char* message, uint32_t skip = 0);
+
+		/// <summary>
+		/// Symbolizes and prints the captured errors, grouping identical stacks, then clears them
+		/// </summary>
+		void reportErrors(lua_State* L);
+
+		/// <summary>
+		/// Gives a module a memory category of its own; allocations are charged to it while a thread runs with it active
+		/// </summary>
+		/// <param name="name">Module the category is named after; the same name gets the same category</param>
+		/// <returns>The category, or 0 (the default one) once all of them are taken</returns>
+		uint8_t tagMemcat(const std::string& name);
+		const std::vector<std::string>& getMemcatNames() const { return memcatNames; }
+
+		/// <summary>
+		/// Starts sampling the bytes of every memory category at collector steps
+		/// </summary>
+		void startMemoryTimeline(lua_State* L, size_t capacity, uint32_t intervalMs);
+
+		/// <summary>
+		/// Writes the memory timeline as CSV if the path ends in .csv, otherwise as JSON
+		/// </summary>
+		/// <returns>false if the file couldn't be opened</returns>
+		bool writeMemoryTimeline(const std::string& path);
+
+		// queued commands are consumed by the next stops before the input stream is read
+		void queueCommand(const std::string& command) { commandQueue.push_back(command); }
+		// stop commands run at the start of every stop
+		void addStopCommand(const std::string& command) { stopCommands.push_back(command); }
+
+		/// <summary>
+		/// Formats a log message; every complete line is emitted as its own event
+		/// </summary>
+		void print(const char* fmt, ...);
+
+		/// <summary>
+		/// Emits an event after any partial log line
+		/// </summary>
+		void emit(const Event& event);
+
+		/// <summary>
+		/// Emits any partial log line and flushes the sink
+		/// </summary>
+		void flushOutput();
 
 		void collect(Closure* cl) {
 			LUAU_ASSERT(!cl->isC);
@@ -66,23 +371,143 @@ namespace ldbg {
 	private:
 		friend void debugstep(lua_State* L, lua_Debug* ar);
 		friend void debugbreak(lua_State* L, lua_Debug* ar);
+		friend void userthread(lua_State* LP, lua_State* L);
+		friend void interrupt(lua_State* L, int gc);
 		friend void* frealloc(void* ud, void* ptr, size_t osize, size_t nsize);
+		friend void onallocate(lua_State* L, size_t osize, size_t nsize);
+		friend class DapServer;
 
 		std::vector<Proto*> loadedProtos;
 		std::vector<Breakpoint> breakpoints;
 
-		uint32_t lastLevel = 0;
-		uint32_t stateLevel = 0;
-		State state = State::None;
+		std::unordered_map<lua_State*, ThreadState> threads;
+		void (*oldUserthread)(lua_State* LP, lua_State* L) = nullptr;
+
+		// the interrupt hook is only installed while a request is pending, a watchdog, trace, profile, timeline or GC tuning
+		// is running, or collector breakpoints are set
+		global_State* vm = nullptr;
+		std::atomic<bool> pauseRequested = false;
+		void (*oldInterrupt)(lua_State* L, int gc) = nullptr;
+
+		// keep the interrupt hook installed while armed
+		Watchdog watchdog;
+		Tracer tracer;
+		Profiler profiler;
+		MemoryTimeline timeline;
 
+		// stops the next thread to run an instruction; set on attach
+		bool breakNext = true;
+		// filter applied to breakpoints created by the current break command
+		lua_State* breakpointThread = nullptr;
+
+		std::unordered_map<std::string, std::unique_ptr<SourceFile>> sourceFiles;
+
+		int evalEnv = LUA_NOREF;
+		// names bound to the stopped frame's locals and upvalues while an expression runs
+		int evalBindings = LUA_NOREF;
+		std::unordered_map<std::string, int> exprCache;
+		std::vector<std::string> displays;
+
+		std::deque<std::string> commandQueue;
+		std::vector<std::string> stopCommands;
+
+		std::vector<Watchpoint> watchpoints;
+
+		// the allocation hook is only installed while there are memory breakpoints
+		std::vector<MemoryBreakpoint> memoryBreakpoints;
+		void (*oldOnallocate)(lua_State* L, size_t osize, size_t nsize) = nullptr;
+		// memory breakpoint number crossed by the last allocation and the bytes it counted, 0 when none is pending
+		size_t memoryBreakHit = 0;
+		size_t memoryBreakBytes = 0;
+		uint32_t memorySnapshotCount = 0;
+
+		// collector states with a breakpoint, as bits
+		uint32_t gcBreakStates = 0;
+		// state entered last, and the one a breakpoint was hit on, -1 when none is pending
+		int lastGcState = -1;
+		int gcBreakHit = -1;
+
+		// observed at collector steps while gc tune runs the workload
+		bool gcTuning = false;
+		uint32_t gcCycles = 0;
+		size_t gcPeakBytes = 0;
+
+		// true while any thread needs attention on every instruction
 		bool debugstepActive = true;
+		lua_State* stoppedThread = nullptr;
+
+		std::unique_ptr<StackCapture> errorStacks;
+		Symbolizer symbolizer;
+		uint32_t postmortemCount = 0;
+
+		// indexed by memory category; empty for categories no module was tagged with
+		std::vector<std::string> memcatNames;
+
+		Checkpoints checkpoints;
+		Recorder recorder;
+		FastcallSites fastcalls;
+		SlotSites slots;
+		ClosureSites closures;
+
+		std::string pendingLog;
+		std::unique_ptr<ConsoleSink> console;
+
+		// set while a protocol client is attached; stops are reported to it instead of the prompt
+		DapServer* dap = nullptr;
+		const char* stopReason = "step";
 
 		size_t oldGCThreshold = 0;
 		lua_Alloc oldFrealloc = nullptr;
 
+		EventSink* getSink();
+
 		void collectProtos(Proto* root);
 		void dumpFunctionInfo(lua_State* L);
 
+		const SourceFile* getSourceFile(Proto* p);
+		bool formatSource(Proto* p, int first, int last, int current, std::string& out);
+		bool listSource(Proto* p, int first, int last, int current);
+
+		void beginLineStep(lua_State* L, State mode);
+		void updateStepping();
+
+		void requestInterrupt();
+		// restores the previous interrupt hook unless something still needs it
+		void releaseInterrupt();
+		bool interruptArmed() const { return watchdog.budget || tracer.active() || profiler.active() || timeline.active() || gcBreakStates || gcTuning; }
+		void interrupt(lua_State* L);
+		bool checkWatchdog(lua_State* L);
+
+		// breakpoints travel to restarted checkpoints as indices into loadedProtos, which only ever grows
+		std::string saveBreakpoints() const;
+		void restoreBreakpoints(lua_State* L, const std::string& saved);
+
+		// steps the recording back by an instruction, over calls or to the previous breakpoint
+		void reverseStep(lua_State* L, bool overCalls, bool toBreakpoint);
+
+		void onThreadDestroyed(lua_State* L);
+		lua_State* findThread(lua_State* L, uintptr_t address);
+		void listThreads(lua_State* L);
+
+		bool pushExpression(lua_State* L, const std::string& expr);
+		int evaluate(lua_State* L, const std::string& expr);
+		void showDisplays(lua_State* L);
+
+		const TValue* watchSlot(lua_State* L, const Watchpoint& wp);
+		bool checkWatchpoints(lua_State* L, Proto* p, const Instruction* pc);
+		void removeWatchpoint(lua_State* L, size_t index);
+
+		void updateAllocationHook();
+		// reports a pending memory breakpoint; true if the thread should stop
+		bool takeMemoryBreak(lua_State* L);
+
+		// follows collector state transitions for breakpoints and tuning
+		void noteGcState(lua_State* L);
+		bool takeGcBreak(lua_State* L);
+
+		// runs a workload under a grid of collector goals and step multipliers and reports the trade-offs
+		void tuneGc(lua_State* L, uint32_t runs, const std::string& expr);
+
 		void debugstep(lua_State* L, lua_Debug* ar);
 		void debugbreak(lua_State* L, lua_Debug* ar);
 
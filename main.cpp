@@ -1,4 +1,5 @@
 #include <format>
+#include <csignal>
 #include <fstream>
 #include <iostream>
 
@@ -8,17 +9,72 @@
 #include <lstate.h>
 #include <Luau/Compiler.h>
 
+#include "dap.h"
 #include "ldbg.h"
+#include "postmortem.h"
+
+static ldbg::Debugger* sigintTarget = nullptr;
+
+static void onSigint(int) {
+	// some platforms reset the handler once it runs
+	std::signal(SIGINT, onSigint);
+
+	if (ldbg::Debugger* dbg = sigintTarget)
+		dbg->pause();
+}
 
 int main(int argc, char** argv) {
 	if (argc < 2) {
-		printf("%s <file>", argv[0]);
+		printf("%s [--commands <file>] [--dap tcp:<port>|unix:<path>] [--events <file>] [--breakpoints-only] [--capture-errors] [--postmortem-on-error <prefix> [--abort-on-error]] [--memcat] [--memory-timeline <file>] <file>\n       %s --postmortem <file>\n", argv[0], argv[0]);
 		return 1;
 	}
 
 	std::string filename;
-	for (int i = 1; i < argc; i++)
-		filename += argv[i];
+	std::string commands;
+	std::string dapAddress;
+	std::string eventsPath;
+	bool breakpointsOnly = false;
+	bool captureErrors = false;
+	std::string postmortemPrefix;
+	bool abortOnError = false;
+	std::string postmortemPath;
+	bool memcat = false;
+	std::string timelinePath;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--commands") && i + 1 < argc)
+			commands = argv[++i];
+		else if (!strcmp(argv[i], "--dap") && i + 1 < argc)
+			dapAddress = argv[++i];
+		else if (!strcmp(argv[i], "--events") && i + 1 < argc)
+			eventsPath = argv[++i];
+		else if (!strcmp(argv[i], "--breakpoints-only"))
+			breakpointsOnly = true;
+		else if (!strcmp(argv[i], "--capture-errors"))
+			captureErrors = true;
+		else if (!strcmp(argv[i], "--postmortem-on-error") && i + 1 < argc)
+			postmortemPrefix = argv[++i];
+		else if (!strcmp(argv[i], "--abort-on-error"))
+			abortOnError = true;
+		else if (!strcmp(argv[i], "--postmortem") && i + 1 < argc)
+			postmortemPath = argv[++i];
+		else if (!strcmp(argv[i], "--memcat"))
+			memcat = true;
+		else if (!strcmp(argv[i], "--memory-timeline") && i + 1 < argc)
+			timelinePath = argv[++i];
+		else
+			filename += argv[i];
+	}
+
+	if (!postmortemPath.empty()) {
+		ldbg::PostmortemViewer viewer;
+		if (!viewer.load(postmortemPath)) {
+			puts("unable to read postmortem file");
+			return 1;
+		}
+
+		viewer.run(stdin, stdout);
+		return 0;
+	}
 
 	try {
 		lua_State* L = luaL_newstate();
@@ -48,20 +104,90 @@ int main(int argc, char** argv) {
 				1, // verbose coverage is stupid
 			}, {}, nullptr);
 
+		// outlives the debugger, which flushes into it on detach
+		std::unique_ptr<FILE, decltype(&fclose)> eventsFile(nullptr, fclose);
+		std::unique_ptr<ldbg::JsonLinesSink> eventsSink;
+		if (!eventsPath.empty()) {
+			FILE* file = nullptr;
+			if (fopen_s(&file, eventsPath.c_str(), "w") || !file) {
+				puts("unable to open events file");
+				return 1;
+			}
+
+			eventsFile.reset(file);
+			eventsSink = std::make_unique<ldbg::JsonLinesSink>(eventsFile.get());
+		}
+
 		ldbg::Debugger dbg;
+		dbg.options.sink = eventsSink.get();
+		dbg.options.breakpointsOnly = breakpointsOnly;
+		dbg.options.captureErrors = captureErrors;
+		dbg.options.postmortem = postmortemPrefix.empty() ? nullptr : postmortemPrefix.c_str();
+		dbg.options.postmortemAbort = abortOnError;
 		dbg.attach(L);
 
+		if (!timelinePath.empty())
+			dbg.startMemoryTimeline(L, 64 * 1024, 100);
+
+		// declared after the debugger so that it's torn down first
+		std::unique_ptr<ldbg::DapServer> dap;
+		if (!dapAddress.empty()) {
+			dap = std::make_unique<ldbg::DapServer>(dbg);
+			if (!dap->listen(dapAddress)) {
+				puts("unable to listen on the DAP address");
+				return 1;
+			}
+
+			printf("waiting for a DAP client on %s\n", dapAddress.c_str());
+			if (!dap->accept()) {
+				puts("unable to accept a DAP client");
+				return 1;
+			}
+		}
+
+		if (!commands.empty()) {
+			std::ifstream script(commands);
+			if (!script.is_open()) {
+				puts("unable to open command file");
+				return 1;
+			}
+
+			dbg.options.batch = true;
+
+			std::string line;
+			while (std::getline(script, line)) {
+				if (!line.empty() && line[0] != '#')
+					dbg.queueCommand(line);
+			}
+		}
+
+		// the script and everything it allocates is charged to its own category, libraries loaded later get theirs
+		if (memcat)
+			lua_setmemcat(L, dbg.tagMemcat(filename));
+
+		int status = 0;
 		lua_pushcfunction(L, dbg.options.onError, "");
 		if (!luau_load(L, std::format("@{}", filename).c_str(), src.data(), src.size(), 0)) {
 			dbg.collect(clvalue(L->top - 1));
 
-			lua_pcall(L, 0, 0, -2);
+			// ctrl+c breaks into the debugger instead of killing the process
+			sigintTarget = &dbg;
+			std::signal(SIGINT, onSigint);
+
+			status = lua_pcall(L, 0, 0, -2) == LUA_OK ? 0 : 1;
+
+			std::signal(SIGINT, SIG_DFL);
+			sigintTarget = nullptr;
+
+			if (!timelinePath.empty() && !dbg.writeMemoryTimeline(timelinePath))
+				puts("unable to write the memory timeline");
 		} else {
 			puts(lua_tostring(L, -1));
 			return 1;
 		}
 
-		return 0;
+		dbg.endCheckpoints(status);
+		return status;
 	} catch (const std::exception& e) {
 		std::cout << e.what();
 		return 1;
@@ -0,0 +1,355 @@
+#include "postmortem.h"
+
+#include <cstdarg>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <algorithm>
+
+#include <lgc.h>
+#include <lmem.h>
+#include <ltm.h>
+
+#include "ldbg.h"
+#include "style.h"
+#include "render.h"
+
+namespace ldbg {
+	// keeps a postmortem of a deep or wide stack from growing without bound
+	static constexpr uint32_t maxFrames = 64;
+	static constexpr int maxSlots = 256;
+	static constexpr int codeWindow = 12;
+
+	static constexpr RenderOptions postmortemRender = { 2, 8, 256 };
+
+	// the document is a FrameSource written out, so the viewer can read it back through the same interface
+	static Json captureFrame(const ThreadFrames& frames, uint32_t level) {
+		using Slot = FrameSource::Slot;
+
+		const FrameSource::Frame f = frames.frame(level);
+
+		Json frame = Json::makeObject()
+			.set("function", f.function)
+			.set("source", f.source);
+
+		if (f.c)
+			frame.set("c", true);
+		else {
+			frame.set("linedefined", f.linedefined);
+			frame.set("line", f.line);
+			frame.set("pc", f.pc);
+		}
+
+		Json registers = Json::makeArray();
+		for (int i = 0; i < std::min(frames.slotCount(level, Slot::Register), maxSlots); i++)
+			registers.push(stripAnsi(frames.value(level, Slot::Register, i, postmortemRender)));
+		frame.set("registers", std::move(registers));
+
+		Json locals = Json::makeArray();
+		for (const auto& local : frames.locals(level)) {
+			locals.push(Json::makeObject()
+				.set("name", local.name)
+				.set("reg", local.reg)
+				.set("active", local.active));
+		}
+		frame.set("locals", std::move(locals));
+
+		Json upvalues = Json::makeArray();
+		for (int i = 0; i < frames.slotCount(level, Slot::Upvalue); i++) {
+			upvalues.push(Json::makeObject()
+				.set("name", frames.upvalueName(level, i))
+				.set("value", stripAnsi(frames.value(level, Slot::Upvalue, i, postmortemRender))));
+		}
+		frame.set("upvalues", std::move(upvalues));
+
+		if (!f.c) {
+			Json constants = Json::makeArray();
+			for (int i = 0; i < std::min(frames.slotCount(level, Slot::Constant), maxSlots); i++)
+				constants.push(stripAnsi(frames.value(level, Slot::Constant, i, postmortemRender)));
+			frame.set("constants", std::move(constants));
+
+			std::vector<FrameSource::Insn> insns;
+			frames.code(level, "", insns);
+
+			Json code = Json::makeArray();
+			for (const auto& insn : insns) {
+				if (insn.pc >= f.pc - codeWindow && insn.pc <= f.pc + codeWindow)
+					code.push(Json::makeObject()
+						.set("pc", insn.pc)
+						.set("line", insn.line)
+						.set("text", stripAnsi(insn.text)));
+			}
+			frame.set("code", std::move(code));
+		}
+		return frame;
+	}
+
+	// protos and upvalues live on the heap too but have no entry in luaT_typenames
+	static const char* heapTypeName(int tt) {
+		if (tt < LUA_T_COUNT)
+			return luaT_typenames[tt];
+		return tt == LUA_TPROTO ? "proto" : tt == LUA_TUPVAL ? "upvalue" : "?";
+	}
+
+	static Json captureHeap(lua_State* L) {
+		global_State* g = L->global;
+
+		struct Context {
+			uint32_t count[LUA_TDEADKEY + 1];
+			size_t bytes[LUA_TDEADKEY + 1];
+		};
+
+		Context ctx = {};
+		luaM_visitgco(L, &ctx, [](void* _ctx, lua_Page* page, GCObject* gco) -> bool {
+			Context* ctx = (Context*)_ctx;
+
+			int pageBlocks, busyBlocks, blockSize, pageSize;
+			luaM_getpageinfo(page, &pageBlocks, &busyBlocks, &blockSize, &pageSize);
+
+			ctx->count[gco->gch.tt]++;
+			ctx->bytes[gco->gch.tt] += blockSize;
+			return false;
+		});
+
+		Json types = Json::makeArray();
+		for (int tt = 0; tt <= LUA_TDEADKEY; tt++) {
+			if (ctx.count[tt])
+				types.push(Json::makeObject()
+					.set("type", heapTypeName(tt))
+					.set("count", (double)ctx.count[tt])
+					.set("bytes", (double)ctx.bytes[tt]));
+		}
+
+		Json memcats = Json::makeArray();
+		for (int i = 0; i < LUA_MEMORY_CATEGORIES; i++) {
+			if (g->memcatbytes[i])
+				memcats.push(Json::makeObject()
+					.set("memcat", i)
+					.set("bytes", (double)g->memcatbytes[i]));
+		}
+
+		return Json::makeObject()
+			.set("totalBytes", (double)g->totalbytes)
+			.set("threshold", (double)g->GCthreshold)
+			.set("gcState", (int)g->gcstate)
+			.set("types", std::move(types))
+			.set("memcats", std::move(memcats));
+	}
+
+	Json capturePostmortem(const Debugger& dbg, lua_State* L, const char* message, uint32_t skip) {
+		Json frames = Json::makeArray();
+
+		const ThreadFrames thread(dbg, L);
+		const uint32_t count = thread.frameCount();
+		for (uint32_t level = skip; level < count && level - skip < maxFrames; level++)
+			frames.push(captureFrame(thread, level));
+
+		return Json::makeObject()
+			.set("postmortem", 1)
+			.set("error", message ? message : "")
+			.set("frameCount", (int)(count > skip ? count - skip : 0))
+			.set("frames", std::move(frames))
+			.set("heap", captureHeap(L));
+	}
+
+	const Json& SnapshotFrames::at(uint32_t level) const {
+		static const Json none;
+
+		const auto& frames = doc["frames"].array;
+		return level < frames.size() ? frames[level] : none;
+	}
+
+	const std::vector<Json>& SnapshotFrames::slots(uint32_t level, Slot slot) const {
+		return at(level)[slot == Slot::Register ? "registers" : slot == Slot::Constant ? "constants" : "upvalues"].array;
+	}
+
+	FrameSource::Frame SnapshotFrames::frame(uint32_t level) const {
+		const Json& f = at(level);
+
+		Frame frame;
+		frame.function = f["function"].string;
+		frame.source = f["source"].string;
+		frame.linedefined = f["linedefined"].integer();
+		frame.line = f["line"].integer();
+		frame.pc = f["pc"].integer();
+		frame.c = f["c"].truthy();
+		return frame;
+	}
+
+	std::vector<FrameSource::Local> SnapshotFrames::locals(uint32_t level) const {
+		std::vector<Local> locals;
+		for (const Json& local : at(level)["locals"].array)
+			locals.push_back({ local["name"].string, local["reg"].integer(), local["active"].truthy() });
+		return locals;
+	}
+
+	std::string SnapshotFrames::upvalueName(uint32_t level, int index) const {
+		const auto& upvalues = slots(level, Slot::Upvalue);
+		return index >= 0 && (size_t)index < upvalues.size() ? upvalues[index]["name"].string : "";
+	}
+
+	int SnapshotFrames::slotCount(uint32_t level, Slot slot) const {
+		return (int)slots(level, slot).size();
+	}
+
+	std::string SnapshotFrames::value(uint32_t level, Slot slot, int index, const RenderOptions& options) const {
+		const auto& values = slots(level, slot);
+		if (index < 0 || (size_t)index >= values.size())
+			return "?";
+
+		return (slot == Slot::Upvalue ? values[index]["value"] : values[index]).string;
+	}
+
+	bool SnapshotFrames::code(uint32_t level, const std::string& function, std::vector<Insn>& out) const {
+		const Json* f = &at(level);
+		if (!function.empty()) {
+			f = nullptr;
+			for (const Json& frame : doc["frames"].array) {
+				if (!frame["c"].truthy() && frame["function"].string == function) {
+					f = &frame;
+					break;
+				}
+			}
+
+			if (!f)
+				return false;
+		}
+
+		for (const Json& insn : (*f)["code"].array)
+			out.push_back({ insn["pc"].integer(), insn["line"].integer(), insn["text"].string });
+		return true;
+	}
+
+	bool PostmortemViewer::load(const std::string& path) {
+		std::ifstream file(path, std::ios::binary);
+		if (!file.is_open())
+			return false;
+
+		const std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		if (!Json::parse(text, doc) || doc["postmortem"].integer() != 1)
+			return false;
+
+		return doc["frames"].type == Json::Type::Array && !doc["frames"].array.empty();
+	}
+
+	void PostmortemViewer::print(const char* fmt, ...) {
+		va_list args;
+		va_start(args, fmt);
+		const int n = vsnprintf(nullptr, 0, fmt, args);
+		va_end(args);
+
+		if (n <= 0)
+			return;
+
+		Event event;
+		event.text.resize(n + 1);
+
+		va_start(args, fmt);
+		vsnprintf(event.text.data(), n + 1, fmt, args);
+		va_end(args);
+
+		event.text.resize(n);
+		console->emit(event);
+	}
+
+	// reads a line without its terminator; false once the input ends
+	static bool readLine(FILE* in, std::string& line) {
+		line.clear();
+
+		char buf[256];
+		while (fgets(buf, sizeof(buf), in)) {
+			line += buf;
+			if (line.back() == '\n') {
+				line.pop_back();
+				if (!line.empty() && line.back() == '\r')
+					line.pop_back();
+				return true;
+			}
+		}
+		return !line.empty();
+	}
+
+	void PostmortemViewer::run(FILE* in, FILE* out) {
+		console = std::make_unique<ConsoleSink>(out);
+
+		Inspector inspector(frames, [this](const std::string& text) { print("%s", text.c_str()); });
+
+		print(ANSI_RED "%s\n" ANSI_RESET, doc["error"].string.c_str());
+		print("postmortem of %d frames, %u captured\n", doc["frameCount"].integer(), frames.frameCount());
+
+		std::string line;
+		while (true) {
+			print(ANSI_RESET "(ldbg-postmortem) ");
+			console->flush();
+			if (!readLine(in, line))
+				break;
+
+			if (line.empty())
+				continue;
+
+			std::istringstream ss(line);
+			std::string cmd;
+			ss >> cmd;
+
+			if (cmd == "quit" || cmd == "q")
+				break;
+			else if (cmd == "bt" || cmd == "backtrace")
+				inspector.backtrace();
+			else if (cmd == "frame" || cmd == "f") {
+				uint32_t num = 0;
+				if (!(ss >> num) || num < 1 || num > frames.frameCount()) {
+					print("usage: frame <1-%u>\n", frames.frameCount());
+					continue;
+				}
+				inspector.current = num - 1;
+			}
+			else if (cmd == "up" || cmd == "down") {
+				if (cmd == "up" && inspector.current + 1 < frames.frameCount())
+					inspector.current++;
+				else if (cmd == "down" && inspector.current > 0)
+					inspector.current--;
+				else
+					print("no more frames\n");
+			}
+			else if (cmd == "inspect" || cmd == "i") {
+				std::string what;
+				ss >> std::ws;
+				std::getline(ss, what);
+				inspector.inspect(what);
+			}
+			else if (cmd == "disasm") {
+				std::string func;
+				ss >> std::ws;
+				std::getline(ss, func);
+				inspector.disasm(func);
+			}
+			else if (cmd == "gc") {
+				const Json& heap = doc["heap"];
+				print("total bytes allocated: " ANSI_YELLOW "%.0f\n" ANSI_RESET, heap["totalBytes"].number);
+				print("threshold: " ANSI_YELLOW "%.0f\n" ANSI_RESET, heap["threshold"].number);
+
+				print("%-10s %-10s %s\n" ANSI_GREY "---------- ---------- ----------\n" ANSI_RESET, "type", "count", "bytes");
+				for (const Json& type : heap["types"].array)
+					print("%-10s %-10.0f %.0f\n", type["type"].string.c_str(), type["count"].number, type["bytes"].number);
+
+				for (const Json& memcat : heap["memcats"].array)
+					print("memcat " ANSI_YELLOW "%d" ANSI_RESET ": %.0f bytes\n", memcat["memcat"].integer(), memcat["bytes"].number);
+			}
+			else if (cmd == "help") {
+				print("%s", Inspector::help);
+				print(
+					"  f, frame <num>        - select a frame\n"
+					"  up, down              - select the caller or the callee\n"
+					"  gc                    - show the heap summary\n"
+					"  quit, q               - quit\n"
+					"values were rendered when the postmortem was written, so render options have no effect and\n"
+					"disasm only shows the instructions around each frame's pc\n"
+				);
+			}
+			else
+				print("unknown command; values were rendered when the postmortem was written, so expressions can't be evaluated\n");
+		}
+
+		console->flush();
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+
+#include <lstate.h>
+
+#include "json.h"
+#include "events.h"
+#include "inspect.h"
+
+namespace ldbg {
+	class Debugger;
+
+	/// <summary>
+	/// Snapshots a failing thread into a self-contained document: every frame's registers, locals, upvalues,
+	/// constants and the instructions around its pc, plus a heap summary. Values are rendered with bounded depth
+	/// </summary>
+	/// <param name="message">Error message to record; may be null</param>
+	/// <param name="skip">Number of innermost frames to leave out, e.g. the error handler's</param>
+	Json capturePostmortem(const Debugger& dbg, lua_State* L, const char* message, uint32_t skip = 0);
+
+	/// <summary>
+	/// Frames of a parsed postmortem document
+	/// </summary>
+	class SnapshotFrames : public FrameSource {
+	public:
+		explicit SnapshotFrames(const Json& doc) : doc(doc) {}
+
+		uint32_t frameCount() const override { return (uint32_t)doc["frames"].array.size(); }
+		Frame frame(uint32_t level) const override;
+
+		std::vector<Local> locals(uint32_t level) const override;
+		std::string upvalueName(uint32_t level, int index) const override;
+
+		int slotCount(uint32_t level, Slot slot) const override;
+		std::string value(uint32_t level, Slot slot, int index, const RenderOptions& options) const override;
+
+		/// <summary>
+		/// Only the instructions around the pc are saved; a named function is looked up among the saved frames
+		/// </summary>
+		bool code(uint32_t level, const std::string& function, std::vector<Insn>& out) const override;
+
+	private:
+		const Json& doc;
+
+		const Json& at(uint32_t level) const;
+		const std::vector<Json>& slots(uint32_t level, Slot slot) const;
+	};
+
+	/// <summary>
+	/// Offline viewer that answers the REPL's inspection commands from a postmortem file
+	/// </summary>
+	class PostmortemViewer {
+	public:
+		/// <summary>
+		/// Reads and parses a postmortem file
+		/// </summary>
+		/// <returns>false if the file can't be read or isn't a postmortem</returns>
+		bool load(const std::string& path);
+
+		/// <summary>
+		/// Runs the prompt until the input ends or the user quits
+		/// </summary>
+		void run(FILE* in, FILE* out);
+
+	private:
+		Json doc;
+		SnapshotFrames frames{ doc };
+
+		std::unique_ptr<ConsoleSink> console;
+
+		void print(const char* fmt, ...);
+	};
+}
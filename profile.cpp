@@ -0,0 +1,125 @@
+#include "profile.h"
+
+#include <chrono>
+#include <algorithm>
+
+#include <ldebug.h>
+
+#include "trace.h"
+
+namespace ldbg {
+	uint64_t Profiler::now() {
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	void Profiler::start() {
+		stacks.clear();
+		lastThread = nullptr;
+		lastStack = nullptr;
+
+		ids.clear();
+		profiles.clear();
+
+		overheadNs = 0;
+		interrupts = 0;
+		running = true;
+	}
+
+	void Profiler::stop() {
+		if (!running)
+			return;
+
+		const uint64_t ns = now() - overheadNs;
+		for (auto& [thread, stack] : stacks) {
+			while (!stack.frames.empty())
+				exit(stack, ns);
+		}
+
+		stacks.clear();
+		lastThread = nullptr;
+		lastStack = nullptr;
+		running = false;
+	}
+
+	uint32_t Profiler::functionOf(const Closure* cl) {
+		const void* key = cl->isC ? (const void*)cl->c.f : (const void*)cl->l.p;
+
+		auto [it, inserted] = ids.try_emplace(key, (uint32_t)profiles.size());
+		if (inserted) {
+			FunctionProfile& profile = profiles.emplace_back();
+			if (cl->isC) {
+				profile.p = nullptr;
+				profile.name = cl->c.debugname ? cl->c.debugname : "??";
+				profile.source = "[C]";
+				profile.line = -1;
+			} else {
+				const Proto* p = cl->l.p;
+				char ss[LUA_IDSIZE];
+				profile.p = p;
+				profile.name = p->debugname ? getstr(p->debugname) : "??";
+				profile.source = luaO_chunkid(ss, sizeof(ss), getstr(p->source), p->source->len);
+				profile.line = p->linedefined;
+			}
+			profile.calls = profile.inclusiveNs = profile.exclusiveNs = 0;
+		}
+		return it->second;
+	}
+
+	void Profiler::enter(Stack& stack, const Closure* cl, uint32_t level, uint64_t ns) {
+		const uint32_t function = functionOf(cl);
+		profiles[function].calls++;
+
+		if (function >= stack.active.size())
+			stack.active.resize(profiles.size());
+		stack.active[function]++;
+
+		stack.frames.push_back({ cl, level, function, ns, 0 });
+	}
+
+	void Profiler::exit(Stack& stack, uint64_t ns) {
+		const Frame frame = stack.frames.back();
+		stack.frames.pop_back();
+
+		const uint64_t elapsed = ns - frame.start;
+
+		FunctionProfile& profile = profiles[frame.function];
+		profile.exclusiveNs += elapsed - std::min(elapsed, frame.children);
+		if (--stack.active[frame.function] == 0)
+			profile.inclusiveNs += elapsed;
+
+		if (!stack.frames.empty())
+			stack.frames.back().children += elapsed;
+	}
+
+	void Profiler::onInterrupt(lua_State* L) {
+		const uint64_t entered = now();
+		const uint64_t ns = entered - overheadNs;
+		interrupts++;
+
+		if (L != lastThread) {
+			lastThread = L;
+			lastStack = &stacks[L];
+		}
+
+		Stack& stack = *lastStack;
+		followCalls(L, stack.frames,
+			[&](const Closure* cl, uint32_t level) { enter(stack, cl, level, ns); },
+			[&]() { exit(stack, ns); });
+
+		overheadNs += now() - entered;
+	}
+
+	void Profiler::onThreadDestroyed(lua_State* L) {
+		auto it = stacks.find(L);
+		if (it == stacks.end())
+			return;
+
+		const uint64_t ns = now() - overheadNs;
+		while (!it->second.frames.empty())
+			exit(it->second, ns);
+
+		stacks.erase(it);
+		lastThread = nullptr;
+		lastStack = nullptr;
+	}
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+
+#include <lua.h>
+#include <lstate.h>
+
+namespace ldbg {
+	struct FunctionProfile {
+		// null for C functions
+		const Proto* p;
+		std::string name;
+		std::string source;
+		int line;
+
+		uint64_t calls;
+		uint64_t inclusiveNs;
+		uint64_t exclusiveNs;
+	};
+
+	/// <summary>
+	/// Deterministic profiler counting calls and inclusive and exclusive time per proto and C function.
+	/// It follows calls through the interrupt hook like the tracer, and keeps its own cost out of the
+	/// measurements by running on a clock that stops while the hook runs
+	/// </summary>
+	class Profiler {
+	public:
+		bool active() const { return running; }
+
+		/// <summary>
+		/// Discards the previous profile and starts a new one
+		/// </summary>
+		void start();
+
+		/// <summary>
+		/// Closes the frames that are still open and stops counting; the profile is kept until the next start
+		/// </summary>
+		void stop();
+
+		void onInterrupt(lua_State* L);
+		void onThreadDestroyed(lua_State* L);
+
+		const std::vector<FunctionProfile>& functions() const { return profiles; }
+
+		// total time spent in the hook, which the measurements leave out
+		uint64_t getOverheadNs() const { return overheadNs; }
+		uint64_t getInterrupts() const { return interrupts; }
+
+	private:
+		struct Frame {
+			const Closure* cl;
+			uint32_t level;
+			uint32_t function;
+
+			uint64_t start;
+			// inclusive time of the calls made from this frame
+			uint64_t children;
+		};
+
+		struct Stack {
+			std::vector<Frame> frames;
+
+			// activations per function on this thread; only the outermost one adds to the inclusive time of recursive functions
+			std::vector<uint32_t> active;
+		};
+
+		bool running = false;
+
+		std::unordered_map<lua_State*, Stack> stacks;
+		lua_State* lastThread = nullptr;
+		Stack* lastStack = nullptr;
+
+		// keyed by proto for Luau functions and by function pointer for C functions
+		std::unordered_map<const void*, uint32_t> ids;
+		std::vector<FunctionProfile> profiles;
+
+		uint64_t overheadNs = 0;
+		uint64_t interrupts = 0;
+
+		static uint64_t now();
+
+		uint32_t functionOf(const Closure* cl);
+
+		void enter(Stack& stack, const Closure* cl, uint32_t level, uint64_t ns);
+		void exit(Stack& stack, uint64_t ns);
+	};
+}
@@ -0,0 +1,250 @@
+#include "record.h"
+
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+
+#include <lgc.h>
+#include <ltable.h>
+#include <Luau/Bytecode.h>
+
+#include "disasm.h"
+
+namespace ldbg {
+	// registers logged for calls whose result count is only known once they return
+	static constexpr int multretSlots = 8;
+
+	void Recorder::start(lua_State* L, size_t capacity) {
+		stop(L);
+
+		capacity = std::clamp<size_t>(capacity, 1024, 1 << 24);
+		entries.assign(capacity, {});
+
+		lua_createtable(L, (int)(capacity * 4), 0);
+		slots = hvalue(L->top - 1);
+		anchor = lua_ref(L, -1);
+		lua_pop(L, 1);
+
+		head = count = cursor = 0;
+		stepsBack = 0;
+		instructions = logged = samples = 0;
+		sampledNanos = 0;
+	}
+
+	void Recorder::stop(lua_State* L) {
+		if (!active())
+			return;
+
+		toPresent(L);
+
+		lua_unref(L, anchor);
+		anchor = LUA_NOREF;
+		slots = nullptr;
+
+		entries.clear();
+		entries.shrink_to_fit();
+		head = count = 0;
+	}
+
+	void Recorder::log(lua_State* L, Proto* p, int pc, Entry::Kind kind, uint32_t index, const TValue* value, const TValue* owner, const TValue* key, bool& first) {
+		entries[head] = { p, L, pc, (uint32_t)(L->ci - L->base_ci), index, kind, first };
+
+		TValue* slot = &slots->array[head * 4];
+		auto keep = [&](TValue* dst, const TValue* src) {
+			if (src) {
+				setobj2t(L, dst, src);
+				luaC_barriert(L, slots, src);
+			} else
+				setnilvalue(dst);
+		};
+
+		keep(slot, value);
+		keep(slot + 1, owner);
+		keep(slot + 2, key);
+		// keeps the proto alive for as long as the position is shown
+		keep(slot + 3, first ? L->ci->func : nullptr);
+
+		first = false;
+		head = (head + 1) % entries.size();
+		if (count < entries.size())
+			count++;
+		logged++;
+	}
+
+	void Recorder::record(lua_State* L, Proto* p, const Instruction* pc) {
+		// timing every instruction would cost more than logging it
+		const bool sample = (instructions++ & 4095) == 0;
+		const auto begin = sample ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+
+		const int at = (int)(pc - p->code);
+		const Instruction insn = *pc;
+		StkId base = L->ci->base;
+
+		TValue thread;
+		setthvalue(L, &thread, L);
+
+		bool first = true;
+		auto logRegisters = [&](int reg, int n) {
+			n = std::min(n, (int)p->maxstacksize - reg);
+			for (int i = 0; i < n; i++)
+				log(L, p, at, Entry::Kind::Register, (uint32_t)(base + reg + i - L->stack), base + reg + i, &thread, nullptr, first);
+		};
+
+		// luaH_set raises on nil and NaN keys, and undoing the write goes through it; such stores fail anyway
+		auto logField = [&](const TValue* t, const TValue* key) {
+			if (ttistable(t) && !ttisnil(key) && !(ttisnumber(key) && std::isnan(nvalue(key))))
+				log(L, p, at, Entry::Kind::Field, 0, luaH_get(hvalue(t), key), t, key, first);
+		};
+
+		uint8_t op = LUAU_INSN_OP(insn);
+		if (op == LOP_BREAK && p->debuginsn)
+			op = p->debuginsn[at];
+
+		const InsnWrites w = decodeWrites(p, pc);
+		switch (op) {
+		case LOP_FORGLOOP:
+			// the control variable and the loop variables
+			logRegisters(w.reg + 2, (pc[1] & 0xff) + 1);
+			break;
+
+		case LOP_CALL: {
+			const int c = LUAU_INSN_C(insn);
+			logRegisters(w.reg, c ? c - 1 : multretSlots);
+		} break;
+
+		case LOP_FASTCALL:
+		case LOP_FASTCALL1:
+		case LOP_FASTCALL2:
+		case LOP_FASTCALL2K:
+		case LOP_FASTCALL3: {
+			// a fast call that succeeds writes the results of the call it skips
+			if (const Instruction* call = fastcallFallback(p, pc)) {
+				const int c = LUAU_INSN_C(*call);
+				logRegisters(LUAU_INSN_A(*call), c ? c - 1 : multretSlots);
+			}
+		} break;
+
+		case LOP_SETUPVAL: {
+			TValue* uv = &clvalue(L->ci->func)->l.uprefs[w.upval];
+			log(L, p, at, Entry::Kind::Upvalue, w.upval, ttisupval(uv) ? upvalue(uv)->v : uv, L->ci->func, nullptr, first);
+		} break;
+
+		case LOP_SETGLOBAL: {
+			TValue env;
+			sethvalue(L, &env, clvalue(L->ci->func)->env);
+			logField(&env, &p->k[pc[1]]);
+		} break;
+
+		case LOP_SETTABLE:
+			logField(base + w.table, base + LUAU_INSN_C(insn));
+			break;
+
+		case LOP_SETTABLEKS:
+			logField(base + w.table, &p->k[pc[1]]);
+			break;
+
+		case LOP_SETTABLEN: {
+			TValue key;
+			setnvalue(&key, LUAU_INSN_C(insn) + 1);
+			logField(base + w.table, &key);
+		} break;
+
+		case LOP_SETLIST: {
+			// only the count of constructors ending in a call isn't known up front; those are skipped
+			const int c = LUAU_INSN_C(insn);
+			for (int i = 0; i < std::min(c - 1, 256); i++) {
+				TValue key;
+				setnvalue(&key, (double)(pc[1] + i));
+				logField(base + w.table, &key);
+			}
+		} break;
+
+		default:
+			if (w.count)
+				logRegisters(w.reg, w.count);
+			break;
+		}
+
+		// instructions that write nothing still mark a position to step back to
+		if (first)
+			log(L, p, at, Entry::Kind::None, 0, nullptr, nullptr, nullptr, first);
+
+		if (sample) {
+			sampledNanos += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+			samples++;
+		}
+	}
+
+	const Recorder::Entry* Recorder::undo(lua_State* L) {
+		// an instruction whose first entry was overwritten can't be undone as a whole
+		size_t n = 1;
+		while (cursor + n <= count && !at(count - cursor - n).first)
+			n++;
+
+		if (cursor + n > count)
+			return nullptr;
+
+		for (size_t i = 0; i < n; i++) {
+			swap(L, count - 1 - cursor);
+			cursor++;
+		}
+
+		stepsBack++;
+		return &at(count - cursor);
+	}
+
+	void Recorder::toPresent(lua_State* L) {
+		// swapping is its own inverse, so redoing walks the undone entries oldest first
+		while (cursor) {
+			swap(L, count - cursor);
+			cursor--;
+		}
+		stepsBack = 0;
+	}
+
+	void Recorder::swap(lua_State* L, size_t logical) {
+		const size_t i = physical(logical);
+		const Entry& e = entries[i];
+
+		TValue* saved = &slots->array[i * 4];
+		const TValue* owner = saved + 1;
+
+		TValue* target = nullptr;
+		switch (e.kind) {
+		case Entry::Kind::None:
+			return;
+
+		case Entry::Kind::Register: {
+			lua_State* th = thvalue(owner);
+			if ((int)e.index >= th->stacksize)
+				return;
+
+			luaC_threadbarrier(th);
+			target = th->stack + e.index;
+		} break;
+
+		case Entry::Kind::Upvalue: {
+			Closure* cl = clvalue(owner);
+			TValue* uv = &cl->l.uprefs[e.index];
+			if (ttisupval(uv)) {
+				target = upvalue(uv)->v;
+				luaC_barrier(L, upvalue(uv), saved);
+			} else {
+				target = uv;
+				luaC_barrier(L, cl, saved);
+			}
+		} break;
+
+		case Entry::Kind::Field: {
+			Table* h = hvalue(owner);
+			target = luaH_set(L, h, saved + 2);
+			luaC_barriert(L, h, saved);
+		} break;
+		}
+
+		const TValue current = *target;
+		setobj(L, target, saved);
+		setobj2t(L, saved, &current);
+		luaC_barriert(L, slots, &current);
+	}
+}
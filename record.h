@@ -0,0 +1,114 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <lua.h>
+#include <lstate.h>
+
+namespace ldbg {
+	/// <summary>
+	/// Undo log of executed instructions kept in a bounded ring. Before an instruction runs, every slot it may
+	/// overwrite is saved: registers, upvalues and table fields. Replaying the log backward swaps the saved values
+	/// back into the VM, and replaying it forward swaps them out again, so the live state can always be restored.
+	/// Saved values and their owners are anchored in a preallocated table so the collector keeps them alive
+	/// </summary>
+	class Recorder {
+	public:
+		struct Entry {
+			enum class Kind : uint8_t {
+				None,
+				Register,
+				Upvalue,
+				Field
+			};
+
+			Proto* p;
+			lua_State* thread;
+			int pc;
+			uint32_t level;
+
+			// stack slot for registers, upvalue index for upvalues
+			uint32_t index;
+			Kind kind;
+
+			// first entry logged for its instruction
+			bool first;
+		};
+
+		bool active() const { return anchor != LUA_NOREF; }
+		bool replaying() const { return cursor != 0; }
+
+		/// <summary>
+		/// Starts a recording, allocating everything it will need up front
+		/// </summary>
+		/// <param name="capacity">Number of entries kept; instructions need one per slot they overwrite</param>
+		void start(lua_State* L, size_t capacity);
+
+		/// <summary>
+		/// Returns to the live state and releases the log
+		/// </summary>
+		void stop(lua_State* L);
+
+		/// <summary>
+		/// Logs what the instruction about to run may overwrite
+		/// </summary>
+		void record(lua_State* L, Proto* p, const Instruction* pc);
+
+		/// <summary>
+		/// Undoes the most recent instruction that's still applied
+		/// </summary>
+		/// <returns>The first entry of the undone instruction, or null at the start of the log</returns>
+		const Entry* undo(lua_State* L);
+
+		/// <summary>
+		/// Reapplies every undone instruction
+		/// </summary>
+		void toPresent(lua_State* L);
+
+		/// <summary>
+		/// Gets the first entry of the most recently undone instruction, which is where replay stands
+		/// </summary>
+		const Entry* position() { return cursor ? &at(count - cursor) : nullptr; }
+
+		// instructions undone since the present
+		uint64_t getStepsBack() const { return stepsBack; }
+
+		size_t size() const { return count; }
+		size_t capacity() const { return entries.size(); }
+
+		uint64_t getInstructions() const { return instructions; }
+		uint64_t getEntriesLogged() const { return logged; }
+
+		// ring and anchor bytes per entry
+		static size_t entryBytes() { return sizeof(Entry) + 4 * sizeof(TValue); }
+
+		/// <summary>
+		/// Average time spent logging an instruction, measured on a sample of them
+		/// </summary>
+		double getNanosPerInstruction() const { return samples ? sampledNanos / samples : 0; }
+
+	private:
+		std::vector<Entry> entries;
+		size_t head = 0;
+		size_t count = 0;
+		// entries undone, counted from the newest one
+		size_t cursor = 0;
+		uint64_t stepsBack = 0;
+
+		// 4 slots per entry: saved value, owner (thread, closure or table), key, running closure
+		int anchor = LUA_NOREF;
+		Table* slots = nullptr;
+
+		uint64_t instructions = 0;
+		uint64_t logged = 0;
+		double sampledNanos = 0;
+		uint64_t samples = 0;
+
+		Entry& at(size_t logical) { return entries[(head + entries.size() - count + logical) % entries.size()]; }
+		size_t physical(size_t logical) const { return (head + entries.size() - count + logical) % entries.size(); }
+
+		void log(lua_State* L, Proto* p, int pc, Entry::Kind kind, uint32_t index, const TValue* value, const TValue* owner, const TValue* key, bool& first);
+		void swap(lua_State* L, size_t logical);
+	};
+}
@@ -0,0 +1,187 @@
+#include "render.h"
+
+#include <format>
+#include <vector>
+#include <algorithm>
+
+#include <ltable.h>
+
+namespace ldbg {
+	extern std::string lua_strprimitive(const TValue* o);
+
+	struct ValueRenderer {
+		const RenderOptions& options;
+		std::string out;
+		std::vector<const Table*> path;
+
+		bool full() const {
+			return out.size() >= options.bytes;
+		}
+
+		void value(const TValue* o, uint32_t depth, uint32_t from);
+		void key(const TValue* k);
+		void string(const TString* ts);
+		void table(const Table* t, uint32_t depth, uint32_t from);
+	};
+
+	static bool isIdentifier(const TString* ts) {
+		const char* s = getstr(ts);
+		if (!ts->len || !(isalpha((uint8_t)s[0]) || s[0] == '_'))
+			return false;
+
+		return std::all_of(s + 1, s + ts->len, [](uint8_t c) { return isalnum(c) || c == '_'; });
+	}
+
+	void ValueRenderer::string(const TString* ts) {
+		// strings always get a little room so that keys stay recognizable when the budget runs out
+		const size_t room = std::max<size_t>(full() ? 0 : options.bytes - out.size(), 16);
+		const size_t shown = std::min<size_t>(ts->len, room);
+
+		out += '"';
+		out.append(getstr(ts), shown);
+		out += '"';
+
+		if (shown < ts->len)
+			out += std::format("... ({} bytes)", ts->len);
+	}
+
+	void ValueRenderer::key(const TValue* k) {
+		if (ttisstring(k) && isIdentifier(tsvalue(k))) {
+			out.append(getstr(tsvalue(k)), tsvalue(k)->len);
+			return;
+		}
+
+		out += '[';
+		value(k, 0, 0);
+		out += ']';
+	}
+
+	void ValueRenderer::table(const Table* t, uint32_t depth, uint32_t from) {
+		const uint32_t sizearray = (uint32_t)t->sizearray;
+		const uint32_t sizehash = t->node == dummynode ? 0 : (uint32_t)sizenode(t);
+
+		out += std::format("table 0x{:x} [array {}, hash {}]", (uintptr_t)t, sizearray, sizehash);
+		if (t->metatable)
+			out += std::format(" <metatable 0x{:x}>", (uintptr_t)t->metatable);
+
+		if (std::find(path.begin(), path.end(), t) != path.end()) {
+			out += " <cycle>";
+			return;
+		}
+
+		if (!depth || full()) {
+			out += " {...}";
+			return;
+		}
+
+		path.push_back(t);
+		out += " {";
+
+		// empty slots count against the scan budget too, so sparse tables can't stall rendering
+		const uint32_t slots = sizearray + sizehash;
+		const uint32_t maxScan = options.width * 16 + 64;
+
+		uint32_t shown = 0;
+		uint32_t scanned = 0;
+		uint32_t slot = from;
+		for (; slot < slots; slot++) {
+			if (shown == options.width || scanned == maxScan || full())
+				break;
+			scanned++;
+
+			TValue k;
+			const TValue* v;
+			if (slot < sizearray) {
+				v = &t->array[slot];
+				if (ttisnil(v))
+					continue;
+
+				setnvalue(&k, slot + 1);
+			} else {
+				const LuaNode* n = gnode(t, slot - sizearray);
+				v = gval(n);
+				if (ttisnil(v))
+					continue;
+
+				k.value = n->key.value;
+				memcpy(k.extra, n->key.extra, sizeof(k.extra));
+				k.tt = n->key.tt;
+			}
+
+			out += shown ? ", " : " ";
+			key(&k);
+			out += " = ";
+			value(v, depth - 1, 0);
+			shown++;
+		}
+
+		if (slot < slots)
+			out += std::format("{}... from={}", shown ? ", " : " ", slot);
+
+		out += " }";
+		path.pop_back();
+	}
+
+	void ValueRenderer::value(const TValue* o, uint32_t depth, uint32_t from) {
+		switch (ttype(o)) {
+		case LUA_TSTRING:
+			string(tsvalue(o));
+			break;
+		case LUA_TTABLE:
+			table(hvalue(o), depth, from);
+			break;
+		case LUA_TFUNCTION: {
+			const Closure* cl = clvalue(o);
+			if (cl->isC) {
+				out += std::format("function '{}' [C, {} upvalues]", cl->c.debugname ? cl->c.debugname : "??", cl->nupvalues);
+			} else {
+				const Proto* p = cl->l.p;
+
+				char ss[LUA_IDSIZE];
+				const char* source = p->source ? luaO_chunkid(ss, sizeof(ss), getstr(p->source), p->source->len) : "?";
+				out += std::format("function '{}' at {}:{} [{} upvalues]", p->debugname ? getstr(p->debugname) : "??", source, p->linedefined, cl->nupvalues);
+			}
+		} break;
+		case LUA_TUSERDATA: {
+			const Udata* u = uvalue(o);
+			out += std::format("userdata 0x{:x} [tag {}, {} bytes]", (uintptr_t)u, u->tag, u->len);
+			if (u->metatable)
+				out += std::format(" <metatable 0x{:x}>", (uintptr_t)u->metatable);
+		} break;
+		case LUA_TLIGHTUSERDATA:
+			out += std::format("lightuserdata 0x{:x}", (uintptr_t)pvalue(o));
+			break;
+		case LUA_TVECTOR: {
+			const float* v = vvalue(o);
+#if LUA_VECTOR_SIZE == 4
+			out += std::format("vector({}, {}, {}, {})", v[0], v[1], v[2], v[3]);
+#else
+			out += std::format("vector({}, {}, {})", v[0], v[1], v[2]);
+#endif
+		} break;
+		case LUA_TBUFFER: {
+			const Buffer* b = bufvalue(o);
+			out += std::format("buffer 0x{:x} [{} bytes]", (uintptr_t)b, b->len);
+
+			const uint32_t shown = std::min<uint32_t>(b->len, 16);
+			for (uint32_t i = 0; i < shown; i++)
+				out += std::format(" {:02x}", (uint8_t)b->data[i]);
+			if (shown < b->len)
+				out += " ...";
+		} break;
+		case LUA_TTHREAD: {
+			const lua_State* th = thvalue(o);
+			out += std::format("thread 0x{:x} [status {}, depth {}]", (uintptr_t)th, th->status, (int)(th->ci - th->base_ci));
+		} break;
+		default:
+			out += lua_strprimitive(o);
+			break;
+		}
+	}
+
+	std::string renderValue(const TValue* o, const RenderOptions& options) {
+		ValueRenderer r = { options };
+		r.value(o, options.depth, options.from);
+		return std::move(r.out);
+	}
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+#include <lstate.h>
+
+namespace ldbg {
+	struct RenderOptions {
+		uint32_t depth = 2;		// nesting levels of tables that get expanded
+		uint32_t width = 16;	// entries shown per table
+		size_t bytes = 1024;	// soft limit on the length of the output
+		uint32_t from = 0;		// first slot of the outermost table to show
+	};
+
+	/// <summary>
+	/// Renders any value into a human readable string. Tables are expanded up to the
+	/// configured depth and width, and the amount of work is bounded by the options
+	/// rather than by the size of the value
+	/// </summary>
+	/// <param name="o">Value to render</param>
+	/// <param name="options">Rendering budgets</param>
+	std::string renderValue(const TValue* o, const RenderOptions& options = {});
+}
@@ -0,0 +1,240 @@
+#include "sites.h"
+
+#include <iterator>
+
+#include <ltable.h>
+#include <Luau/Bytecode.h>
+
+#include "disasm.h"
+
+namespace ldbg {
+	static uint8_t realOp(const Proto* p, const Instruction* pc) {
+		uint8_t op = LUAU_INSN_OP(*pc);
+		if (op == LOP_BREAK && p->debuginsn)
+			op = p->debuginsn[pc - p->code];
+		return op;
+	}
+
+	void ProtoPins::pin(lua_State* L, const TValue* func) {
+		if (!pinned.insert(clvalue(func)->l.p).second)
+			return;
+
+		if (ref == LUA_NOREF) {
+			lua_newtable(L);
+			ref = lua_ref(L, -1);
+			lua_pop(L, 1);
+		}
+
+		lua_getref(L, ref);
+		setobj2s(L, L->top, func);
+		incr_top(L);
+		lua_pushboolean(L, true);
+		lua_rawset(L, -3);
+		lua_pop(L, 1);
+	}
+
+	void ProtoPins::clear(lua_State* L) {
+		lua_unref(L, ref);
+		ref = LUA_NOREF;
+		pinned.clear();
+	}
+
+	void FastcallSites::start(lua_State* L) {
+		clear(L);
+		running = true;
+	}
+
+	void FastcallSites::clear(lua_State* L) {
+		list.clear();
+		byInsn.clear();
+		pins.clear(L);
+	}
+
+	void FastcallSites::onStep(lua_State* L, Proto* p, const Instruction* pc) {
+		const uint8_t op = realOp(p, pc);
+		switch (op) {
+		case LOP_FASTCALL:
+		case LOP_FASTCALL1:
+		case LOP_FASTCALL2:
+		case LOP_FASTCALL2K:
+		case LOP_FASTCALL3:
+		case LOP_CALL:
+			break;
+		default:
+			return;
+		}
+
+		auto it = byInsn.find(pc);
+		if (it != byInsn.end()) {
+			FastcallSite& site = list[it->second];
+			if (op != LOP_CALL) {
+				site.executed++;
+				return;
+			}
+
+			site.fallbacks++;
+
+			// the fast call skips the instructions that load the function, so it's only in place once one falls back
+			const TValue* func = L->ci->base + LUAU_INSN_A(*pc);
+			if (site.name.empty() && ttisfunction(func) && clvalue(func)->isC && clvalue(func)->c.debugname)
+				site.name = clvalue(func)->c.debugname;
+			return;
+		}
+
+		// a plain call, or a fallback whose fast call ran before counting started
+		if (op == LOP_CALL)
+			return;
+
+		const Instruction* call = fastcallFallback(p, pc);
+		if (!call)
+			return;
+
+		const FastcallSite site = { p, (int)(pc - p->code), (int)(call - p->code), (uint8_t)LUAU_INSN_A(*pc), "", 1, 0 };
+
+		pins.pin(L, L->ci->func);
+
+		const uint32_t index = (uint32_t)list.size();
+		list.push_back(site);
+		byInsn[pc] = index;
+		byInsn[call] = index;
+	}
+
+	void SlotSites::start(lua_State* L) {
+		clear(L);
+		running = true;
+	}
+
+	void SlotSites::clear(lua_State* L) {
+		list.clear();
+		byInsn.clear();
+		pins.clear(L);
+	}
+
+	// whether the hinted node of a table holds the key
+	static bool slotHolds(const Table* h, uint8_t hint, const TString* key) {
+		const LuaNode* n = &h->node[hint & h->nodemask8];
+		return ttisstring(gkey(n)) && tsvalue(gkey(n)) == key && !ttisnil(gval(n));
+	}
+
+	void SlotSites::onStep(lua_State* L, Proto* p, const Instruction* pc) {
+		const uint8_t op = realOp(p, pc);
+		if (op != LOP_GETTABLEKS && op != LOP_SETTABLEKS && op != LOP_NAMECALL)
+			return;
+
+		auto [it, inserted] = byInsn.try_emplace(pc, (uint32_t)list.size());
+		if (inserted) {
+			pins.pin(L, L->ci->func);
+
+			SlotSite& site = list.emplace_back();
+			site.p = p;
+			site.pc = (int)(pc - p->code);
+			site.op = op;
+			site.key = tsvalue(&p->k[pc[1]]);
+			site.hits = site.misses = site.others = 0;
+			site.shapeCount = 0;
+			site.otherShapes = 0;
+		}
+
+		SlotSite& site = list[it->second];
+
+		const TValue* rb = L->ci->base + LUAU_INSN_B(*pc);
+		if (!ttistable(rb)) {
+			site.others++;
+			return;
+		}
+
+		const Table* h = hvalue(rb);
+		const uint8_t hint = (uint8_t)LUAU_INSN_C(*pc);
+
+		bool hit = slotHolds(h, hint, site.key);
+		if (op == LOP_SETTABLEKS)
+			hit = hit && !h->readonly;
+		else if (op == LOP_NAMECALL && !hit && h->metatable && ttisnil(luaH_getstr((Table*)h, (TString*)site.key))) {
+			// methods usually live in the __index table, where the hint applies as well
+			const TValue* index = luaH_getstr(h->metatable, L->global->tmname[TM_INDEX]);
+			hit = ttistable(index) && slotHolds(hvalue(index), hint, site.key);
+		}
+
+		if (hit)
+			site.hits++;
+		else
+			site.misses++;
+
+		for (uint8_t i = 0; i < site.shapeCount; i++) {
+			TableShape& shape = site.shapes[i];
+			if (shape.metatable == h->metatable && shape.sizearray == h->sizearray && shape.lsizenode == h->lsizenode) {
+				shape.count++;
+				return;
+			}
+		}
+
+		if (site.shapeCount < std::size(site.shapes))
+			site.shapes[site.shapeCount++] = { h->metatable, h->sizearray, h->lsizenode, 1 };
+		else
+			site.otherShapes++;
+	}
+
+	void ClosureSites::start(lua_State* L) {
+		clear(L);
+		running = true;
+	}
+
+	void ClosureSites::clear(lua_State* L) {
+		list.clear();
+		byInsn.clear();
+		pins.clear(L);
+	}
+
+	void ClosureSites::onStep(lua_State* L, Proto* p, const Instruction* pc) {
+		const uint8_t op = realOp(p, pc);
+		if (op != LOP_NEWCLOSURE && op != LOP_DUPCLOSURE)
+			return;
+
+		const Closure* kcl = op == LOP_DUPCLOSURE ? clvalue(&p->k[LUAU_INSN_D(*pc)]) : nullptr;
+		const Proto* child = kcl ? kcl->l.p : p->p[LUAU_INSN_D(*pc)];
+
+		auto [it, inserted] = byInsn.try_emplace(pc, (uint32_t)list.size());
+		if (inserted) {
+			pins.pin(L, L->ci->func);
+
+			ClosureSite& site = list.emplace_back();
+			site.p = p;
+			site.pc = (int)(pc - p->code);
+			site.op = op;
+			site.child = child;
+			site.byValue = site.byReference = site.fromUpvalue = 0;
+			site.runs = site.allocations = 0;
+
+			// the captures follow the instruction, one per upvalue
+			for (int i = 1; i <= child->nups && pc + i < p->code + p->sizecode; i++) {
+				switch (LUAU_INSN_A(pc[i])) {
+				case LCT_VAL: site.byValue++; break;
+				case LCT_REF: site.byReference++; break;
+				case LCT_UPVAL: site.fromUpvalue++; break;
+				}
+			}
+
+			site.loopDepth = loopDepths(p)[site.pc];
+		}
+
+		ClosureSite& site = list[it->second];
+		site.runs++;
+
+		if (!kcl) {
+			site.allocations++;
+			return;
+		}
+
+		// the constant closure is shared while it runs in the same environment and captures the same values
+		const Closure* cl = clvalue(L->ci->func);
+		bool shared = kcl->env == cl->env;
+		for (int i = 0; shared && kcl->preload == 0 && i < kcl->nupvalues; i++) {
+			const Instruction capture = pc[1 + i];
+			const TValue* uv = LUAU_INSN_A(capture) == LCT_VAL ? L->ci->base + LUAU_INSN_B(capture) : &cl->l.uprefs[LUAU_INSN_B(capture)];
+			shared = luaO_rawequalObj(&kcl->l.uprefs[i], uv);
+		}
+
+		if (!shared)
+			site.allocations++;
+	}
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <lua.h>
+#include <lstate.h>
+
+namespace ldbg {
+	/// <summary>
+	/// Keeps the protos that sites point into alive until the sites are cleared, so that their code, constants
+	/// and names can still be read by a report and their instruction addresses aren't reused for other code.
+	/// The first closure seen running each proto is pinned in a registry table
+	/// </summary>
+	class ProtoPins {
+	public:
+		void pin(lua_State* L, const TValue* func);
+		void clear(lua_State* L);
+
+	private:
+		int ref = LUA_NOREF;
+		std::unordered_set<const Proto*> pinned;
+	};
+
+	struct FastcallSite {
+		Proto* p;
+		// the FASTCALL and the CALL it falls back to
+		int pc;
+		int call;
+		uint8_t builtin;
+		// the function the fallback calls; only known once the site has fallen back
+		std::string name;
+
+		uint64_t executed;
+		uint64_t fallbacks;
+	};
+
+	/// <summary>
+	/// Counts how often each builtin fast path runs and how often it falls back. A FASTCALL that succeeds
+	/// skips the CALL after its arguments, so reaching that CALL is exactly a fallback. Fed from the
+	/// single-step hook, sites are registered the first time they run
+	/// </summary>
+	class FastcallSites {
+	public:
+		bool active() const { return running; }
+
+		/// <summary>
+		/// Discards the previous counts and starts counting
+		/// </summary>
+		void start(lua_State* L);
+		void stop() { running = false; }
+
+		/// <summary>
+		/// Discards the counts and unpins the protos of the sites
+		/// </summary>
+		void clear(lua_State* L);
+
+		/// <summary>
+		/// Counts the instruction about to run if it's a fast call or the call it falls back to
+		/// </summary>
+		void onStep(lua_State* L, Proto* p, const Instruction* pc);
+
+		const std::vector<FastcallSite>& sites() const { return list; }
+
+	private:
+		bool running = false;
+
+		std::vector<FastcallSite> list;
+		// the FASTCALL and CALL instructions of every site
+		std::unordered_map<const Instruction*, uint32_t> byInsn;
+		ProtoPins pins;
+	};
+
+	struct TableShape {
+		const Table* metatable;
+		int sizearray;
+		uint8_t lsizenode;
+		uint64_t count;
+	};
+
+	struct SlotSite {
+		Proto* p;
+		int pc;
+		uint8_t op;
+		const TString* key;
+
+		uint64_t hits;
+		uint64_t misses;
+		// runs on values other than tables, which don't use the hint
+		uint64_t others;
+
+		// the first shapes seen; the rest are only counted
+		TableShape shapes[4];
+		uint8_t shapeCount;
+		uint64_t otherShapes;
+	};
+
+	/// <summary>
+	/// Counts how often the hash slot predicted by GETTABLEKS, SETTABLEKS and NAMECALL holds the key, checked the
+	/// way the VM does before the instruction runs. NAMECALL on a table without the method checks its __index
+	/// table as well. Tables are told apart by metatable and part sizes
+	/// </summary>
+	class SlotSites {
+	public:
+		bool active() const { return running; }
+
+		/// <summary>
+		/// Discards the previous counts and starts counting
+		/// </summary>
+		void start(lua_State* L);
+		void stop() { running = false; }
+
+		/// <summary>
+		/// Discards the counts and unpins the protos of the sites
+		/// </summary>
+		void clear(lua_State* L);
+
+		/// <summary>
+		/// Counts the instruction about to run if it looks up a constant key
+		/// </summary>
+		void onStep(lua_State* L, Proto* p, const Instruction* pc);
+
+		const std::vector<SlotSite>& sites() const { return list; }
+
+	private:
+		bool running = false;
+
+		std::vector<SlotSite> list;
+		std::unordered_map<const Instruction*, uint32_t> byInsn;
+		ProtoPins pins;
+	};
+
+	struct ClosureSite {
+		Proto* p;
+		int pc;
+		uint8_t op;
+		const Proto* child;
+
+		// how the upvalues are captured; only references allocate upvalue objects, once per open local
+		uint8_t byValue;
+		uint8_t byReference;
+		uint8_t fromUpvalue;
+
+		// loops enclosing the site, 0 outside of loops
+		uint8_t loopDepth;
+
+		uint64_t runs;
+		uint64_t allocations;
+	};
+
+	/// <summary>
+	/// Counts closures created per NEWCLOSURE and DUPCLOSURE site. NEWCLOSURE always allocates, DUPCLOSURE only
+	/// when the constant closure can't be shared, which is predicted the way the VM decides it
+	/// </summary>
+	class ClosureSites {
+	public:
+		bool active() const { return running; }
+
+		/// <summary>
+		/// Discards the previous counts and starts counting
+		/// </summary>
+		void start(lua_State* L);
+		void stop() { running = false; }
+
+		/// <summary>
+		/// Discards the counts and unpins the protos of the sites
+		/// </summary>
+		void clear(lua_State* L);
+
+		/// <summary>
+		/// Counts the instruction about to run if it creates a closure
+		/// </summary>
+		void onStep(lua_State* L, Proto* p, const Instruction* pc);
+
+		const std::vector<ClosureSite>& sites() const { return list; }
+
+	private:
+		bool running = false;
+
+		std::vector<ClosureSite> list;
+		std::unordered_map<const Instruction*, uint32_t> byInsn;
+		ProtoPins pins;
+	};
+}
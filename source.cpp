@@ -0,0 +1,106 @@
+#include "source.h"
+
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace ldbg {
+	std::unique_ptr<SourceFile> SourceFile::open(const std::string& path) {
+		std::unique_ptr<SourceFile> sf(new SourceFile());
+
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return nullptr;
+		sf->file = file;
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size))
+			return nullptr;
+		sf->size = (size_t)size.QuadPart;
+
+		if (sf->size) {
+			HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (!mapping)
+				return nullptr;
+			sf->mapping = mapping;
+
+			sf->data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			if (!sf->data)
+				return nullptr;
+		}
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return nullptr;
+
+		struct stat st;
+		if (fstat(fd, &st) != 0) {
+			close(fd);
+			return nullptr;
+		}
+		sf->size = (size_t)st.st_size;
+
+		if (sf->size) {
+			void* data = mmap(nullptr, sf->size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (data == MAP_FAILED) {
+				sf->size = 0;
+				close(fd);
+				return nullptr;
+			}
+			sf->data = (const char*)data;
+		}
+
+		// the mapping stays valid after the descriptor is closed
+		close(fd);
+#endif
+
+		size_t pos = 0;
+		while (pos < sf->size) {
+			sf->lines.push_back(pos);
+
+			const char* nl = (const char*)memchr(sf->data + pos, '\n', sf->size - pos);
+			if (!nl)
+				break;
+			pos = (size_t)(nl - sf->data) + 1;
+		}
+
+		return sf;
+	}
+
+	SourceFile::~SourceFile() {
+#ifdef _WIN32
+		if (data)
+			UnmapViewOfFile(data);
+		if (mapping)
+			CloseHandle(mapping);
+		if (file)
+			CloseHandle(file);
+#else
+		if (data)
+			munmap((void*)data, size);
+#endif
+	}
+
+	std::string_view SourceFile::line(uint32_t n) const {
+		if (n < 1 || n > lines.size())
+			return {};
+
+		size_t start = lines[n - 1];
+		size_t end = n < lines.size() ? lines[n] - 1 : size;
+		if (end > start && data[end - 1] == '\n')
+			end--;
+		if (end > start && data[end - 1] == '\r')
+			end--;
+
+		return std::string_view(data + start, end - start);
+	}
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <string_view>
+
+namespace ldbg {
+	/// <summary>
+	/// A read-only, memory-mapped source file with a precomputed line offset index
+	/// </summary>
+	class SourceFile {
+	public:
+		/// <summary>
+		/// Maps the provided file and indexes the start of every line
+		/// </summary>
+		/// <param name="path">Path of the file to map</param>
+		/// <returns>The mapped file or nullptr if it couldn't be opened</returns>
+		static std::unique_ptr<SourceFile> open(const std::string& path);
+
+		~SourceFile();
+
+		SourceFile(const SourceFile&) = delete;
+		SourceFile& operator=(const SourceFile&) = delete;
+
+		/// <summary>
+		/// Returns the number of lines in the file
+		/// </summary>
+		uint32_t lineCount() const { return (uint32_t)lines.size(); }
+
+		/// <summary>
+		/// Returns the contents of a line without its terminator
+		/// </summary>
+		/// <param name="n">1-based line number</param>
+		std::string_view line(uint32_t n) const;
+
+	private:
+		SourceFile() = default;
+
+		const char* data = nullptr;
+		size_t size = 0;
+
+#ifdef _WIN32
+		void* file = nullptr;
+		void* mapping = nullptr;
+#endif
+
+		std::vector<size_t> lines;
+	};
+}
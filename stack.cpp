@@ -0,0 +1,125 @@
+#include "stack.h"
+
+#include <format>
+#include <cstring>
+#include <algorithm>
+
+#include <ldebug.h>
+
+namespace ldbg {
+	StackCapture::StackCapture(size_t maxFrames, size_t maxStacks, uint32_t maxDepth)
+		: frames(std::max<size_t>(maxFrames, maxDepth)), stacks(maxStacks ? maxStacks : 1), maxDepth(maxDepth) {}
+
+	bool StackCapture::capture(lua_State* L, const char* message, uint32_t skip) {
+		if (stackCount == stacks.size()) {
+			droppedCount++;
+			return false;
+		}
+
+		CapturedStack& stack = stacks[stackCount];
+		stack.first = (uint32_t)frameCount;
+		stack.count = 0;
+		stack.truncated = false;
+
+		for (CallInfo* ci = L->ci; ci > L->base_ci; ci--) {
+			if (skip) {
+				skip--;
+				continue;
+			}
+
+			if (stack.count == maxDepth) {
+				stack.truncated = true;
+				break;
+			}
+
+			if (frameCount == frames.size()) {
+				frameCount = stack.first;
+				droppedCount++;
+				return false;
+			}
+
+			const Closure* cl = clvalue(ci->func);
+			CapturedFrame& frame = frames[frameCount++];
+			if (cl->isC) {
+				frame.p = nullptr;
+				frame.cfunc = cl->c.debugname;
+				frame.pc = -1;
+			} else {
+				pin(L, ci->func);
+				frame.p = cl->l.p;
+				frame.cfunc = nullptr;
+				frame.pc = ci->savedpc ? std::max((int)(ci->savedpc - cl->l.p->code) - 1, 0) : 0;
+			}
+			stack.count++;
+		}
+
+		if (message) {
+			strncpy(stack.message, message, sizeof(stack.message) - 1);
+			stack.message[sizeof(stack.message) - 1] = '\0';
+		} else
+			stack.message[0] = '\0';
+
+		stackCount++;
+		return true;
+	}
+
+	void StackCapture::pin(lua_State* L, const TValue* func) {
+		if (!pinned.insert(clvalue(func)->l.p).second)
+			return;
+
+		if (pins == LUA_NOREF) {
+			lua_newtable(L);
+			pins = lua_ref(L, -1);
+			lua_pop(L, 1);
+		}
+
+		lua_getref(L, pins);
+		setobj2s(L, L->top, func);
+		incr_top(L);
+		lua_pushboolean(L, true);
+		lua_rawset(L, -3);
+		lua_pop(L, 1);
+	}
+
+	void StackCapture::clear(lua_State* L) {
+		frameCount = 0;
+		stackCount = 0;
+		droppedCount = 0;
+
+		lua_unref(L, pins);
+		pins = LUA_NOREF;
+		pinned.clear();
+	}
+
+	FrameSymbol Symbolizer::symbolize(const CapturedFrame& frame) {
+		if (!frame.p)
+			return { frame.cfunc ? frame.cfunc : "??", "[C]", -1 };
+
+		auto it = protos.find(frame.p);
+		if (it == protos.end()) {
+			char ss[LUA_IDSIZE];
+
+			ProtoSymbol symbol;
+			symbol.function = frame.p->debugname ? getstr(frame.p->debugname) : "??";
+			symbol.source = luaO_chunkid(ss, sizeof(ss), getstr(frame.p->source), frame.p->source->len);
+			it = protos.emplace(frame.p, std::move(symbol)).first;
+		}
+
+		const int line = frame.p->lineinfo ? luaG_getline((Proto*)frame.p, frame.pc) : 0;
+		return { it->second.function, it->second.source, line };
+	}
+
+	void Symbolizer::format(const StackCapture& capture, size_t index, std::string& out) {
+		uint32_t level = 0;
+		for (const CapturedFrame& frame : capture.framesOf(index)) {
+			const FrameSymbol symbol = symbolize(frame);
+			if (symbol.line < 0)
+				out += std::format("  {} - {} {}\n", ++level, symbol.source, symbol.function);
+			else
+				out += std::format("  {} - {}:{} {}\n", ++level, symbol.source, symbol.line, symbol.function);
+		}
+
+		if (capture.stack(index).truncated)
+			out += "  ...\n";
+	}
+}
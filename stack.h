@@ -0,0 +1,112 @@
+#pragma once
+
+#include <span>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <lstate.h>
+
+namespace ldbg {
+	/// <summary>
+	/// A frame as it was on the stack. C frames have no proto and keep their function's debug name instead
+	/// </summary>
+	struct CapturedFrame {
+		const Proto* p;
+		const char* cfunc;
+		int pc;
+	};
+
+	struct CapturedStack {
+		uint32_t first;
+		uint32_t count;
+
+		// frames past the depth limit were left out
+		bool truncated;
+		// error message or the like, cut to fit
+		char message[120];
+	};
+
+	/// <summary>
+	/// Records stacks as raw (Proto*, pc) pairs into buffers allocated up front, so capturing never builds
+	/// strings. Protos are only read when symbolizing, so the first closure seen of each one is pinned in a
+	/// registry table until the captures are cleared; that is the only allocation, once per distinct proto
+	/// </summary>
+	class StackCapture {
+	public:
+		explicit StackCapture(size_t maxFrames = 16 * 1024, size_t maxStacks = 1024, uint32_t maxDepth = 64);
+
+		/// <summary>
+		/// Records the frames of a thread, innermost first
+		/// </summary>
+		/// <param name="message">Copied along with the frames; may be null</param>
+		/// <param name="skip">Number of innermost frames to leave out, e.g. an error handler's</param>
+		/// <returns>False if there was no room; the stack is counted as dropped</returns>
+		bool capture(lua_State* L, const char* message = nullptr, uint32_t skip = 0);
+
+		/// <summary>
+		/// Returns whether a stack of the maximum depth might not fit anymore
+		/// </summary>
+		bool full() const { return stackCount == stacks.size() || frames.size() - frameCount < maxDepth; }
+
+		size_t size() const { return stackCount; }
+		size_t dropped() const { return droppedCount; }
+
+		const CapturedStack& stack(size_t index) const { return stacks[index]; }
+		std::span<const CapturedFrame> framesOf(size_t index) const { return { frames.data() + stacks[index].first, stacks[index].count }; }
+
+		/// <summary>
+		/// Drops the captured stacks and unpins their protos
+		/// </summary>
+		void clear(lua_State* L);
+
+	private:
+		std::vector<CapturedFrame> frames;
+		size_t frameCount = 0;
+
+		std::vector<CapturedStack> stacks;
+		size_t stackCount = 0;
+
+		uint32_t maxDepth;
+		size_t droppedCount = 0;
+
+		// closures keeping the protos of the captured frames alive, by proto
+		int pins = LUA_NOREF;
+		std::unordered_set<const Proto*> pinned;
+
+		void pin(lua_State* L, const TValue* func);
+	};
+
+	struct FrameSymbol {
+		std::string_view function;
+		std::string_view source;
+		int line;
+	};
+
+	/// <summary>
+	/// Resolves captured frames to source locations. Function and source names are resolved once per proto
+	/// and kept until cleared, which has to happen whenever the captures unpin their protos
+	/// </summary>
+	class Symbolizer {
+	public:
+		FrameSymbol symbolize(const CapturedFrame& frame);
+
+		/// <summary>
+		/// Appends a traceback of a captured stack, one line per frame
+		/// </summary>
+		void format(const StackCapture& capture, size_t index, std::string& out);
+
+		void clear() { protos.clear(); }
+
+	private:
+		struct ProtoSymbol {
+			std::string function;
+			std::string source;
+		};
+
+		std::unordered_map<const Proto*, ProtoSymbol> protos;
+	};
+}
@@ -0,0 +1,6 @@
+# stops at the first instruction, then in shadow() with value nil and seen false
+break test-eval.luau:8
+continue
+seen = value
+value = 5
+continue
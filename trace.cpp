@@ -0,0 +1,164 @@
+#include "trace.h"
+
+#include <chrono>
+#include <format>
+#include <algorithm>
+
+#include <ldebug.h>
+
+#include "json.h"
+
+namespace ldbg {
+	// symbol of frames whose entry didn't fit
+	static constexpr uint32_t noSymbol = UINT32_MAX;
+
+	uint64_t Tracer::now() {
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	void Tracer::start(size_t capacity) {
+		buffers.clear();
+		live.clear();
+		lastThread = nullptr;
+
+		symbolIds.clear();
+		symbols.clear();
+
+		limit = std::max<size_t>(capacity, 1024);
+		recorded = 0;
+		droppedCount = 0;
+		running = true;
+	}
+
+	void Tracer::stop() {
+		if (!running)
+			return;
+
+		const uint64_t ns = now();
+		for (ThreadBuffer& buffer : buffers) {
+			while (!buffer.frames.empty())
+				exit(buffer, ns);
+		}
+
+		live.clear();
+		lastThread = nullptr;
+		running = false;
+	}
+
+	Tracer::ThreadBuffer& Tracer::bufferOf(lua_State* L) {
+		if (L == lastThread)
+			return buffers[lastBuffer];
+
+		auto [it, inserted] = live.try_emplace(L, buffers.size());
+		if (inserted) {
+			ThreadBuffer& buffer = buffers.emplace_back();
+			buffer.thread = L;
+			buffer.name = L == L->global->mainthread ? "main" : std::format("thread 0x{:x}", (uintptr_t)L);
+			// most threads only run a handful of calls; the main one gets a head start
+			buffer.records.reserve(std::min<size_t>(limit, L == L->global->mainthread ? 64 * 1024 : 256));
+		}
+
+		lastThread = L;
+		lastBuffer = it->second;
+		return buffers[lastBuffer];
+	}
+
+	uint32_t Tracer::symbolOf(const Closure* cl) {
+		const void* key = cl->isC ? (const void*)cl->c.f : (const void*)cl->l.p;
+
+		auto [it, inserted] = symbolIds.try_emplace(key, (uint32_t)symbols.size());
+		if (inserted) {
+			Symbol& symbol = symbols.emplace_back();
+			if (cl->isC)
+				symbol.name = cl->c.debugname ? cl->c.debugname : "[C]";
+			else {
+				const Proto* p = cl->l.p;
+				char ss[LUA_IDSIZE];
+				symbol.name = p->debugname ? getstr(p->debugname) : "anonymous";
+				symbol.location = std::format("{}:{}", luaO_chunkid(ss, sizeof(ss), getstr(p->source), p->source->len), p->linedefined);
+			}
+		}
+		return it->second;
+	}
+
+	void Tracer::enter(ThreadBuffer& buffer, const Closure* cl, uint32_t level, uint64_t ns) {
+		uint32_t symbol = noSymbol;
+		if (recorded < limit) {
+			symbol = symbolOf(cl);
+			buffer.records.push_back({ ns, symbol, false });
+			recorded++;
+		} else
+			droppedCount++;
+
+		buffer.frames.push_back({ cl, level, symbol });
+	}
+
+	void Tracer::exit(ThreadBuffer& buffer, uint64_t ns) {
+		const Frame frame = buffer.frames.back();
+		buffer.frames.pop_back();
+
+		// the closure may be gone by now, so only the symbol taken on entry is used
+		if (frame.symbol != noSymbol)
+			buffer.records.push_back({ ns, frame.symbol, true });
+	}
+
+	void Tracer::onInterrupt(lua_State* L) {
+		const uint64_t ns = now();
+		ThreadBuffer& buffer = bufferOf(L);
+
+		followCalls(L, buffer.frames,
+			[&](const Closure* cl, uint32_t level) { enter(buffer, cl, level, ns); },
+			[&]() { exit(buffer, ns); });
+	}
+
+	void Tracer::onThreadDestroyed(lua_State* L) {
+		auto it = live.find(L);
+		if (it == live.end())
+			return;
+
+		ThreadBuffer& buffer = buffers[it->second];
+		const uint64_t ns = now();
+		while (!buffer.frames.empty())
+			exit(buffer, ns);
+
+		live.erase(it);
+		if (lastThread == L)
+			lastThread = nullptr;
+	}
+
+	size_t Tracer::write(FILE* file) const {
+		// names are escaped once, not once per event
+		std::vector<std::string> names;
+		std::vector<std::string> args;
+		for (const Symbol& symbol : symbols) {
+			names.push_back(Json(symbol.name).dump());
+			args.push_back(symbol.location.empty() ? std::string() : std::format(",\"args\":{{\"source\":{}}}", Json(symbol.location).dump()));
+		}
+
+		std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+		out += "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":1,\"args\":{\"name\":\"luau\"}}";
+
+		size_t events = 0;
+		for (size_t tid = 0; tid < buffers.size(); tid++) {
+			const ThreadBuffer& buffer = buffers[tid];
+			out += std::format(",\n{{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":{},\"args\":{{\"name\":{}}}}}", tid + 1, Json(buffer.name).dump());
+
+			for (const Record& record : buffer.records) {
+				// microseconds with the nanoseconds kept as decimals
+				out += std::format(",\n{{\"ph\":\"{}\",\"name\":{},\"cat\":\"{}\",\"pid\":1,\"tid\":{},\"ts\":{}.{:03}{}}}",
+					record.exit ? 'E' : 'B', names[record.symbol], args[record.symbol].empty() ? "c" : "luau", tid + 1,
+					record.ns / 1000, record.ns % 1000, record.exit ? "" : args[record.symbol]);
+				events++;
+
+				if (out.size() > 1 << 20) {
+					fwrite(out.data(), 1, out.size(), file);
+					out.clear();
+				}
+			}
+		}
+
+		out += "\n]}\n";
+		fwrite(out.data(), 1, out.size(), file);
+		return events;
+	}
+}
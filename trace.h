@@ -0,0 +1,148 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <unordered_map>
+
+#include <lua.h>
+#include <lstate.h>
+#include <Luau/Bytecode.h>
+
+namespace ldbg {
+	/// <summary>
+	/// Brings the shadow stack of a thread up to date at a safe point of the interrupt hook. Frames that are gone
+	/// since the last one are exited, frames entered without passing one (called from C, or already running
+	/// when tracking started) are entered, then the call or return about to run is applied.
+	/// Frames need the closure and level they were entered with; enter and exit push and pop them
+	/// </summary>
+	template<typename Frame, typename Enter, typename Exit>
+	void followCalls(lua_State* L, const std::vector<Frame>& frames, Enter&& enter, Exit&& exit) {
+		const uint32_t level = (uint32_t)(L->ci - L->base_ci);
+
+		while (!frames.empty()) {
+			const Frame& top = frames.back();
+			if (top.level <= level && clvalue((L->base_ci + top.level)->func) == top.cl)
+				break;
+			exit();
+		}
+
+		for (uint32_t i = frames.empty() ? 1 : frames.back().level + 1; i <= level; i++)
+			enter(clvalue((L->base_ci + i)->func), i);
+
+		const Closure* cl = clvalue(L->ci->func);
+		if (cl->isC || level == 0)
+			return;
+
+		const Proto* p = cl->l.p;
+		const Instruction* pc = L->ci->savedpc - 1;
+
+		uint8_t op = LUAU_INSN_OP(*pc);
+		if (op == LOP_BREAK && p->debuginsn)
+			op = p->debuginsn[pc - p->code];
+
+		if (op == LOP_CALL) {
+			// the interrupt runs before the call, so the callee is entered right here
+			const TValue* func = L->ci->base + LUAU_INSN_A(*pc);
+			if (ttisfunction(func))
+				enter(clvalue(func), level + 1);
+		} else if (op == LOP_RETURN && !frames.empty() && frames.back().level == level)
+			exit();
+	}
+
+	/// <summary>
+	/// Timeline of function entries and exits, driven by the interrupt hook so that singlestep can stay off.
+	/// A shadow stack per thread is reconciled with the real one at every call, return and loop back-edge;
+	/// calls and returns of Luau functions are timed exactly, frames that end elsewhere (C functions,
+	/// errors) are closed at the next safe point of their caller. Records go into per-thread binary buffers
+	/// and are only turned into text on export
+	/// </summary>
+	class Tracer {
+	public:
+		bool active() const { return running; }
+
+		/// <summary>
+		/// Discards the previous trace and starts a new one
+		/// </summary>
+		/// <param name="capacity">Number of calls recorded over all threads; later ones are dropped along with their exits</param>
+		void start(size_t capacity);
+
+		/// <summary>
+		/// Closes the frames that are still open and stops recording; the trace is kept until the next start
+		/// </summary>
+		void stop();
+
+		/// <summary>
+		/// Records the transitions since the last safe point of a thread
+		/// </summary>
+		void onInterrupt(lua_State* L);
+
+		/// <summary>
+		/// Closes the frames of a thread that's going away; its records are kept
+		/// </summary>
+		void onThreadDestroyed(lua_State* L);
+
+		/// <summary>
+		/// Writes the trace in the Chrome trace-event format, which Perfetto loads as well. Timestamps are
+		/// steady clock microseconds, so they line up with native spans taken from the same clock
+		/// </summary>
+		/// <returns>The number of events written</returns>
+		size_t write(FILE* file) const;
+
+		size_t size() const { return recorded; }
+		size_t capacity() const { return limit; }
+		size_t dropped() const { return droppedCount; }
+		size_t threadCount() const { return buffers.size(); }
+
+	private:
+		struct Record {
+			uint64_t ns;
+			uint32_t symbol;
+			bool exit;
+		};
+
+		struct Frame {
+			const Closure* cl;
+			uint32_t level;
+			// taken on entry; entries dropped for lack of room leave out their exit as well
+			uint32_t symbol;
+		};
+
+		struct ThreadBuffer {
+			lua_State* thread;
+			std::string name;
+			std::vector<Record> records;
+			std::vector<Frame> frames;
+		};
+
+		struct Symbol {
+			std::string name;
+			// where a Luau function is defined, empty for C functions
+			std::string location;
+		};
+
+		bool running = false;
+		size_t limit = 0;
+		size_t recorded = 0;
+		size_t droppedCount = 0;
+
+		// buffers of destroyed threads are kept for export but can't be looked up anymore
+		std::vector<ThreadBuffer> buffers;
+		std::unordered_map<lua_State*, size_t> live;
+		lua_State* lastThread = nullptr;
+		size_t lastBuffer = 0;
+
+		// keyed by proto for Luau functions and by function pointer for C functions
+		std::unordered_map<const void*, uint32_t> symbolIds;
+		std::vector<Symbol> symbols;
+
+		static uint64_t now();
+
+		ThreadBuffer& bufferOf(lua_State* L);
+		uint32_t symbolOf(const Closure* cl);
+
+		void enter(ThreadBuffer& buffer, const Closure* cl, uint32_t level, uint64_t ns);
+		void exit(ThreadBuffer& buffer, uint64_t ns);
+	};
+}